@@ -0,0 +1,204 @@
+// combat core benchmark, runs without a window or renderer:
+//  wvv_bench [-assets dir] [-scale n] [-repeat n] [-o file]
+// results are written as json lines so two runs can be diffed directly,
+//  the checksum of each case changes only when the battle rules change
+
+#include "../cpp/core/world.h"
+
+#include <chrono>
+#include <cstdio>
+
+struct BenchResult
+{
+	std::string name;
+	uint64_t ops;
+	double ns_per_op;
+	uint64_t checksum;
+	uint64_t actions = 0;	// battle actions per run, for the battle cases
+};
+
+std::vector<BenchResult> results;
+
+uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs fn repeat times and keeps the fastest, fn returns the checksum of the work it did
+template <class F>
+void run_case(const std::string& name, uint64_t ops, uint repeat, F&& fn)
+{
+	auto best = ~(uint64_t)0;
+	uint64_t checksum = 0;
+	for (auto i = 0; i < repeat; i++)
+	{
+		auto t0 = now_ns();
+		checksum = fn();
+		best = std::min(best, now_ns() - t0);
+	}
+	results.push_back({ name, ops, (double)best / std::max((uint64_t)1, ops), checksum });
+	fprintf(stderr, "%-24s %12.1f ns/op\n", name.c_str(), results.back().ns_per_op);
+}
+
+UnitInstance make_random_unit(Rng& rng)
+{
+	std::vector<uint> cands;
+	for (auto i = 0; i < unit_datas.size(); i++)
+	{
+		if (!unit_datas[i].skillset.empty())
+			cands.push_back(i);
+	}
+	auto id = cands[rng.range(0, (int)cands.size() - 1)];
+	auto lv = (uint)rng.range(5, 50);
+	int skills[4] = { -1, -1, -1, -1 };
+	auto n = 0;
+	auto& unit_data = unit_datas[id];
+	for (auto it = unit_data.skillset.rbegin(); it != unit_data.skillset.rend() && n < 4; it++)
+	{
+		if (it->first <= lv)
+			skills[n++] = it->second;
+	}
+	if (n == 0)
+		skills[0] = unit_data.skillset.front().second;
+	UnitInstance unit;
+	unit.init(id, lv, skills);
+	return unit;
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path assets_path = "assets";
+	std::string output_path;
+	auto scale = 1U;
+	auto repeat = 5U;
+	for (auto i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+		if (arg == "-assets" && i + 1 < argc)
+			assets_path = argv[++i];
+		else if (arg == "-scale" && i + 1 < argc)
+			scale = std::max(1, atoi(argv[++i]));
+		else if (arg == "-repeat" && i + 1 < argc)
+			repeat = std::max(1, atoi(argv[++i]));
+		else if (arg == "-o" && i + 1 < argc)
+			output_path = argv[++i];
+	}
+
+	{
+		auto t0 = now_ns();
+		if (!load_skill_datas(assets_path / "skill.sht") || !load_unit_datas(assets_path / "pokemon.sht"))
+		{
+			fprintf(stderr, "cannot load sheets from %s\n", assets_path.string().c_str());
+			return 1;
+		}
+		results.push_back({ "load_sheets", 1, (double)(now_ns() - t0), skill_datas.size() * 1000 + unit_datas.size() });
+	}
+	record_replays = false;
+
+	const auto pool_size = 256U;
+	Rng pool_rng(0, 1);
+	std::vector<UnitInstance> pool;
+	for (auto i = 0; i < pool_size; i++)
+		pool.push_back(make_random_unit(pool_rng));
+
+	{
+		const uint64_t n = 1000000ULL * scale;
+		run_case("cast_skill", n, repeat, [&]() {
+			Rng rng(0, 2);
+			uint64_t checksum = 0;
+			for (auto i = 0; i < n; i++)
+			{
+				auto& caster = pool[i % pool_size];
+				auto& target = pool[(i * 7 + 3) % pool_size];
+				auto skill_id = caster.skills[i % 4];
+				if (skill_id == -1)
+					skill_id = caster.skills[0];
+				uint damage = 0;
+				StatChange caster_stat_change, target_stat_change;
+				checksum += cast_skill(caster, target, skill_id, damage, caster_stat_change, target_stat_change, rng) + damage;
+			}
+			return checksum;
+		});
+	}
+
+	{
+		const uint64_t n = 1000000ULL * scale;
+		run_case("choose_skill", n, repeat, [&]() {
+			Rng rng(0, 3);
+			uint64_t checksum = 0;
+			for (auto i = 0; i < n; i++)
+				checksum += pool[i % pool_size].choose_skill(pool[(i * 7 + 3) % pool_size], rng) + 1;
+			return checksum;
+		});
+	}
+
+	for (auto troop_size = 1; troop_size <= MAX_TROOP_UNITS; troop_size++)
+	{
+		const uint64_t n = 20000ULL * scale / troop_size;
+		std::vector<UnitInstance> sides[2];
+		BattleSim sim;
+		uint64_t actions = 0;
+		run_case("battle_" + std::to_string(troop_size) + "v" + std::to_string(troop_size), n, repeat, [&]() {
+			uint64_t checksum = 0;
+			actions = 0;
+			for (auto i = 0; i < n; i++)
+			{
+				for (auto j = 0; j < 2; j++)
+				{
+					sides[j].clear();
+					for (auto k = 0; k < troop_size; k++)
+						sides[j].push_back(pool[(i * 31 + j * 17 + k * 5) % pool_size]);
+				}
+				sim.setup(sides[0], sides[1], Rng(troop_size, i));
+				BattleEvent event;
+				while (sim.step(event))
+				{
+					checksum += event.damage;
+					actions++;
+				}
+				checksum += sim.get_winner() + 1;
+			}
+			return checksum;
+		});
+		results.back().actions = actions;
+	}
+
+	// 64x64 goes through the cached distance rows, 256x256 is too large for them and uses a*
+	for (auto map_size : { 64U, 256U })
+	{
+		tile_cx = tile_cy = map_size;
+		init_tiles();
+		const uint64_t n = (map_size == 64 ? 100000ULL : 2000ULL) * scale;
+		const auto target_count = 8U;
+		run_case("find_path_" + std::to_string(map_size) + "x" + std::to_string(map_size), n, repeat, [&]() {
+			Rng rng(map_size, 4);
+			uint64_t checksum = 0;
+			invalidate_paths();
+			for (auto i = 0; i < n; i++)
+			{
+				auto start_id = (uint)rng.range(0, (int)tiles.size() - 1);
+				auto end_id = (uint)((i % target_count) * 7919 % tiles.size());
+				auto path = find_path(start_id, end_id);
+				checksum += path.size() + (path.empty() ? 0 : path[path.size() / 2]);
+			}
+			return checksum;
+		});
+	}
+
+	auto file = output_path.empty() ? stdout : fopen(output_path.c_str(), "w");
+	if (!file)
+	{
+		fprintf(stderr, "cannot write %s\n", output_path.c_str());
+		return 1;
+	}
+	for (auto& r : results)
+	{
+		fprintf(file, "{\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"checksum\": %llu", r.name.c_str(), (unsigned long long)r.ops, r.ns_per_op, (unsigned long long)r.checksum);
+		if (r.actions > 0)
+			fprintf(file, ", \"actions\": %llu", (unsigned long long)r.actions);
+		fprintf(file, "}\n");
+	}
+	if (file != stdout)
+		fclose(file);
+	return 0;
+}
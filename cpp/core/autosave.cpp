@@ -0,0 +1,548 @@
+#include "autosave.h"
+#include "save.h"
+
+std::filesystem::path autosave_dir;
+uint autosave_compact_days = 16;
+
+// a journal block is the header, then at most one camps entry, the lord entries and the city entries.
+//  camps only ever go away, so a city may be built on the tile of a camp that is gone but never the other way
+struct JournalBlockHeader
+{
+	static constexpr uint Magic = 0x4a565657; // "WVVJ"
+
+	uint magic;
+	uint day;
+	uint lord_count;
+	uint payload_size;
+	uint64_t checksum;
+};
+
+enum JournalEntryType : uint8_t
+{
+	JournalLord,		// resources and the city tiles in order
+	JournalCity,		// everything of one city, addressed by lord and index
+	JournalCamps		// all the camps, they are few and change together at night
+};
+
+uint64_t hash_bytes(const char* data, size_t size)
+{
+	// fnv-1a
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= (uint8_t)data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+std::filesystem::path get_autosave_path(const char* prefix, uint generation)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%s_%08u.bin", prefix, generation);
+	return autosave_dir / name;
+}
+
+// the generation in a file name like base_00000003.bin, or -1
+int get_autosave_generation(const std::filesystem::path& path, const char* prefix)
+{
+	auto name = path.filename().string();
+	auto prefix_len = strlen(prefix);
+	if (name.size() != prefix_len + 13 || name.compare(0, prefix_len, prefix) != 0 || name[prefix_len] != '_' || !name.ends_with(".bin"))
+		return -1;
+	auto generation = 0;
+	for (auto i = prefix_len + 1; i < prefix_len + 9; i++)
+	{
+		if (name[i] < '0' || name[i] > '9')
+			return -1;
+		generation = generation * 10 + (name[i] - '0');
+	}
+	return generation;
+}
+
+void write_lord_entry(BinaryWriter& writer, const Lord& lord)
+{
+	for (auto i = 0; i < ResourceTypeCount; i++)
+		writer.write(lord.resources[i]);
+	writer.write((uint)lord.cities.size());
+	for (auto& city : lord.cities)
+		writer.write(city.tile_id);
+}
+
+void write_city_entry(BinaryWriter& writer, const City& city)
+{
+	writer.write(city.tile_id);
+	writer.write(city.loyalty);
+	writer.write(city.production);
+	writer.write((uint)city.buildings.size());
+	for (auto& building : city.buildings)
+	{
+		writer.write(building.slot);
+		writer.write((uint)building.type);
+		writer.write(building.lv);
+	}
+	writer.write((uint)city.captures.size());
+	for (auto& capture : city.captures)
+	{
+		writer.write(capture.unit_id);
+		writer.write(capture.exclusive_id);
+		writer.write(capture.lv);
+		writer.write(capture.cost_gold);
+	}
+	writer.write((uint)city.units.size());
+	for (auto& unit : city.units)
+	{
+		writer.write(unit.id);
+		writer.write(unit.lv);
+		writer.write(unit.exp);
+		writer.write(unit.gain_exp);
+		for (auto i = 0; i < 4; i++)
+			writer.write(unit.skills[i]);
+		writer.write((uint)unit.learnt_skills.size());
+		for (auto skill : unit.learnt_skills)
+			writer.write(skill);
+	}
+	writer.write((uint)city.troops.size());
+	for (auto& troop : city.troops)
+	{
+		writer.write(troop.target);
+		writer.write((uint)troop.units.size());
+		for (auto idx : troop.units)
+			writer.write(idx);
+	}
+}
+
+void write_camps_entry(BinaryWriter& writer)
+{
+	writer.write((uint)neutral_camps.size());
+	for (auto& camp : neutral_camps)
+	{
+		writer.write(camp.tile_id);
+		writer.write((uint)camp.chest.type);
+		writer.write(camp.chest.value);
+		writer.write((uint)camp.units.size());
+		for (auto& unit : camp.units)
+		{
+			writer.write(unit.id);
+			writer.write(unit.lv);
+			writer.write(unit.stats[StatHP]);
+			for (auto i = 0; i < 4; i++)
+				writer.write(unit.skills[i]);
+		}
+	}
+}
+
+struct AutosaveState
+{
+	uint generation = 0;
+	bool has_base = false;
+	uint blocks = 0;	// in the journal of the current generation
+};
+AutosaveState autosave_state;
+
+void finish_autosave()
+{
+	finish_saves();
+}
+
+void restart_autosave()
+{
+	autosave_state.has_base = false;
+}
+
+void autosave()
+{
+	if (autosave_dir.empty())
+		return;
+	auto& state = autosave_state;
+	std::error_code ec;
+	std::filesystem::create_directories(autosave_dir, ec);
+
+	// the base holds everything, so the flags only need clearing then. a city that shifted to a
+	//  lower index keeps its content when the journal is applied, only its lord entry is written
+	auto compact = !state.has_base || state.blocks >= autosave_compact_days;
+	BinaryWriter payload;
+	if (neutral_camps_dirty && !compact)
+	{
+		payload.write(JournalCamps);
+		write_camps_entry(payload);
+	}
+	neutral_camps_dirty = false;
+	for (auto& lord : lords)
+	{
+		if (lord.dirty && !compact)
+		{
+			payload.write(JournalLord);
+			payload.write(lord.id);
+			write_lord_entry(payload, lord);
+		}
+		lord.dirty = false;
+	}
+	for (auto& lord : lords)
+	{
+		for (auto i = 0; i < lord.cities.size(); i++)
+		{
+			auto& city = lord.cities[i];
+			if (city.dirty && !compact)
+			{
+				payload.write(JournalCity);
+				payload.write(lord.id);
+				payload.write((uint)i);
+				write_city_entry(payload, city);
+			}
+			city.dirty = false;
+		}
+	}
+
+	if (compact)
+	{
+		// only the snapshot is taken here, the save thread builds the image and writes it out. a
+		//  generation only counts once its base is renamed into place, until then recovery uses the
+		//  previous one and loses the days since
+		state.generation++;
+		state.has_base = true;
+		state.blocks = 0;
+		auto base_path = get_autosave_path("base", state.generation);
+		submit_save_task([snapshot = take_world_snapshot(), dir = autosave_dir, base_path, generation = state.generation]() {
+			std::vector<char> image;
+			write_world(image, *snapshot);
+			auto path = base_path;
+			path.replace_extension(".tmp");
+			{
+				std::ofstream file(path, std::ios::binary);
+				file.write(image.data(), image.size());
+				if (!file.good())
+					return;
+			}
+			std::error_code ec;
+			std::filesystem::rename(path, base_path, ec);
+			if (ec)
+				return;
+			std::vector<std::filesystem::path> olds;
+			for (auto& it : std::filesystem::directory_iterator(dir, ec))
+			{
+				auto g = get_autosave_generation(it.path(), "base");
+				if (g == -1)
+					g = get_autosave_generation(it.path(), "journal");
+				if (g != -1 && g < (int)generation)
+					olds.push_back(it.path());
+			}
+			for (auto& p : olds)
+				std::filesystem::remove(p, ec);
+		});
+		return;
+	}
+
+	JournalBlockHeader header;
+	header.magic = JournalBlockHeader::Magic;
+	header.day = current_day;
+	header.lord_count = lords.size();
+	header.payload_size = payload.data.size();
+	header.checksum = hash_bytes(payload.data.data(), payload.data.size());
+	std::ofstream file(get_autosave_path("journal", state.generation), std::ios::binary | std::ios::app);
+	file.write((const char*)&header, sizeof(header));
+	file.write(payload.data.data(), payload.data.size());
+	file.flush();
+	state.blocks++;
+}
+
+// the city is only replaced when the whole entry could be read
+bool read_city_entry(BinaryReader& reader, City& dst)
+{
+	auto city = dst;
+	auto tile_count = (uint)tiles.size();
+	auto skills_ok = [](const int* skills) {
+		for (auto i = 0; i < 4; i++)
+		{
+			if (skills[i] < -1 || skills[i] >= (int)skill_datas.size())
+				return false;
+		}
+		return true;
+	};
+
+	if (reader.read<uint>() != city.tile_id)
+		return false;
+	city.loyalty = reader.read<uint>();
+	city.production = reader.read<uint>();
+	if (reader.read_count(12) != building_slots.size())
+		return false;
+	for (auto& building : city.buildings)
+	{
+		building.slot = reader.read<uint>();
+		building.type = (BuildingType)reader.read<uint>();
+		building.lv = reader.read<uint>();
+		if (building.type > BuildingTypeCount || (building.lv > 0 && !get_building_base_data(building.type, building.lv - 1)))
+			return false;
+	}
+	city.captures.resize(reader.read_count(16));
+	for (auto& capture : city.captures)
+	{
+		capture.unit_id = reader.read<uint>();
+		capture.exclusive_id = reader.read<uint>();
+		capture.lv = reader.read<uint>();
+		capture.cost_gold = reader.read<uint>();
+		if (capture.unit_id >= unit_datas.size())
+			return false;
+	}
+	city.units.resize(reader.read_count(36));
+	for (auto& unit : city.units)
+	{
+		unit.id = reader.read<uint>();
+		unit.lv = reader.read<uint>();
+		unit.exp = reader.read<uint>();
+		unit.gain_exp = reader.read<uint>();
+		for (auto i = 0; i < 4; i++)
+			unit.skills[i] = reader.read<int>();
+		if (unit.id >= unit_datas.size() || !skills_ok(unit.skills))
+			return false;
+		unit.learnt_skills.resize(reader.read_count(4));
+		for (auto& skill : unit.learnt_skills)
+		{
+			skill = reader.read<uint>();
+			if (skill >= skill_datas.size())
+				return false;
+		}
+	}
+	// the first troop holds the units that stay in the city
+	city.troops.resize(reader.read_count(8));
+	if (city.troops.empty())
+		return false;
+	for (auto& troop : city.troops)
+	{
+		auto target = reader.read<uint>();
+		troop.units.resize(reader.read_count(4));
+		for (auto& idx : troop.units)
+		{
+			idx = reader.read<uint>();
+			if (idx >= city.units.size())
+				return false;
+		}
+		if (target >= tile_count)
+			return false;
+		city.set_troop_target(troop, target);
+	}
+	if (!reader.ok)
+		return false;
+	dst = std::move(city);
+	return true;
+}
+
+bool read_camps_entry(BinaryReader& reader)
+{
+	for (auto& camp : neutral_camps)
+	{
+		auto& tile = tiles[camp.tile_id];
+		tile.type = TileField;
+		tile.idx1 = tile.idx2 = -1;
+	}
+	neutral_camps.clear();
+
+	auto count = reader.read_count(16);
+	for (auto i = 0; i < count; i++)
+	{
+		auto tile_id = reader.read<uint>();
+		auto chest_type = (ChestType)reader.read<uint>();
+		auto chest_value = reader.read<uint>();
+		std::vector<NeutralUnit> units(reader.read_count(28));
+		std::vector<uint> HPs(units.size());
+		for (auto j = 0; j < units.size(); j++)
+		{
+			units[j].id = reader.read<uint>();
+			units[j].lv = reader.read<uint>();
+			HPs[j] = reader.read<uint>();
+			for (auto k = 0; k < 4; k++)
+				units[j].skills[k] = reader.read<int>();
+			if (units[j].id >= unit_datas.size())
+				return false;
+			for (auto k = 0; k < 4; k++)
+			{
+				if (units[j].skills[k] < -1 || units[j].skills[k] >= (int)skill_datas.size())
+					return false;
+			}
+		}
+		if (!reader.ok || tile_id >= tiles.size())
+			return false;
+		if (add_neutral_camp(tile_id, units, chest_type, chest_value))
+		{
+			auto& camp = neutral_camps.back();
+			for (auto j = 0; j < camp.units.size(); j++)
+				camp.units[j].stats[StatHP] = std::min(HPs[j], camp.units[j].HP_MAX);
+		}
+	}
+	return reader.ok;
+}
+
+// the cities of every lord are brought to the tiles of its entry, kept cities keep their content,
+//  new ones are built and get their content from the city entries that follow
+bool apply_lord_entries(const std::vector<std::pair<uint, std::vector<uint>>>& entries)
+{
+	// removals first, a city may have moved from one lord to another
+	for (auto& [lord_id, city_tiles] : entries)
+	{
+		auto& lord = lords[lord_id];
+		for (auto i = 0; i < lord.cities.size(); )
+		{
+			auto tile_id = lord.cities[i].tile_id;
+			if (std::find(city_tiles.begin(), city_tiles.end(), tile_id) == city_tiles.end())
+			{
+				auto& tile = tiles[tile_id];
+				tile.type = TileField;
+				tile.idx1 = tile.idx2 = -1;
+				lord.cities.erase(lord.cities.begin() + i);
+				lord.remove_city_territory(tile_id);
+			}
+			else
+				i++;
+		}
+	}
+	for (auto& [lord_id, city_tiles] : entries)
+	{
+		auto& lord = lords[lord_id];
+		for (auto tile_id : city_tiles)
+		{
+			auto& tile = tiles[tile_id];
+			if (tile.type == TileCity && tile.idx1 == (int)lord_id)
+				continue;
+			if (!lord.build_city(tile_id))
+				return false;
+		}
+		std::vector<City> cities;
+		for (auto tile_id : city_tiles)
+		{
+			auto it = std::find_if(lord.cities.begin(), lord.cities.end(), [&](const auto& city) {
+				return city.tile_id == tile_id;
+			});
+			if (it == lord.cities.end())
+				return false;
+			cities.push_back(std::move(*it));
+			lord.cities.erase(it);
+		}
+		lord.cities = std::move(cities);
+		for (auto i = 0; i < lord.cities.size(); i++)
+		{
+			lord.cities[i].id = i;
+			tiles[lord.cities[i].tile_id].idx2 = i;
+		}
+	}
+	return true;
+}
+
+bool apply_journal_block(BinaryReader& reader, uint lord_count)
+{
+	while (lords.size() < lord_count)
+	{
+		auto& lord = lords.emplace_back();
+		lord.id = lords.size() - 1;
+	}
+
+	std::vector<std::pair<uint, std::vector<uint>>> lord_entries;
+	auto lords_applied = false;
+	while (reader.ok && reader.pos < reader.data.size())
+	{
+		auto type = reader.read<JournalEntryType>();
+		if (type == JournalCity && !lords_applied)
+		{
+			if (!apply_lord_entries(lord_entries))
+				return false;
+			lords_applied = true;
+		}
+		switch (type)
+		{
+		case JournalLord:
+		{
+			auto lord_id = reader.read<uint>();
+			if (lord_id >= lords.size() || lords_applied)
+				return false;
+			auto& lord = lords[lord_id];
+			for (auto i = 0; i < ResourceTypeCount; i++)
+				lord.resources[i] = reader.read<uint>();
+			std::vector<uint> city_tiles(reader.read_count(4));
+			for (auto& tile_id : city_tiles)
+			{
+				tile_id = reader.read<uint>();
+				if (tile_id >= tiles.size())
+					return false;
+			}
+			lord_entries.emplace_back(lord_id, std::move(city_tiles));
+		}
+			break;
+		case JournalCity:
+		{
+			auto lord_id = reader.read<uint>();
+			auto city_idx = reader.read<uint>();
+			if (lord_id >= lords.size() || city_idx >= lords[lord_id].cities.size())
+				return false;
+			if (!read_city_entry(reader, lords[lord_id].cities[city_idx]))
+				return false;
+		}
+			break;
+		case JournalCamps:
+			if (!lord_entries.empty() || lords_applied || !read_camps_entry(reader))
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	if (!lords_applied && !apply_lord_entries(lord_entries))
+		return false;
+	return reader.ok;
+}
+
+bool load_autosave()
+{
+	finish_autosave();
+	auto& state = autosave_state;
+
+	std::vector<int> bases;
+	auto last_generation = 0;
+	std::error_code ec;
+	for (auto& it : std::filesystem::directory_iterator(autosave_dir, ec))
+	{
+		if (auto g = get_autosave_generation(it.path(), "base"); g != -1)
+			bases.push_back(g);
+		if (auto g = get_autosave_generation(it.path(), "journal"); g != -1)
+			last_generation = std::max(last_generation, g);
+	}
+	std::sort(bases.begin(), bases.end(), std::greater<int>());
+	auto base = -1;
+	for (auto g : bases)
+	{
+		if (load_world(get_autosave_path("base", g)))
+		{
+			base = g;
+			break;
+		}
+	}
+	if (base == -1)
+		return false;
+	last_generation = std::max(last_generation, base);
+
+	// the journal of a generation whose base never made it to disk starts from a world that isn't
+	//  on disk either, so it is of no use. a torn or broken block ends the recovery there
+	BinaryReader file;
+	if (file.load(get_autosave_path("journal", base)))
+	{
+		while (file.pos + sizeof(JournalBlockHeader) <= file.data.size())
+		{
+			auto header = file.read<JournalBlockHeader>();
+			if (header.magic != JournalBlockHeader::Magic || header.payload_size > file.data.size() - file.pos)
+				break;
+			BinaryReader reader;
+			reader.data.assign(file.data.begin() + file.pos, file.data.begin() + file.pos + header.payload_size);
+			file.pos += header.payload_size;
+			if (hash_bytes(reader.data.data(), reader.data.size()) != header.checksum || header.lord_count < lords.size())
+				break;
+			// it passed the checksum, so only sheets that changed since can refuse it
+			if (!apply_journal_block(reader, header.lord_count))
+				break;
+			current_day = header.day;
+		}
+	}
+	invalidate_troop_index();
+
+	state.generation = last_generation;
+	state.has_base = false;
+	state.blocks = 0;
+	return true;
+}
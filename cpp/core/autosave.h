@@ -0,0 +1,19 @@
+#pragma once
+
+#include "world.h"
+
+// autosave at the end of every new_day, off while autosave_dir is empty. a generation is a full
+//  save base_N.bin followed by journal_N.bin, which gets one block per day holding only the lords,
+//  cities and camps marked dirty since the day before, the flags are cleared once written. every
+//  autosave_compact_days days a new generation starts, its base is written and the older ones
+//  removed on the save thread
+extern std::filesystem::path autosave_dir;
+extern uint autosave_compact_days;
+
+void autosave();
+// the next autosave starts a new generation, for when the world was replaced as a whole
+void restart_autosave();
+// waits for the background compaction
+void finish_autosave();
+// the newest complete base and every journal block after it, the next autosave starts a new generation
+bool load_autosave();
@@ -0,0 +1,527 @@
+#include "battle.h"
+#include "sheet.h"
+
+std::vector<SkillData> skill_datas;
+std::vector<UnitData> unit_datas;
+NameRegistry skill_names;
+NameRegistry unit_names;
+uint damage_multiplier = 1;
+bool record_replays = true;
+
+const wchar_t* get_pokemon_type_name(PokemonType type)
+{
+	switch (type)
+	{
+	case PokemonNormal: return L"Normal";
+	case PokemonFire: return L"Fire";
+	case PokemonWater: return L"Water";
+	case PokemonElectric: return L"Electric";
+	case PokemonGrass: return L"Grass";
+	case PokemonIce: return L"Ice";
+	case PokemonFighting: return L"Fighting";
+	case PokemonPoison: return L"Poison";
+	case PokemonGround: return L"Ground";
+	case PokemonFlying: return L"Flying";
+	case PokemonPsychic: return L"Psychic";
+	case PokemonBug: return L"Bug";
+	case PokemonRock: return L"Rock";
+	case PokemonGhost: return L"Ghost";
+	case PokemonDragon: return L"Dragon";
+	case PokemonDark: return L"Dark";
+	case PokemonSteel: return L"Steel";
+	case PokemonFairy: return L"Fairy";
+	}
+	return L"";
+}
+
+PokemonType get_pokemon_type_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(PokemonTypeCount, [](uint i) {
+		return get_pokemon_type_name((PokemonType)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (PokemonType)id;
+	return PokemonTypeCount;
+}
+
+const wchar_t* get_stat_name(Stat stat)
+{
+	switch (stat)
+	{
+	case StatHP: return L"HP";
+	case StatATK: return L"ATK";
+	case StatDEF: return L"DEF";
+	case StatSA: return L"SA";
+	case StatSD: return L"SD";
+	case StatSP: return L"SP";
+	case StatACC: return L"ACC";
+	case StatEVA: return L"EVA";
+	}
+	return L"";
+}
+
+Stat get_stat_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(StatCount, [](uint i) {
+		return get_stat_name((Stat)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (Stat)id;
+	return StatCount;
+}
+
+const wchar_t* get_skill_category_name(SkillCategory cate)
+{
+	switch (cate)
+	{
+	case SkillCatePhysical: return L"Physical";
+	case SkillCateSpecial: return L"Special";
+	case SkillCateStatus: return L"Status";
+	}
+	return L"";
+}
+
+SkillCategory get_skill_category_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(SkillCategoryCount, [](uint i) {
+		return get_skill_category_name((SkillCategory)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (SkillCategory)id;
+	return SkillCategoryCount;
+}
+
+const wchar_t* get_effect_type_name(EffectType effect)
+{
+	switch (effect)
+	{
+	case EffectUserStat: return L"UserStat";
+	case EffectOpponentStat: return L"OpponentStat";
+	case EffectStatus: return L"Status";
+	}
+	return L"";
+}
+
+EffectType get_effect_type_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(EffectTypeCount, [](uint i) {
+		return get_effect_type_name((EffectType)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (EffectType)id;
+	return EffectTypeCount;
+}
+
+const wchar_t* get_status_name(AbnormalStatus status)
+{
+	switch (status)
+	{
+	case AbnormalStatusBurn: return L"Burn";
+	case AbnormalStatusFreeze: return L"Freeze";
+	case AbnormalStatusParalysis: return L"Paralysis";
+	case AbnormalStatusPoison: return L"Poison";
+	case AbnormalStatusSleep: return L"Sleep";
+	}
+	return L"";
+}
+
+AbnormalStatus get_status_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(AbnormalStatusCount, [](uint i) {
+		return get_status_name((AbnormalStatus)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (AbnormalStatus)id;
+	return AbnormalStatusCount;
+}
+
+uint calc_hp_stat(uint base, uint lv)
+{
+	return uint((base * 2 + IV_VAL + BP_VAL / 4) * lv / 100.f) + lv + 10;
+}
+
+uint calc_stat(uint base, uint lv)
+{
+	return uint((base * 2 + IV_VAL + BP_VAL / 4) * lv / 100.f) + 5;
+}
+
+uint calc_exp(uint lv)
+{
+	return (lv * lv * lv * 4) / 5;
+}
+
+uint calc_gain_exp(uint lv)
+{
+	return (BASE_EXP * lv) / 7;
+}
+
+int find_unit(std::wstring_view name)
+{
+	return unit_names.find(name);
+}
+
+int find_skill(std::wstring_view name)
+{
+	return skill_names.find(name);
+}
+
+void index_battle_datas()
+{
+	skill_names.clear();
+	skill_names.reserve(skill_datas.size());
+	for (auto i = 0; i < skill_datas.size(); i++)
+		skill_names.add(skill_datas[i].name, i);
+	unit_names.clear();
+	unit_names.reserve(unit_datas.size());
+	for (auto i = 0; i < unit_datas.size(); i++)
+		unit_names.add(unit_datas[i].name, i);
+}
+
+bool load_skill_datas(const std::filesystem::path& path)
+{
+	DataSheet sht;
+	if (!sht.load(path))
+		return false;
+	for (auto i = 0; i < sht.rows.size(); i++)
+	{
+		SkillData data;
+		data.name = sht.get_as_wstr(i, "name");
+		data.type = get_pokemon_type_from_name(sht.get_as_wstr(i, "type"));
+		data.category = get_skill_category_from_name(sht.get_as_wstr(i, "category"));
+		data.power = sht.get_as<uint>(i, "power");
+		data.acc = sht.get_as<uint>(i, "acc");
+		data.pp = sht.get_as<uint>(i, "pp");
+		data.effect_text = sht.get_as_wstr(i, "effect_text");
+		auto effect = sht.get_as_wstr(i, "effect");
+		for (auto t : split_string(effect, ';'))
+		{
+			auto sp = split_string(t, ',');
+			if (sp.size() > 0)
+			{
+				auto type = get_effect_type_from_name(sp[0]);
+				if (type != EffectTypeCount)
+				{
+					switch (type)
+					{
+					case EffectUserStat:
+					case EffectOpponentStat:
+						if (sp.size() == 4)
+						{
+							SkillEffect effect;
+							effect.type = type;
+							effect.data.stat.id = get_stat_from_name(sp[1]);
+							effect.data.stat.state = std::stoi(std::wstring(sp[2]));
+							effect.data.stat.prob = std::stof(std::wstring(sp[3]));
+							data.effects.push_back(effect);
+						}
+						break;
+					case EffectStatus:
+
+						break;
+					}
+				}
+			}
+		}
+		if (data.category == SkillCateStatus)
+		{
+			auto no_target = true;
+			for (auto& effect : data.effects)
+			{
+				if (effect.type == EffectOpponentStat)
+				{
+					no_target = false;
+					break;
+				}
+			}
+			if (no_target)
+				data.target_type = TargetSelf;
+		}
+		skill_datas.push_back(data);
+	}
+	index_battle_datas();
+	return true;
+}
+
+bool load_unit_datas(const std::filesystem::path& path)
+{
+	DataSheet sht;
+	if (!sht.load(path))
+		return false;
+	for (auto i = 0; i < sht.rows.size(); i++)
+	{
+		UnitData data;
+		data.name = sht.get_as_wstr(i, "name");
+		data.cost_gold = sht.get_as<uint>(i, "cost_gold");
+		data.cost_population = sht.get_as<uint>(i, "cost_population");
+		data.evolution_lv = sht.get_as<uint>(i, "evolution_lv");
+		data.stats[StatHP] = sht.get_as<uint>(i, "HP");
+		data.stats[StatATK] = sht.get_as<uint>(i, "ATK");
+		data.stats[StatDEF] = sht.get_as<uint>(i, "DEF");
+		data.stats[StatSA] = sht.get_as<uint>(i, "SA");
+		data.stats[StatSD] = sht.get_as<uint>(i, "SD");
+		data.stats[StatSP] = sht.get_as<uint>(i, "SP");
+		data.type1 = get_pokemon_type_from_name(sht.get_as_wstr(i, "type1"));
+		data.type2 = get_pokemon_type_from_name(sht.get_as_wstr(i, "type2"));
+		{
+			auto str = sht.get_as_wstr(i, "skillset");
+			for (auto t : split_string(str, ','))
+			{
+				auto sp = split_string(t, ':');
+				if (sp.size() == 2)
+				{
+					auto lv = (uint)std::stoul(std::wstring(sp[0]));
+					auto skill_id = find_skill(sp[1]);
+					if (skill_id != -1)
+						data.skillset.emplace_back(lv, skill_id);
+				}
+			}
+		}
+		unit_datas.push_back(data);
+	}
+	for (auto i = 0; i < unit_datas.size(); i++)
+	{
+		auto& unit_data = unit_datas[i];
+		if (unit_data.evolution_lv != 0)
+		{
+			auto& evo_unit_data = unit_datas[i + 1];
+			evo_unit_data.skillset.insert(evo_unit_data.skillset.end(), unit_data.skillset.begin(), unit_data.skillset.end());
+		}
+	}
+	for (auto& unit_data : unit_datas)
+	{
+		for (auto i = 0; i < unit_data.skillset.size(); i++)
+		{
+			auto v = unit_data.skillset[i];
+			for (auto it = unit_data.skillset.begin() + i + 1; it != unit_data.skillset.end(); )
+			{
+				if (it->second == v.second)
+				{
+					if (it->first < v.first)
+						v.first = it->first;
+					it = unit_data.skillset.erase(it);
+				}
+				else
+					it++;
+			}
+		}
+	}
+	index_battle_datas();
+	return true;
+}
+
+float get_stage_modifier(int stage)
+{
+	switch (stage)
+	{
+	case -6: return  25.f / 100.f;
+	case -5: return  28.f / 100.f;
+	case -4: return  33.f / 100.f;
+	case -3: return  40.f / 100.f;
+	case -2: return  50.f / 100.f;
+	case -1: return  66.f / 100.f;
+	case +1: return 150.f / 100.f;
+	case +2: return 200.f / 100.f;
+	case +3: return 250.f / 100.f;
+	case +4: return 300.f / 100.f;
+	case +5: return 350.f / 100.f;
+	case +6: return 400.f / 100.f;
+	}
+	return 1.f;
+}
+
+float get_effectineness(PokemonType skill_type, PokemonType caster_type1, PokemonType caster_type2, PokemonType target_type1, PokemonType target_type2)
+{
+	auto effectiveness = dual_type_effectiveness.v[skill_type][target_type1][target_type2];
+	if (caster_type1 == skill_type || caster_type2 == skill_type)
+		effectiveness *= 1.5f;
+	return effectiveness;
+}
+
+SkillResult cast_skill(UnitInstance& caster, UnitInstance& target, uint skill_id, uint& damage, StatChange& caster_stat_changed, StatChange& target_stat_changed, Rng& rng)
+{
+	auto& skill_data = skill_datas[skill_id];
+	auto effectiveness = get_effectineness(skill_data.type, caster.type1, caster.type2, target.type1, target.type2);
+	if (effectiveness == 0.f)
+		return SkillNoEffect;
+
+	{
+		auto B = skill_data.acc / 100.f;
+		auto C = get_stage_modifier(caster.stat_stage[StatACC]);
+		auto D = get_stage_modifier(target.stat_stage[StatEVA]);
+		auto A = B * C / D;
+		if (rng.unit() >= A)
+			return SkillMiss;
+	}
+
+	if (skill_data.power > 0)
+	{
+		auto A = skill_data.category == SkillCatePhysical ? caster.stats[StatATK] : caster.stats[StatSA];
+		auto D = skill_data.category == SkillCatePhysical ? target.stats[StatDEF] : target.stats[StatSD];
+		damage = ((2.f * caster.lv + 10.f) / 250.f * ((float)A / (float)D) * skill_data.power + 2.f) * effectiveness;
+	}
+
+	for (auto& effect : skill_data.effects)
+	{
+		switch (effect.type)
+		{
+		case EffectUserStat:
+			if (rng.unit() <= effect.data.stat.prob)
+			{
+				caster_stat_changed.changed = true;
+				caster_stat_changed.stage[effect.data.stat.id] += effect.data.stat.state;
+			}
+			break;
+		case EffectOpponentStat:
+			if (rng.unit() <= effect.data.stat.prob)
+			{
+				target_stat_changed.changed = true;
+				target_stat_changed.stage[effect.data.stat.id] += effect.data.stat.state;
+			}
+			break;
+		}
+	}
+
+	return SkillHit;
+}
+
+void eval_skill_scores(const UnitInstance& caster, uint skill_id, const BattleSideSoA& side, float* scores)
+{
+	auto padded = (uint)side.HP.size();
+	auto& skill_data = skill_datas[skill_id];
+	if (skill_data.power == 0)
+	{
+		for (auto i = 0; i < padded; i++)
+			scores[i] = 0.f;
+		return;
+	}
+
+	auto physical = skill_data.category == SkillCatePhysical;
+	auto D = physical ? side.stats[StatDEF].data() : side.stats[StatSD].data();
+	auto A = (float)(physical ? caster.stats[StatATK] : caster.stats[StatSA]);
+	auto base = (2.f * caster.lv + 10.f) / 250.f * A * skill_data.power;
+	auto stab = caster.type1 == skill_data.type || caster.type2 == skill_data.type ? 1.5f : 1.f;
+	auto acc = skill_data.acc / 100.f * get_stage_modifier(caster.stat_stage[StatACC]);
+
+	// effectiveness is a gather, the rest is pure arithmetic over the columns
+	auto& effectiveness_table = dual_type_effectiveness.v[skill_data.type];
+	for (auto i = 0; i < padded; i++)
+		scores[i] = effectiveness_table[side.type1[i]][side.type2[i]] * stab;
+
+	auto i = 0U;
+#ifdef USE_SSE
+	auto v_base = _mm_set1_ps(base);
+	auto v_two = _mm_set1_ps(2.f);
+	auto v_acc = _mm_set1_ps(acc);
+	auto v_one = _mm_set1_ps(1.f);
+	for (; i < padded; i += 4)
+	{
+		auto v_damage = _mm_mul_ps(_mm_add_ps(_mm_div_ps(v_base, _mm_load_ps(D + i)), v_two), _mm_load_ps(scores + i));
+		v_damage = _mm_min_ps(v_damage, _mm_load_ps(side.HP.data() + i));
+		auto v_hit = _mm_min_ps(_mm_div_ps(v_acc, _mm_load_ps(side.EVA_modifier.data() + i)), v_one);
+		_mm_store_ps(scores + i, _mm_mul_ps(v_damage, v_hit));
+	}
+#endif
+	for (; i < padded; i++)
+	{
+		auto damage = std::min((base / D[i] + 2.f) * scores[i], side.HP[i]);
+		scores[i] = damage * std::min(acc / side.EVA_modifier[i], 1.f);
+	}
+}
+
+bool is_same_event(const BattleEvent& a, const BattleEvent& b)
+{
+	return a.side == b.side && a.caster_idx == b.caster_idx && a.target_idx == b.target_idx &&
+		a.skill_id == b.skill_id && a.result == b.result && a.damage == b.damage && a.target_HP_after == b.target_HP_after;
+}
+
+std::filesystem::path get_replay_path(const BattleReplay& replay)
+{
+	wchar_t buf[32];
+	swprintf(buf, 32, L"%016llx.rep", (unsigned long long)replay.rng_key);
+	return std::filesystem::path(L"replays") / buf;
+}
+
+bool verify_replay(const BattleReplay& replay, int* winner)
+{
+	std::vector<UnitInstance> units[2] = { replay.units[0], replay.units[1] };
+	Rng rng;
+	rng.key = replay.rng_key;
+	rng.counter = replay.rng_counter;
+	BattleSim sim;
+	sim.setup(units[0], units[1], rng);
+	sim.damage_multiplier = replay.damage_multiplier;
+	std::vector<BattleEvent> events;
+	auto _winner = sim.run(&events);
+	if (winner)
+		*winner = _winner;
+	if (events.size() != replay.events.size())
+		return false;
+	for (auto i = 0; i < events.size(); i++)
+	{
+		if (!is_same_event(events[i], replay.events[i]))
+			return false;
+	}
+	return true;
+}
+
+BattleEstimate estimate_battle(const std::vector<UnitInstance>& units0, uint defeat_gain_exp0, const std::vector<UnitInstance>& units1, uint defeat_gain_exp1,
+	uint runs, uint64_t seed, uint num_threads)
+{
+	struct Partial
+	{
+		uint64_t wins[2] = { 0, 0 };
+		uint64_t HP[2] = { 0, 0 };
+		uint64_t HP_sq[2] = { 0, 0 };
+	};
+
+	std::vector<Partial> partials(get_parallel_thread_count(num_threads));
+	parallel_for(runs, [&](uint idx, uint thread_idx) {
+		auto& partial = partials[thread_idx];
+		std::vector<UnitInstance> sides[2] = { units0, units1 };
+		BattleSim sim;
+		sim.setup(sides[0], sides[1], Rng(seed, idx));
+		auto winner = sim.run();
+		if (winner != -1)
+			partial.wins[winner]++;
+		for (auto i = 0; i < 2; i++)
+		{
+			uint64_t HP = 0;
+			for (auto& unit : sides[i])
+				HP += unit.stats[StatHP];
+			partial.HP[i] += HP;
+			partial.HP_sq[i] += HP * HP;
+		}
+	}, num_threads);
+
+	Partial total;
+	for (auto& partial : partials)
+	{
+		for (auto i = 0; i < 2; i++)
+		{
+			total.wins[i] += partial.wins[i];
+			total.HP[i] += partial.HP[i];
+			total.HP_sq[i] += partial.HP_sq[i];
+		}
+	}
+
+	BattleEstimate ret;
+	ret.runs = runs;
+	if (runs == 0)
+		return ret;
+	const auto z = 1.96;
+	uint defeat_gain_exps[2] = { defeat_gain_exp1, defeat_gain_exp0 };
+	for (auto i = 0; i < 2; i++)
+	{
+		auto p = (double)total.wins[i] / runs;
+		auto p_ci = z * sqrt(p * (1.0 - p) / runs);
+		ret.win_rate[i] = p;
+		ret.win_rate_ci[i] = p_ci;
+		auto mean = (double)total.HP[i] / runs;
+		auto var = std::max(0.0, (double)total.HP_sq[i] / runs - mean * mean);
+		ret.surviving_HP[i] = mean;
+		ret.surviving_HP_ci[i] = z * sqrt(var / runs);
+		ret.gain_exp[i] = p * defeat_gain_exps[i];
+		ret.gain_exp_ci[i] = p_ci * defeat_gain_exps[i];
+	}
+	return ret;
+}
@@ -0,0 +1,854 @@
+#pragma once
+
+#include "common.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define USE_SSE
+#include <immintrin.h>
+#endif
+
+enum PokemonType
+{
+	PokemonNormal,
+	PokemonFire,
+	PokemonWater,
+	PokemonElectric,
+	PokemonGrass,
+	PokemonIce,
+	PokemonFighting,
+	PokemonPoison,
+	PokemonGround,
+	PokemonFlying,
+	PokemonPsychic,
+	PokemonBug,
+	PokemonRock,
+	PokemonGhost,
+	PokemonDragon,
+	PokemonDark,
+	PokemonSteel,
+	PokemonFairy,
+
+	PokemonTypeCount
+};
+
+const wchar_t* get_pokemon_type_name(PokemonType type);
+
+PokemonType get_pokemon_type_from_name(std::wstring_view name);
+
+constexpr float pokemon_type_effectiveness[PokemonTypeCount][PokemonTypeCount] = { // attacker, defender
+	//	Nor	Fir	Wat	Ele	Gra	Ice	Fig	Poi	Gro	Fly	Psy	Bug	Roc	Gho	Dra	Dar	Ste	Fai
+	{ 1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	.5f,	0.f,	1.f,	1.f,	.5f,	1.f },	// Normal
+	{ 1.f,	.5f,	.5f,	1.f,	2.f,	2.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	.5f,	1.f,	.5f,	1.f,	2.f,	1.f },	// Fire
+	{ 1.f,	2.f,	.5f,	1.f,	.5f,	1.f,	1.f,	1.f,	2.f,	1.f,	1.f,	1.f,	2.f,	1.f,	.5f,	1.f,	1.f,	1.f },	// Water
+	{ 1.f,	1.f,	2.f,	.5f,	.5f,	1.f,	1.f,	1.f,	0.f,	2.f,	1.f,	1.f,	1.f,	1.f,	.5f,	1.f,	1.f,	1.f },	// Electric
+	{ 1.f,	.5f,	2.f,	1.f,	.5f,	1.f,	1.f,	.5f,	2.f,	.5f,	1.f,	.5f,	2.f,	1.f,	.5f,	1.f,	.5f,	1.f },	// Grass
+	{ 1.f,	.5f,	.5f,	1.f,	2.f,	.5f,	1.f,	1.f,	2.f,	2.f,	1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	.5f,	1.f },	// Ice
+	{ 2.f,	1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	.5f,	1.f,	.5f,	.5f,	.5f,	2.f,	0.f,	1.f,	2.f,	2.f,	1.f },	// Fighting
+	{ 1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	1.f,	.5f,	.5f,	1.f,	1.f,	1.f,	.5f,	.5f,	1.f,	1.f,	0.f,	2.f },	// Poison
+	{ 1.f,	2.f,	1.f,	2.f,	.5f,	1.f,	1.f,	2.f,	1.f,	0.f,	1.f,	.5f,	2.f,	1.f,	1.f,	1.f,	2.f,	1.f },	// Ground
+	{ 1.f,	1.f,	1.f,	.5f,	2.f,	1.f,	2.f,	1.f,	1.f,	1.f,	1.f,	2.f,	.5f,	1.f,	1.f,	1.f,	.5f,	1.f },	// Flying
+	{ 1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	2.f,	1.f,	1.f,	.5f,	1.f,	1.f,	1.f,	1.f,	0.f,	.5f,	1.f },	// Psychic
+	{ 1.f,	.5f,	1.f,	1.f,	2.f,	1.f,	.5f,	.5f,	1.f,	.5f,	2.f,	1.f,	1.f,	.5f,	1.f,	2.f,	.5f,	.5f },	// Bug
+	{ 1.f,	2.f,	1.f,	1.f,	1.f,	2.f,	.5f,	1.f,	.5f,	2.f,	1.f,	2.f,	1.f,	1.f,	1.f,	1.f,	.5f,	1.f },	// Rock
+	{ 0.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	1.f,	2.f,	1.f,	.5f,	1.f,	1.f },	// Ghost
+	{ 1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	.5f,	0.f },	// Dragon
+	{ 1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	.5f,	1.f,	1.f,	1.f,	2.f,	1.f,	1.f,	2.f,	1.f,	.5f,	1.f,	.5f },	// Dark
+	{ 1.f,	.5f,	.5f,	.5f,	1.f,	2.f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	1.f,	1.f,	1.f,	.5f,	2.f },	// Steel
+	{ 1.f,	.5f,	1.f,	1.f,	1.f,	1.f,	2.f,	.5f,	1.f,	1.f,	1.f,	1.f,	1.f,	1.f,	2.f,	2.f,	.5f,	1.f },	// Fairy
+};
+
+// skill type, defender type1, defender type2, PokemonTypeCount stands for no type
+struct DualTypeEffectiveness
+{
+	float v[PokemonTypeCount][PokemonTypeCount + 1][PokemonTypeCount + 1];
+};
+
+constexpr DualTypeEffectiveness make_dual_type_effectiveness()
+{
+	DualTypeEffectiveness ret = {};
+	for (auto i = 0; i < PokemonTypeCount; i++)
+	{
+		for (auto j = 0; j <= PokemonTypeCount; j++)
+		{
+			for (auto k = 0; k <= PokemonTypeCount; k++)
+			{
+				auto effectiveness1 = j != PokemonTypeCount ? pokemon_type_effectiveness[i][j] : 1.f;
+				auto effectiveness2 = k != PokemonTypeCount ? pokemon_type_effectiveness[i][k] : 1.f;
+				ret.v[i][j][k] = effectiveness1 * effectiveness2;
+			}
+		}
+	}
+	return ret;
+}
+
+constexpr auto dual_type_effectiveness = make_dual_type_effectiveness();
+
+enum Stat
+{
+	StatHP,
+	StatATK,
+	StatDEF,
+	StatSA,
+	StatSD,
+	StatSP,
+	StatACC,
+	StatEVA,
+
+	StatCount
+};
+
+const wchar_t* get_stat_name(Stat stat);
+
+Stat get_stat_from_name(std::wstring_view name);
+
+enum SkillCategory
+{
+	SkillCatePhysical,
+	SkillCateSpecial,
+	SkillCateStatus,
+
+	SkillCategoryCount
+};
+
+const wchar_t* get_skill_category_name(SkillCategory cate);
+
+SkillCategory get_skill_category_from_name(std::wstring_view name);
+
+enum EffectType
+{
+	EffectUserStat,
+	EffectOpponentStat,
+	EffectStatus,
+	EffectRecover,
+	EffectLifeSteal,
+	EffectMultipleHits,
+	EffectDamageDebuff,
+
+	EffectTypeCount
+};
+
+const wchar_t* get_effect_type_name(EffectType effect);
+
+EffectType get_effect_type_from_name(std::wstring_view name);
+
+enum AbnormalStatus
+{
+	AbnormalStatusNone,
+	AbnormalStatusBurn,
+	AbnormalStatusFreeze,
+	AbnormalStatusParalysis,
+	AbnormalStatusPoison,
+	AbnormalStatusSleep,
+
+	AbnormalStatusCount
+};
+
+const wchar_t* get_status_name(AbnormalStatus status);
+
+AbnormalStatus get_status_from_name(std::wstring_view name);
+
+struct SkillEffect
+{
+	EffectType type;
+	union
+	{
+		struct
+		{
+			Stat id;
+			int state;
+			float prob;
+		}stat;
+		struct
+		{
+			AbnormalStatus id;
+			float prob;
+		}status;
+	}data;
+};
+
+const uint MAX_TROOP_UNITS = 12;
+const uint MAX_BATTLE_ROUNDS = 100; // a battle where nobody can deal damage ends as a draw
+const uint IV_VAL = 31;
+const uint BP_VAL = 252;
+const uint BASE_EXP = 100;
+
+uint calc_hp_stat(uint base, uint lv);
+
+uint calc_stat(uint base, uint lv);
+
+uint calc_exp(uint lv);
+
+uint calc_gain_exp(uint lv);
+
+enum TargetType
+{
+	TargetEnemy,
+	TargetSelf
+};
+
+struct SkillData
+{
+	std::wstring name;
+	PokemonType type;
+	SkillCategory category;
+	uint power;
+	uint acc;
+	uint pp;
+	std::wstring effect_text;
+	std::vector<SkillEffect> effects;
+	TargetType target_type = TargetEnemy;
+};
+extern std::vector<SkillData> skill_datas;
+
+struct UnitData
+{
+	std::wstring name;
+	uint cost_gold;
+	uint cost_population;
+	uint evolution_lv = 0;
+	uint stats[StatCount];
+	PokemonType type1 = PokemonTypeCount;
+	PokemonType type2 = PokemonTypeCount;
+	std::vector<std::pair<uint, uint>> skillset;
+	std::vector<uint> learnable_skills;
+};
+extern std::vector<UnitData> unit_datas;
+
+extern NameRegistry skill_names;
+extern NameRegistry unit_names;
+
+// skills must be loaded first, skillsets refer to them by name
+bool load_skill_datas(const std::filesystem::path& path);
+bool load_unit_datas(const std::filesystem::path& path);
+// fills skill_names and unit_names, the loaders call it, whoever replaces the datas otherwise must too
+void index_battle_datas();
+
+// -1 if there is none, the first one if the name is taken twice
+int find_unit(std::wstring_view name);
+int find_skill(std::wstring_view name);
+
+struct Unit
+{
+	uint id;
+	uint lv;
+	uint exp;
+	int skills[4] = { -1, -1, -1, -1 };
+	std::vector<uint> learnt_skills;
+	uint gain_exp = 0;
+
+	void learn_skills()
+	{
+		auto& unit_data = unit_datas[id];
+		for (auto& s : unit_data.skillset)
+		{
+			if (s.first <= lv)
+			{
+				if (!has(learnt_skills, s.second))
+					learnt_skills.push_back(s.second);
+			}
+		}
+	}
+};
+
+float get_stage_modifier(int stage);
+
+struct UnitInstance
+{
+	Unit* original;
+	uint id;
+	uint lv;
+	uint HP_MAX;
+	uint stats[StatCount];
+	PokemonType type1;
+	PokemonType type2;
+	int skills[4] = { -1, -1, -1, -1 };
+	int stat_stage[StatCount] = { 0, 0, 0, 0, 0, 0 };
+	AbnormalStatus abnormal_status = AbnormalStatusNone;
+
+	void init(uint _id, uint _lv, const int* const _skills)
+	{
+		id = _id;
+		lv = _lv;
+		auto& unit_data = unit_datas[id];
+		original = nullptr;
+		HP_MAX = calc_hp_stat(unit_data.stats[StatHP], lv);
+		stats[StatHP] = HP_MAX;
+		for (auto i = (int)StatATK; i < StatCount; i++)
+			stats[i] = calc_stat(unit_data.stats[i], lv);
+		type1 = unit_data.type1;
+		type2 = unit_data.type2;
+		memcpy(skills, _skills, sizeof(skills));
+	}
+
+	void init(Unit& unit)
+	{
+		init(unit.id, unit.lv, unit.skills);
+		original = &unit;
+	}
+
+	void apply_stat_change(const int* stage_changes)
+	{
+		auto& unit_data = unit_datas[id];
+		for (auto i = (int)StatATK; i < StatCount; i++)
+		{
+			if (auto v = stage_changes[i]; v != 0)
+			{
+				auto& stage = stat_stage[i];
+				auto new_val = std::clamp(stage + v, -6, +6);
+				if (stage != new_val)
+				{
+					stage = new_val;
+					stats[i] = calc_stat(unit_data.stats[i], lv) * get_stage_modifier(stage);
+				}
+			}
+		}
+	}
+
+	int choose_skill(UnitInstance& target, Rng& rng)
+	{
+		std::vector<std::pair<uint, uint>> cands;
+		for (auto i = 0; i < 4; i++)
+		{
+			if (auto skill_id = skills[i]; skill_id != -1)
+			{
+				auto& skill_data = skill_datas[skill_id];
+				auto weight = 100;
+				if (skill_data.category == SkillCateStatus)
+				{
+					weight = 0;
+					for (auto& e : skill_data.effects)
+					{
+						if (e.type == EffectOpponentStat)
+						{
+							auto old_state = target.stat_stage[e.data.stat.id];
+							auto new_state = std::clamp(old_state + e.data.stat.state, -6, +6);
+							if (old_state != new_state)
+							{
+								for (auto i = abs(old_state) + 1; i <= abs(new_state); i++)
+									weight += 100 * (pow(0.8f, i) * e.data.stat.prob);
+							}
+						}
+					}
+				}
+				cands.emplace_back(skill_id, weight);
+			}
+		}
+		if (cands.empty())
+			return -1;
+		return rng.weighted(cands);
+	}
+};
+
+float get_effectineness(PokemonType skill_type, PokemonType caster_type1, PokemonType caster_type2, PokemonType target_type1, PokemonType target_type2);
+
+enum SkillResult
+{
+	SkillHit,
+	SkillMiss,
+	SkillNoEffect
+};
+
+struct StatChange
+{
+	bool changed = false;
+	int stage[StatCount] = { 0, 0, 0, 0, 0, 0 };
+};
+
+SkillResult cast_skill(UnitInstance& caster, UnitInstance& target, uint skill_id, uint& damage, StatChange& caster_stat_changed, StatChange& target_stat_changed, Rng& rng);
+
+template <class T>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		return (T*)::operator new(n * sizeof(T), std::align_val_t(16));
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		::operator delete(p, std::align_val_t(16));
+	}
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U>&) const { return true; }
+	template <class U>
+	bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// one side of a battle in structure-of-arrays layout, padded to a multiple of 4 units for the simd kernel
+struct BattleSideSoA
+{
+	uint count = 0;
+	AlignedVector<float> HP;
+	AlignedVector<float> stats[StatCount];
+	AlignedVector<int> stat_stage[StatCount];
+	AlignedVector<float> EVA_modifier;
+	AlignedVector<uint8_t> type1;
+	AlignedVector<uint8_t> type2;
+
+	void resize(uint n)
+	{
+		count = n;
+		auto padded = (n + 3) & ~3U;
+		HP.assign(padded, 0.f);
+		for (auto i = 0; i < StatCount; i++)
+		{
+			stats[i].assign(padded, 1.f);
+			stat_stage[i].assign(padded, 0);
+		}
+		EVA_modifier.assign(padded, 1.f);
+		type1.assign(padded, PokemonTypeCount);
+		type2.assign(padded, PokemonTypeCount);
+	}
+
+	void set(uint idx, const UnitInstance& unit)
+	{
+		HP[idx] = unit.stats[StatHP];
+		for (auto i = 0; i < StatCount; i++)
+		{
+			stats[i][idx] = unit.stats[i];
+			stat_stage[i][idx] = unit.stat_stage[i];
+		}
+		EVA_modifier[idx] = get_stage_modifier(unit.stat_stage[StatEVA]);
+		type1[idx] = unit.type1;
+		type2[idx] = unit.type2;
+	}
+
+	void build(const std::vector<UnitInstance>& units)
+	{
+		resize(units.size());
+		for (auto i = 0; i < units.size(); i++)
+			set(i, units[i]);
+	}
+};
+
+// expected damage of one skill of the caster against every unit of a side, capped by the target's HP,
+//  scores must hold HP.size() floats
+void eval_skill_scores(const UnitInstance& caster, uint skill_id, const BattleSideSoA& side, float* scores);
+
+extern uint damage_multiplier;
+
+struct BattleEvent
+{
+	uint side;			// side of the caster
+	uint caster_idx;
+	uint target_idx;
+	int skill_id = -1;
+	SkillResult result = SkillMiss;
+	uint damage = 0;
+	uint target_HP_before = 0;
+	uint target_HP_after = 0;
+	int target_stat_stage_before[StatCount] = { 0, 0, 0, 0, 0, 0 };
+	StatChange caster_stat_change;
+	StatChange target_stat_change;
+};
+
+// everything needed to re-run a battle: the random stream, the initial units and the resulting events
+struct BattleReplay
+{
+	static constexpr uint Magic = 0x52565657; // "WVVR"
+	static constexpr uint Version = 1;
+
+	uint64_t rng_key = 0;
+	uint64_t rng_counter = 0;
+	uint damage_multiplier = 1;
+	std::vector<UnitInstance> units[2];
+	std::vector<BattleEvent> events;
+
+	// a replay that can't be written is only lost, this runs on the workers during the night
+	bool save(const std::filesystem::path& path)
+	{
+		BinaryWriter writer;
+		writer.write(Magic);
+		writer.write(Version);
+		writer.write(rng_key);
+		writer.write(rng_counter);
+		writer.write(damage_multiplier);
+		for (auto i = 0; i < 2; i++)
+		{
+			writer.write((uint16_t)units[i].size());
+			for (auto& unit : units[i])
+			{
+				writer.write((uint16_t)unit.id);
+				writer.write((uint16_t)unit.lv);
+				writer.write((uint16_t)unit.HP_MAX);
+				for (auto j = 0; j < StatCount; j++)
+					writer.write((uint16_t)unit.stats[j]);
+				for (auto j = 0; j < StatCount; j++)
+					writer.write((int8_t)unit.stat_stage[j]);
+				writer.write((uint8_t)unit.type1);
+				writer.write((uint8_t)unit.type2);
+				for (auto j = 0; j < 4; j++)
+					writer.write((int16_t)unit.skills[j]);
+				writer.write((uint8_t)unit.abnormal_status);
+			}
+		}
+		writer.write((uint)events.size());
+		for (auto& event : events)
+		{
+			writer.write((uint8_t)event.side);
+			writer.write((uint16_t)event.caster_idx);
+			writer.write((uint16_t)event.target_idx);
+			writer.write((int16_t)event.skill_id);
+			writer.write((uint8_t)event.result);
+			writer.write(event.damage);
+			writer.write((uint16_t)event.target_HP_before);
+			writer.write((uint16_t)event.target_HP_after);
+			writer.write((uint8_t)((event.caster_stat_change.changed ? 1 : 0) | (event.target_stat_change.changed ? 2 : 0)));
+			for (auto j = 0; j < StatCount; j++)
+			{
+				writer.write((int8_t)event.target_stat_stage_before[j]);
+				writer.write((int8_t)event.caster_stat_change.stage[j]);
+				writer.write((int8_t)event.target_stat_change.stage[j]);
+			}
+		}
+		std::error_code ec;
+		std::filesystem::create_directories(path.parent_path(), ec);
+		return !ec && writer.save(path);
+	}
+
+	// a replay of other sheets is refused, its ids would index the current datas
+	bool load(const std::filesystem::path& path)
+	{
+		BinaryReader reader;
+		if (!reader.load(path))
+			return false;
+		if (reader.read<uint>() != Magic || reader.read<uint>() != Version)
+			return false;
+		rng_key = reader.read<uint64_t>();
+		rng_counter = reader.read<uint64_t>();
+		damage_multiplier = reader.read<uint>();
+		for (auto i = 0; i < 2; i++)
+		{
+			units[i].resize(reader.read_count<uint16_t>(35));
+			for (auto& unit : units[i])
+			{
+				unit.original = nullptr;
+				unit.id = reader.read<uint16_t>();
+				unit.lv = reader.read<uint16_t>();
+				unit.HP_MAX = reader.read<uint16_t>();
+				for (auto j = 0; j < StatCount; j++)
+					unit.stats[j] = reader.read<uint16_t>();
+				for (auto j = 0; j < StatCount; j++)
+				{
+					unit.stat_stage[j] = reader.read<int8_t>();
+					if (unit.stat_stage[j] < -6 || unit.stat_stage[j] > 6)
+						return false;
+				}
+				auto type1 = reader.read<uint8_t>();
+				auto type2 = reader.read<uint8_t>();
+				for (auto j = 0; j < 4; j++)
+				{
+					unit.skills[j] = reader.read<int16_t>();
+					if (unit.skills[j] < -1 || unit.skills[j] >= (int)skill_datas.size())
+						return false;
+				}
+				auto abnormal_status = reader.read<uint8_t>();
+				if (unit.id >= unit_datas.size() || type1 > PokemonTypeCount || type2 > PokemonTypeCount || abnormal_status >= AbnormalStatusCount)
+					return false;
+				unit.type1 = (PokemonType)type1;
+				unit.type2 = (PokemonType)type2;
+				unit.abnormal_status = (AbnormalStatus)abnormal_status;
+			}
+		}
+		events.resize(reader.read_count(35));
+		for (auto& event : events)
+		{
+			event.side = reader.read<uint8_t>();
+			event.caster_idx = reader.read<uint16_t>();
+			event.target_idx = reader.read<uint16_t>();
+			event.skill_id = reader.read<int16_t>();
+			auto result = reader.read<uint8_t>();
+			if (result > SkillNoEffect)
+				return false;
+			event.result = (SkillResult)result;
+			event.damage = reader.read<uint>();
+			event.target_HP_before = reader.read<uint16_t>();
+			event.target_HP_after = reader.read<uint16_t>();
+			auto changed = reader.read<uint8_t>();
+			event.caster_stat_change.changed = (changed & 1) != 0;
+			event.target_stat_change.changed = (changed & 2) != 0;
+			for (auto j = 0; j < StatCount; j++)
+			{
+				event.target_stat_stage_before[j] = reader.read<int8_t>();
+				event.caster_stat_change.stage[j] = reader.read<int8_t>();
+				event.target_stat_change.stage[j] = reader.read<int8_t>();
+			}
+			if (event.side > 1 || event.caster_idx >= units[event.side].size() || event.target_idx >= units[1 - event.side].size() ||
+				event.skill_id < -1 || event.skill_id >= (int)skill_datas.size())
+				return false;
+		}
+		return reader.ok;
+	}
+};
+
+bool is_same_event(const BattleEvent& a, const BattleEvent& b);
+
+// a unit in a battle, the index stays valid for the whole battle since dead units are only tombstoned
+struct BattleHandle
+{
+	uint side;
+	uint idx;
+};
+
+// actors of the current round ordered by speed, popping is O(1) and dead actors are skipped lazily
+struct TurnOrder
+{
+	std::vector<BattleHandle> queue;
+	uint head = 0;
+
+	void clear()
+	{
+		queue.clear();
+		head = 0;
+	}
+
+	bool empty() const
+	{
+		return head >= queue.size();
+	}
+
+	void push(const BattleHandle& handle)
+	{
+		queue.push_back(handle);
+	}
+
+	BattleHandle pop()
+	{
+		return queue[head++];
+	}
+};
+
+// resolves a battle between two unit lists without any animation, the view replays the events
+struct BattleSim
+{
+	std::vector<UnitInstance>* sides[2] = { nullptr, nullptr };
+	uint alive[2] = { 0, 0 };
+	TurnOrder turn_order;
+	uint round = 0;
+	Rng rng;
+	uint damage_multiplier = 1;
+	BattleReplay* recording = nullptr;
+
+	BattleSideSoA soa[2];
+	AlignedVector<float> scores;
+	AlignedVector<float> best_scores;
+	std::vector<std::pair<uint, uint>> target_cands;
+	std::vector<std::pair<BattleHandle, uint>> round_list;
+
+	void setup(std::vector<UnitInstance>& units0, std::vector<UnitInstance>& units1, const Rng& _rng, BattleReplay* _recording = nullptr)
+	{
+		sides[0] = &units0;
+		sides[1] = &units1;
+		turn_order.clear();
+		round = 0;
+		rng = _rng;
+		damage_multiplier = ::damage_multiplier;
+		recording = _recording;
+		if (recording)
+		{
+			recording->rng_key = rng.key;
+			recording->rng_counter = rng.counter;
+			recording->damage_multiplier = damage_multiplier;
+			recording->units[0] = units0;
+			recording->units[1] = units1;
+			recording->events.clear();
+		}
+		for (auto i = 0; i < 2; i++)
+		{
+			alive[i] = 0;
+			for (auto& unit : *sides[i])
+			{
+				if (unit.stats[StatHP] > 0)
+					alive[i]++;
+			}
+			soa[i].build(*sides[i]);
+		}
+	}
+
+	bool is_alive(const BattleHandle& handle)
+	{
+		return (*sides[handle.side])[handle.idx].stats[StatHP] > 0;
+	}
+
+	// drops the tombstoned units, call when the battle is over
+	void remove_dead_units()
+	{
+		for (auto i = 0; i < 2; i++)
+		{
+			auto& units = *sides[i];
+			std::erase_if(units, [](const auto& unit) {
+				return unit.stats[StatHP] <= 0;
+			});
+			soa[i].build(units);
+		}
+		turn_order.clear();
+	}
+
+	void begin_round()
+	{
+		round_list.clear();
+		for (auto i = 0; i < 2; i++)
+		{
+			auto& units = *sides[i];
+			for (auto j = 0; j < units.size(); j++)
+			{
+				auto& unit = units[j];
+				if (unit.stats[StatHP] > 0)
+					round_list.emplace_back(BattleHandle{ (uint)i, (uint)j }, unit.stats[StatSP]);
+			}
+		}
+		std::stable_sort(round_list.begin(), round_list.end(), [](const auto& a, const auto& b) {
+			return a.second > b.second;
+		});
+		turn_order.clear();
+		for (auto& i : round_list)
+			turn_order.push(i.first);
+		round++;
+	}
+
+	// scores every opponent with all damaging skills of the caster, one kernel pass per skill,
+	//  then picks a living target with weights of the best expected damage
+	uint choose_target(const UnitInstance& caster, uint side)
+	{
+		auto& targets = soa[1 - side];
+		auto padded = (uint)targets.HP.size();
+		scores.resize(padded);
+		best_scores.assign(padded, 0.f);
+		for (auto i = 0; i < 4; i++)
+		{
+			if (auto skill_id = caster.skills[i]; skill_id != -1)
+			{
+				eval_skill_scores(caster, skill_id, targets, scores.data());
+				for (auto j = 0; j < targets.count; j++)
+					best_scores[j] = std::max(best_scores[j], scores[j]);
+			}
+		}
+		target_cands.clear();
+		for (auto j = 0; j < targets.count; j++)
+		{
+			if (targets.HP[j] > 0.f)
+				target_cands.emplace_back(j, (uint)best_scores[j] + 1);
+		}
+		return rng.weighted(target_cands);
+	}
+
+	bool finished()
+	{
+		return alive[0] == 0 || alive[1] == 0 || (round >= MAX_BATTLE_ROUNDS && turn_order.empty());
+	}
+
+	// -1: no winner, 0 or 1: the side that still has units
+	int get_winner()
+	{
+		if (alive[0] == 0 && alive[1] != 0)
+			return 1;
+		if (alive[0] != 0 && alive[1] == 0)
+			return 0;
+		return -1;
+	}
+
+	// performs one action, returns false when the battle is over
+	bool step(BattleEvent& event)
+	{
+		if (finished())
+		{
+			remove_dead_units();
+			return false;
+		}
+
+		auto caster_handle = BattleHandle{ 0, 0 };
+		while (true)
+		{
+			if (turn_order.empty())
+				begin_round();
+			caster_handle = turn_order.pop();
+			if (is_alive(caster_handle))
+				break;
+		}
+
+		auto side = caster_handle.side;
+		auto idx = caster_handle.idx;
+		auto& caster = (*sides[side])[idx];
+		auto& opponent_units = *sides[1 - side];
+		auto target_idx = choose_target(caster, side);
+		auto& target = opponent_units[target_idx];
+
+		event = BattleEvent();
+		event.side = side;
+		event.caster_idx = idx;
+		event.target_idx = target_idx;
+		event.target_HP_before = event.target_HP_after = target.stats[StatHP];
+		memcpy(event.target_stat_stage_before, target.stat_stage, sizeof(target.stat_stage));
+
+		if (auto skill_id = caster.choose_skill(target, rng); skill_id != -1)
+		{
+			event.skill_id = skill_id;
+			event.result = cast_skill(caster, target, skill_id, event.damage, event.caster_stat_change, event.target_stat_change, rng);
+			if (damage_multiplier > 1)
+				event.damage *= damage_multiplier;
+
+			if (event.damage > 0)
+			{
+				target.stats[StatHP] = target.stats[StatHP] > event.damage ? target.stats[StatHP] - event.damage : 0;
+				if (target.stats[StatHP] == 0)
+					alive[1 - side]--;
+			}
+			event.target_HP_after = target.stats[StatHP];
+			if (event.caster_stat_change.changed)
+				caster.apply_stat_change(event.caster_stat_change.stage);
+			if (event.target_stat_change.changed)
+				target.apply_stat_change(event.target_stat_change.stage);
+			soa[side].set(idx, caster);
+			soa[1 - side].set(target_idx, target);
+		}
+
+		if (recording)
+			recording->events.push_back(event);
+		return true;
+	}
+
+	// runs the battle to the end, returns the winner
+	int run(std::vector<BattleEvent>* events = nullptr)
+	{
+		BattleEvent event;
+		while (step(event))
+		{
+			if (events)
+				events->push_back(event);
+		}
+		return get_winner();
+	}
+};
+
+extern bool record_replays;
+
+std::filesystem::path get_replay_path(const BattleReplay& replay);
+
+// re-runs a replay instantly, returns false if the simulation diverges from the recorded events
+bool verify_replay(const BattleReplay& replay, int* winner = nullptr);
+
+struct BattleEstimate
+{
+	uint runs = 0;
+	float win_rate[2] = { 0.f, 0.f };
+	float win_rate_ci[2] = { 0.f, 0.f };		// half width of the 95% confidence interval
+	float surviving_HP[2] = { 0.f, 0.f };		// expected sum of HP left on each side
+	float surviving_HP_ci[2] = { 0.f, 0.f };
+	float gain_exp[2] = { 0.f, 0.f };			// expected exp won by each side
+	float gain_exp_ci[2] = { 0.f, 0.f };
+};
+
+// runs the same battle many times with independent random streams, run i always uses stream i of the seed,
+//  and the partial results are integers, so the answer does not depend on the thread count
+BattleEstimate estimate_battle(const std::vector<UnitInstance>& units0, uint defeat_gain_exp0, const std::vector<UnitInstance>& units1, uint defeat_gain_exp1,
+	uint runs, uint64_t seed, uint num_threads = 0);
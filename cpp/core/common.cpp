@@ -0,0 +1,101 @@
+#include "common.h"
+#include "jobs.h"
+
+uint64_t game_seed = 0;
+uint current_day = 0;
+
+Rng get_rng(RngDomain domain, uint entity_id, uint day)
+{
+	return Rng(game_seed, ((uint64_t)domain << 56) | ((uint64_t)day << 32) | entity_id);
+}
+
+void NameRegistry::reserve(uint n)
+{
+	auto size = 16ULL;
+	while (size < n * 2ULL)
+		size *= 2;
+	if (size <= slots.size())
+		return;
+	std::vector<Slot> old_slots(size);
+	old_slots.swap(slots);
+	auto mask = slots.size() - 1;
+	for (auto& slot : old_slots)
+	{
+		if (slot.id == -1)
+			continue;
+		auto i = slot.hash & mask;
+		while (slots[i].id != -1)
+			i = (i + 1) & mask;
+		slots[i] = slot;
+	}
+}
+
+bool NameRegistry::add(std::wstring_view name, uint id)
+{
+	reserve(count + 1);
+	auto h = hash(name);
+	auto mask = slots.size() - 1;
+	auto i = h & mask;
+	for (; slots[i].id != -1; i = (i + 1) & mask)
+	{
+		if (slots[i].hash == h && get_name(slots[i]) == name)
+			return false;
+	}
+	auto& slot = slots[i];
+	slot.hash = h;
+	slot.id = id;
+	slot.name_offset = chars.size();
+	slot.name_length = name.size();
+	chars.insert(chars.end(), name.begin(), name.end());
+	count++;
+	return true;
+}
+
+uint get_parallel_thread_count(uint num_threads)
+{
+	if (num_threads == 0)
+	{
+		if (job_system.running())
+			return job_system.worker_count();
+		return std::max(1U, std::thread::hardware_concurrency());
+	}
+	return num_threads;
+}
+
+void parallel_for(uint count, const std::function<void(uint, uint)>& fn, uint num_threads, uint chunk)
+{
+	chunk = std::max(1U, chunk);
+	if (num_threads == 0 && job_system.running())
+	{
+		job_system.run_for(count, fn, chunk);
+		return;
+	}
+	if (num_threads == 0)
+		num_threads = std::max(1U, std::thread::hardware_concurrency());
+	num_threads = std::min(num_threads, std::max(1U, (count + chunk - 1) / chunk));
+	if (num_threads == 1)
+	{
+		for (auto i = 0; i < count; i++)
+			fn(i, 0);
+		return;
+	}
+
+	std::atomic<uint> next_idx = 0;
+	auto worker = [&](uint thread_idx) {
+		while (true)
+		{
+			auto begin = next_idx.fetch_add(chunk);
+			if (begin >= count)
+				break;
+			auto end = std::min(begin + chunk, count);
+			for (auto i = begin; i < end; i++)
+				fn(i, thread_idx);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (auto i = 1; i < num_threads; i++)
+		threads.emplace_back(worker, i);
+	worker(0);
+	for (auto& t : threads)
+		t.join();
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <tuple>
+#include <fstream>
+#include <filesystem>
+
+typedef unsigned int uint;
+
+template <class T>
+bool has(const std::vector<T>& list, T v)
+{
+	for (auto _v : list)
+	{
+		if (_v == v)
+			return true;
+	}
+	return false;
+}
+
+// counter-based random stream, the n-th output only depends on the key and n
+struct Rng
+{
+	uint64_t key = 0;
+	uint64_t counter = 0;
+
+	Rng() {}
+
+	Rng(uint64_t seed, uint64_t stream = 0)
+	{
+		key = mix(seed ^ mix(stream));
+	}
+
+	static uint64_t mix(uint64_t z)
+	{
+		z += 0x9e3779b97f4a7c15;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	uint next()
+	{
+		return (uint)(mix(key + counter++ * 0x9e3779b97f4a7c15) >> 32);
+	}
+
+	// [0, 1)
+	float unit()
+	{
+		return (next() >> 8) * (1.f / 16777216.f);
+	}
+
+	// [a, b]
+	int range(int a, int b)
+	{
+		return a + (int)(((uint64_t)next() * (uint64_t)(b - a + 1)) >> 32);
+	}
+
+	// the list must not be empty
+	template <class T>
+	T weighted(const std::vector<std::pair<T, uint>>& list)
+	{
+		assert(!list.empty());
+		uint total = 0;
+		for (auto& i : list)
+			total += i.second;
+		if (total == 0)
+			return list[range(0, (int)list.size() - 1)].first;
+		auto r = (uint)range(0, (int)total - 1);
+		for (auto& i : list)
+		{
+			if (r < i.second)
+				return i.first;
+			r -= i.second;
+		}
+		return list.back().first;
+	}
+};
+
+struct BinaryWriter
+{
+	std::vector<char> data;
+
+	template <class T>
+	void write(const T& v)
+	{
+		auto p = (const char*)&v;
+		data.insert(data.end(), p, p + sizeof(T));
+	}
+
+	bool save(const std::filesystem::path& path)
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file.good())
+			return false;
+		file.write(data.data(), data.size());
+		return file.good();
+	}
+};
+
+struct BinaryReader
+{
+	std::vector<char> data;
+	uint pos = 0;
+	bool ok = true;
+
+	bool load(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file.good())
+			return false;
+		data.resize(file.tellg());
+		file.seekg(0);
+		file.read(data.data(), data.size());
+		pos = 0;
+		ok = file.good();
+		return ok;
+	}
+
+	template <class T>
+	T read()
+	{
+		T v = {};
+		if (pos + sizeof(T) > data.size())
+		{
+			ok = false;
+			return v;
+		}
+		memcpy(&v, data.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return v;
+	}
+
+	// the count of an array whose items take at least item_size bytes, zero and !ok when the rest can't hold them
+	template <class T = uint>
+	T read_count(uint item_size)
+	{
+		auto count = read<T>();
+		if ((uint64_t)count * item_size > data.size() - std::min((size_t)pos, data.size()))
+		{
+			ok = false;
+			return 0;
+		}
+		return count;
+	}
+};
+
+enum RngDomain
+{
+	RngWorldGen,
+	RngLordAI,
+	RngPark,
+	RngBattle,
+	RngInterface
+};
+
+extern uint64_t game_seed;
+extern uint current_day;
+
+// name to id lookup with open addressing, linear probing and at most half of the slots taken.
+//  the names are copied into the registry, a lookup hashes the name once and only compares the
+//  names that share its hash
+struct NameRegistry
+{
+	struct Slot
+	{
+		uint64_t hash = 0;
+		int id = -1;	// -1 is an empty slot
+		uint name_offset = 0;
+		uint name_length = 0;
+	};
+
+	std::vector<wchar_t> chars;
+	std::vector<Slot> slots;	// the size is zero or a power of two
+	uint count = 0;
+
+	static uint64_t hash(std::wstring_view name)
+	{
+		// fnv-1a
+		uint64_t h = 0xcbf29ce484222325ULL;
+		for (auto ch : name)
+		{
+			h ^= (uint)ch;
+			h *= 0x100000001b3ULL;
+		}
+		return h;
+	}
+
+	std::wstring_view get_name(const Slot& slot) const
+	{
+		return std::wstring_view(chars.data() + slot.name_offset, slot.name_length);
+	}
+
+	void clear()
+	{
+		chars.clear();
+		slots.clear();
+		count = 0;
+	}
+
+	void reserve(uint n);
+	// false if the name is in already, it keeps the first id like a search from the front would
+	bool add(std::wstring_view name, uint id);
+
+	int find(std::wstring_view name) const
+	{
+		if (slots.empty())
+			return -1;
+		auto h = hash(name);
+		auto mask = slots.size() - 1;
+		for (auto i = h & mask; ; i = (i + 1) & mask)
+		{
+			auto& slot = slots[i];
+			if (slot.id == -1)
+				return -1;
+			if (slot.hash == h && get_name(slot) == name)
+				return slot.id;
+		}
+	}
+};
+
+// a registry of the names of an enum, get_name(i) for i in [0, count)
+template <class F>
+NameRegistry make_enum_names(uint count, F&& get_name)
+{
+	NameRegistry ret;
+	ret.reserve(count);
+	for (auto i = 0; i < count; i++)
+		ret.add(get_name(i), i);
+	return ret;
+}
+
+// every random decision pulls from its own stream keyed by the game seed, the day and the entity,
+//  so a game is reproducible from its seed and streams can be used from any thread
+Rng get_rng(RngDomain domain, uint entity_id = 0, uint day = current_day);
+
+// runs fn(idx, thread_idx) for idx in [0, count) on all cores, threads grab chunk indices at a time.
+//  with num_threads 0 it runs on the job system if it is running
+void parallel_for(uint count, const std::function<void(uint, uint)>& fn, uint num_threads = 0, uint chunk = 64);
+// how many different thread_idx parallel_for can pass with num_threads
+uint get_parallel_thread_count(uint num_threads = 0);
@@ -0,0 +1,349 @@
+#include "datapack.h"
+
+#include <unordered_map>
+
+struct DataPackHeader
+{
+	static constexpr uint Magic = 0x44565657; // "WVVD"
+	static constexpr uint Version = 1;
+
+	uint magic;
+	uint version;
+	uint wchar_size;
+	uint sheet_count;
+	int64_t sheets_time;	// of the newest sheet when the pack was built
+};
+
+// a slice of the string table
+struct PackString
+{
+	uint offset;
+	uint length;
+};
+
+// std::pair isn't trivially copyable
+struct PackPair
+{
+	uint first;
+	uint second;
+};
+
+struct PackSkill
+{
+	PackString name;
+	PackString effect_text;
+	uint type;
+	uint category;
+	uint power;
+	uint acc;
+	uint pp;
+	uint target_type;
+	uint effects_begin;
+	uint effects_count;
+};
+
+struct PackUnit
+{
+	PackString name;
+	uint cost_gold;
+	uint cost_population;
+	uint evolution_lv;
+	uint stats[StatCount];
+	uint type1;
+	uint type2;
+	uint skillset_begin;
+	uint skillset_count;
+};
+
+struct PackPark
+{
+	BuildingBaseData base;
+	uint capture_num;
+	uint encounter_begin;
+	uint encounter_count;
+};
+
+std::filesystem::path get_data_pack_path(const std::filesystem::path& assets_path)
+{
+	return assets_path / L"data.pack";
+}
+
+// the count and the newest write time of the sheets, a pack only stands for the same sheets
+std::pair<uint, int64_t> get_sheets_time(const std::filesystem::path& assets_path)
+{
+	auto count = 0U;
+	int64_t time = 0;
+	std::error_code ec;
+	for (auto& it : std::filesystem::directory_iterator(assets_path, ec))
+	{
+		if (it.path().extension() != L".sht")
+			continue;
+		count++;
+		time = std::max(time, (int64_t)it.last_write_time(ec).time_since_epoch().count());
+	}
+	return { count, time };
+}
+
+template <class T>
+void write_pack_array(BinaryWriter& writer, const T* items, uint count)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	writer.write(count);
+	auto p = (const char*)items;
+	writer.data.insert(writer.data.end(), p, p + sizeof(T) * count);
+}
+
+template <class T>
+bool read_pack_array(BinaryReader& reader, std::vector<T>& items)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	auto count = reader.read<uint>();
+	if (!reader.ok || (uint64_t)count * sizeof(T) > reader.data.size() - reader.pos)
+		return false;
+	items.resize(count);
+	if (count > 0)
+		memcpy(items.data(), reader.data.data() + reader.pos, sizeof(T) * count);
+	reader.pos += sizeof(T) * count;
+	return true;
+}
+
+bool build_data_pack(const std::filesystem::path& assets_path)
+{
+	std::vector<wchar_t> strings;
+	std::unordered_map<std::wstring_view, PackString> interned;
+	auto intern = [&](const std::wstring& str) {
+		if (auto it = interned.find(str); it != interned.end())
+			return it->second;
+		PackString ret;
+		ret.offset = strings.size();
+		ret.length = str.size();
+		strings.insert(strings.end(), str.begin(), str.end());
+		// the views of the map point into the datas, which stay put while the pack is built
+		interned.emplace(str, ret);
+		return ret;
+	};
+
+	std::vector<PackSkill> skills;
+	std::vector<SkillEffect> effects;
+	for (auto& data : skill_datas)
+	{
+		auto& rec = skills.emplace_back();
+		rec.name = intern(data.name);
+		rec.effect_text = intern(data.effect_text);
+		rec.type = data.type;
+		rec.category = data.category;
+		rec.power = data.power;
+		rec.acc = data.acc;
+		rec.pp = data.pp;
+		rec.target_type = data.target_type;
+		rec.effects_begin = effects.size();
+		rec.effects_count = data.effects.size();
+		effects.insert(effects.end(), data.effects.begin(), data.effects.end());
+	}
+
+	std::vector<PackUnit> units;
+	std::vector<PackPair> skillsets;
+	for (auto& data : unit_datas)
+	{
+		auto& rec = units.emplace_back();
+		rec.name = intern(data.name);
+		rec.cost_gold = data.cost_gold;
+		rec.cost_population = data.cost_population;
+		rec.evolution_lv = data.evolution_lv;
+		memcpy(rec.stats, data.stats, sizeof(rec.stats));
+		rec.type1 = data.type1;
+		rec.type2 = data.type2;
+		rec.skillset_begin = skillsets.size();
+		rec.skillset_count = data.skillset.size();
+		for (auto [lv, skill_id] : data.skillset)
+			skillsets.push_back({ lv, skill_id });
+	}
+
+	std::vector<PackPark> parks;
+	std::vector<PackPair> encounters;
+	for (auto& data : park_datas)
+	{
+		auto& rec = parks.emplace_back();
+		rec.base = data;
+		rec.capture_num = data.capture_num;
+		rec.encounter_begin = encounters.size();
+		rec.encounter_count = data.encounter_list.size();
+		for (auto [unit_id, weight] : data.encounter_list)
+			encounters.push_back({ unit_id, weight });
+	}
+
+	auto [sheet_count, sheets_time] = get_sheets_time(assets_path);
+	DataPackHeader header;
+	header.magic = DataPackHeader::Magic;
+	header.version = DataPackHeader::Version;
+	header.wchar_size = sizeof(wchar_t);
+	header.sheet_count = sheet_count;
+	header.sheets_time = sheets_time;
+
+	BinaryWriter writer;
+	writer.write(header);
+	write_pack_array(writer, strings.data(), strings.size());
+	write_pack_array(writer, skills.data(), skills.size());
+	write_pack_array(writer, effects.data(), effects.size());
+	write_pack_array(writer, units.data(), units.size());
+	write_pack_array(writer, skillsets.data(), skillsets.size());
+	write_pack_array(writer, building_slots.data(), building_slots.size());
+	write_pack_array(writer, town_center_datas.data(), town_center_datas.size());
+	write_pack_array(writer, house_datas.data(), house_datas.size());
+	write_pack_array(writer, barracks_datas.data(), barracks_datas.size());
+	write_pack_array(writer, parks.data(), parks.size());
+	write_pack_array(writer, encounters.data(), encounters.size());
+	write_pack_array(writer, training_machine_datas.data(), training_machine_datas.size());
+	write_pack_array(writer, tower_datas.data(), tower_datas.size());
+	write_pack_array(writer, wall_datas.data(), wall_datas.size());
+	for (auto i = 0; i < ResourceTypeCount; i++)
+		write_pack_array(writer, resource_field_datas[i].data(), resource_field_datas[i].size());
+	return writer.save(get_data_pack_path(assets_path));
+}
+
+bool load_data_pack(const std::filesystem::path& assets_path)
+{
+	BinaryReader reader;
+	if (!reader.load(get_data_pack_path(assets_path)))
+		return false;
+	auto header = reader.read<DataPackHeader>();
+	if (!reader.ok || header.magic != DataPackHeader::Magic || header.version != DataPackHeader::Version || header.wchar_size != sizeof(wchar_t))
+		return false;
+	if (auto [sheet_count, sheets_time] = get_sheets_time(assets_path); sheet_count != header.sheet_count || sheets_time != header.sheets_time)
+		return false;
+
+	std::vector<wchar_t> strings;
+	std::vector<PackSkill> skills;
+	std::vector<SkillEffect> effects;
+	std::vector<PackUnit> units;
+	std::vector<PackPair> skillsets;
+	std::vector<BuildingSlot> slots;
+	std::vector<TownCenterData> town_centers;
+	std::vector<HouseData> houses;
+	std::vector<BarracksData> barrackses;
+	std::vector<PackPark> parks;
+	std::vector<PackPair> encounters;
+	std::vector<TrainingMachineData> training_machines;
+	std::vector<TowerData> towers;
+	std::vector<WallData> walls;
+	std::vector<ResourceFieldData> resource_fields[ResourceTypeCount];
+	if (!read_pack_array(reader, strings) || !read_pack_array(reader, skills) || !read_pack_array(reader, effects) ||
+		!read_pack_array(reader, units) || !read_pack_array(reader, skillsets) || !read_pack_array(reader, slots) ||
+		!read_pack_array(reader, town_centers) || !read_pack_array(reader, houses) || !read_pack_array(reader, barrackses) ||
+		!read_pack_array(reader, parks) || !read_pack_array(reader, encounters) || !read_pack_array(reader, training_machines) ||
+		!read_pack_array(reader, towers) || !read_pack_array(reader, walls))
+		return false;
+	for (auto i = 0; i < ResourceTypeCount; i++)
+	{
+		if (!read_pack_array(reader, resource_fields[i]))
+			return false;
+	}
+
+	auto get_string = [&](const PackString& str, std::wstring& out) {
+		if ((uint64_t)str.offset + str.length > strings.size())
+			return false;
+		out.assign(strings.data() + str.offset, str.length);
+		return true;
+	};
+	auto range_ok = [](uint begin, uint count, size_t size) {
+		return (uint64_t)begin + count <= size;
+	};
+	// the enums of the effects index arrays in the battles
+	for (auto& effect : effects)
+	{
+		if ((uint)effect.type >= EffectTypeCount)
+			return false;
+		switch (effect.type)
+		{
+		case EffectUserStat:
+		case EffectOpponentStat:
+			if ((uint)effect.data.stat.id >= StatCount)
+				return false;
+			break;
+		case EffectStatus:
+			if ((uint)effect.data.status.id >= AbnormalStatusCount)
+				return false;
+			break;
+		}
+	}
+
+	std::vector<SkillData> new_skill_datas(skills.size());
+	for (auto i = 0; i < skills.size(); i++)
+	{
+		auto& rec = skills[i];
+		auto& data = new_skill_datas[i];
+		if (!get_string(rec.name, data.name) || !get_string(rec.effect_text, data.effect_text) ||
+			rec.type >= PokemonTypeCount || rec.category >= SkillCategoryCount || rec.target_type > TargetSelf ||
+			!range_ok(rec.effects_begin, rec.effects_count, effects.size()))
+			return false;
+		data.type = (PokemonType)rec.type;
+		data.category = (SkillCategory)rec.category;
+		data.power = rec.power;
+		data.acc = rec.acc;
+		data.pp = rec.pp;
+		data.target_type = (TargetType)rec.target_type;
+		data.effects.assign(effects.begin() + rec.effects_begin, effects.begin() + rec.effects_begin + rec.effects_count);
+	}
+
+	std::vector<UnitData> new_unit_datas(units.size());
+	for (auto i = 0; i < units.size(); i++)
+	{
+		auto& rec = units[i];
+		auto& data = new_unit_datas[i];
+		if (!get_string(rec.name, data.name) || rec.type1 > PokemonTypeCount || rec.type2 > PokemonTypeCount ||
+			!range_ok(rec.skillset_begin, rec.skillset_count, skillsets.size()))
+			return false;
+		data.cost_gold = rec.cost_gold;
+		data.cost_population = rec.cost_population;
+		data.evolution_lv = rec.evolution_lv;
+		memcpy(data.stats, rec.stats, sizeof(data.stats));
+		data.type1 = (PokemonType)rec.type1;
+		data.type2 = (PokemonType)rec.type2;
+		for (auto j = 0; j < rec.skillset_count; j++)
+		{
+			auto [lv, skill_id] = skillsets[rec.skillset_begin + j];
+			if (skill_id >= skills.size())
+				return false;
+			data.skillset.emplace_back(lv, skill_id);
+		}
+	}
+
+	std::vector<ParkData> new_park_datas(parks.size());
+	for (auto i = 0; i < parks.size(); i++)
+	{
+		auto& rec = parks[i];
+		auto& data = new_park_datas[i];
+		if (!range_ok(rec.encounter_begin, rec.encounter_count, encounters.size()))
+			return false;
+		(BuildingBaseData&)data = rec.base;
+		data.capture_num = rec.capture_num;
+		for (auto j = 0; j < rec.encounter_count; j++)
+		{
+			auto [unit_id, weight] = encounters[rec.encounter_begin + j];
+			if (unit_id >= units.size())
+				return false;
+			data.encounter_list.emplace_back(unit_id, weight);
+		}
+	}
+	// a slot of a building that was cut keeps BuildingTypeCount
+	for (auto& slot : slots)
+	{
+		if (slot.type > BuildingTypeCount)
+			return false;
+	}
+
+	skill_datas = std::move(new_skill_datas);
+	unit_datas = std::move(new_unit_datas);
+	building_slots = std::move(slots);
+	town_center_datas = std::move(town_centers);
+	house_datas = std::move(houses);
+	barracks_datas = std::move(barrackses);
+	park_datas = std::move(new_park_datas);
+	training_machine_datas = std::move(training_machines);
+	tower_datas = std::move(towers);
+	wall_datas = std::move(walls);
+	for (auto i = 0; i < ResourceTypeCount; i++)
+		resource_field_datas[i] = std::move(resource_fields[i]);
+	index_battle_datas();
+	return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "world.h"
+
+// every world data of the sheets in one file, assets/data.pack. names are resolved to ids, the
+//  records are flat arrays and the strings are interned into one table, so it loads with a single
+//  read and no parsing. wvv_server -build-pack writes it from the sheets, a pack older than any
+//  sheet of the directory is ignored. built for the platform it runs on, wchar_t is stored as is
+
+// from what is loaded now, call after load_world_sheets
+bool build_data_pack(const std::filesystem::path& assets_path);
+// the globals are only replaced when the whole pack could be read
+bool load_data_pack(const std::filesystem::path& assets_path);
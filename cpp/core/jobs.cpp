@@ -0,0 +1,225 @@
+#include "jobs.h"
+
+JobSystem job_system;
+
+thread_local int job_worker_idx = -1;
+// set while a background job runs, what it submits is background too
+thread_local bool job_in_background = false;
+
+void* ScratchArena::alloc(size_t size, size_t align)
+{
+	while (true)
+	{
+		if (block_idx < blocks.size())
+		{
+			auto& block = blocks[block_idx];
+			auto p = (pos + align - 1) & ~(align - 1);
+			if (p + size <= block.second)
+			{
+				pos = p + size;
+				return block.first.get() + p;
+			}
+			block_idx++;
+			pos = 0;
+			continue;
+		}
+		auto block_size = std::max(BlockSize, size + align);
+		blocks.emplace_back(new char[block_size], block_size);
+	}
+}
+
+void JobSystem::init(uint num_threads)
+{
+	if (running())
+		return;
+	// at least one thread besides the caller, so jobs progress while the caller doesn't wait
+	if (num_threads == 0)
+		num_threads = std::max(2U, std::thread::hardware_concurrency());
+	quit = false;
+	for (auto i = 0; i < num_threads; i++)
+		workers.emplace_back(new Worker);
+	job_worker_idx = 0;
+	for (auto i = 1; i < num_threads; i++)
+		threads.emplace_back(&JobSystem::worker_main, this, i);
+}
+
+void JobSystem::shutdown()
+{
+	if (!running())
+		return;
+	{
+		std::lock_guard lock(sleep_mtx);
+		quit = true;
+	}
+	sleep_cv.notify_all();
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+	workers.clear();
+	job_worker_idx = -1;
+}
+
+uint JobSystem::current_worker() const
+{
+	return job_worker_idx > 0 ? job_worker_idx : 0;
+}
+
+ScratchArena& JobSystem::scratch()
+{
+	// worker 0's arena belongs to the thread that called init, the others can't share it
+	thread_local ScratchArena outside_arena;
+	if (!running() || job_worker_idx < 0)
+		return outside_arena;
+	return workers[job_worker_idx]->arena;
+}
+
+void JobSystem::push(uint worker_idx, Job&& job)
+{
+	auto background = job.background;
+	auto& worker = *workers[worker_idx];
+	{
+		std::lock_guard lock(worker.mtx);
+		worker.jobs.push_back(std::move(job));
+	}
+	{
+		std::lock_guard lock(sleep_mtx);
+		queued++;
+	}
+	// a background job may only be taken by some of the sleepers
+	if (background)
+		sleep_cv.notify_all();
+	else
+		sleep_cv.notify_one();
+}
+
+std::shared_ptr<JobGroup> JobSystem::submit(std::function<void(uint)>&& fn, std::shared_ptr<JobGroup> group)
+{
+	if (!group)
+		group.reset(new JobGroup);
+	group->remain.fetch_add(1, std::memory_order_relaxed);
+	if (!running())
+	{
+		fn(0);
+		group->remain.fetch_sub(1, std::memory_order_release);
+		return group;
+	}
+
+	push(current_worker(), { std::move(fn), group, job_in_background && workers.size() > 1 });
+	return group;
+}
+
+std::shared_ptr<JobGroup> JobSystem::submit_background(std::function<void(uint)>&& fn)
+{
+	// with worker 0 alone it has to run them after all
+	if (workers.size() < 2)
+		return submit(std::move(fn));
+
+	auto group = std::make_shared<JobGroup>();
+	group->remain.fetch_add(1, std::memory_order_relaxed);
+	push(1 + next_background++ % (workers.size() - 1), { std::move(fn), group, true });
+	return group;
+}
+
+bool JobSystem::run_one(uint worker_idx)
+{
+	Job job;
+	auto found = false;
+	auto take = [&](std::deque<Job>& jobs, bool newest) {
+		if (worker_idx != 0)
+		{
+			if (!jobs.empty())
+			{
+				if (newest)
+				{
+					job = std::move(jobs.back());
+					jobs.pop_back();
+				}
+				else
+				{
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+				found = true;
+			}
+			return;
+		}
+		// worker 0 passes over the background jobs
+		for (auto i = 0; i < jobs.size(); i++)
+		{
+			auto it = newest ? jobs.end() - 1 - i : jobs.begin() + i;
+			if (!it->background)
+			{
+				job = std::move(*it);
+				jobs.erase(it);
+				found = true;
+				return;
+			}
+		}
+	};
+	{
+		auto& worker = *workers[worker_idx];
+		std::lock_guard lock(worker.mtx);
+		take(worker.jobs, true);
+	}
+	for (auto i = 1; !found && i < workers.size(); i++)
+	{
+		auto& victim = *workers[(worker_idx + i) % workers.size()];
+		std::lock_guard lock(victim.mtx);
+		take(victim.jobs, false);
+	}
+	if (!found)
+		return false;
+	queued--;
+
+	auto& arena = workers[worker_idx]->arena;
+	auto mark = arena.mark();
+	auto was_background = job_in_background;
+	job_in_background = job.background;
+	job.fn(worker_idx);
+	job_in_background = was_background;
+	arena.restore(mark);
+	job.group->remain.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void JobSystem::worker_main(uint worker_idx)
+{
+	job_worker_idx = worker_idx;
+	while (true)
+	{
+		if (run_one(worker_idx))
+			continue;
+		std::unique_lock lock(sleep_mtx);
+		sleep_cv.wait(lock, [&]() {
+			return quit || queued > 0;
+		});
+		if (quit)
+			break;
+	}
+}
+
+void JobSystem::wait(JobGroup& group)
+{
+	// threads outside the system only wait, running jobs would share the arena of worker 0
+	auto can_run = running() && job_worker_idx >= 0;
+	while (!group.done())
+	{
+		if (!can_run || !run_one(job_worker_idx))
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::run_for(uint count, const std::function<void(uint, uint)>& fn, uint chunk)
+{
+	chunk = std::max(1U, chunk);
+	auto group = std::make_shared<JobGroup>();
+	for (auto begin = 0U; begin < count; begin += chunk)
+	{
+		auto end = std::min(begin + chunk, count);
+		submit([&fn, begin, end](uint worker_idx) {
+			for (auto i = begin; i < end; i++)
+				fn(i, worker_idx);
+		}, group);
+	}
+	wait(*group);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <deque>
+#include <condition_variable>
+
+// bump allocator for the temporaries of jobs, every worker owns one and threads outside the
+//  system get their own. a job gets the arena back in the state it found it in, so nothing
+//  allocated in it may outlive the job, code outside of jobs marks and restores by itself
+struct ScratchArena
+{
+	static constexpr size_t BlockSize = 1 << 20;
+
+	std::vector<std::pair<std::unique_ptr<char[]>, size_t>> blocks;
+	uint block_idx = 0;
+	size_t pos = 0;
+
+	void* alloc(size_t size, size_t align = alignof(std::max_align_t));
+
+	// only for trivially destructible types, destructors are never called
+	template <class T>
+	T* alloc_array(uint count)
+	{
+		static_assert(std::is_trivially_destructible_v<T>);
+		auto ret = (T*)alloc(sizeof(T) * count, alignof(T));
+		for (auto i = 0; i < count; i++)
+			new (ret + i) T();
+		return ret;
+	}
+
+	std::pair<uint, size_t> mark() const { return { block_idx, pos }; }
+	void restore(const std::pair<uint, size_t>& m) { block_idx = m.first; pos = m.second; }
+};
+
+// counts the unfinished jobs of one submission
+struct JobGroup
+{
+	std::atomic<uint> remain = 0;
+
+	bool done() const { return remain.load(std::memory_order_acquire) == 0; }
+};
+
+// work stealing job system, every worker pops the newest job of its own queue and steals the
+//  oldest job of the others when it runs dry. worker 0 is the thread that called init, it runs
+//  jobs while it waits. threads outside the system submit into the queue of worker 0 and wait
+//  without running jobs. background jobs, and every job they submit, are left to the other
+//  workers, so worker 0 never picks up a long job while it waits for a short one
+struct JobSystem
+{
+	struct Job
+	{
+		std::function<void(uint)> fn;	// takes the index of the worker that runs it
+		std::shared_ptr<JobGroup> group;
+		bool background = false;
+	};
+
+	struct Worker
+	{
+		std::mutex mtx;
+		std::deque<Job> jobs;
+		ScratchArena arena;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::mutex sleep_mtx;
+	std::condition_variable sleep_cv;
+	std::atomic<uint> queued = 0;
+	std::atomic<uint> next_background = 0;
+	bool quit = false;
+
+	~JobSystem() { shutdown(); }
+
+	// num_threads counts the calling thread, 0 uses all cores but at least two threads
+	void init(uint num_threads = 0);
+	void shutdown();
+	bool running() const { return !workers.empty(); }
+	uint worker_count() const { return workers.size(); }
+	uint current_worker() const;
+	ScratchArena& scratch();
+
+	// adds the job to the group, a new group is made if none is given
+	std::shared_ptr<JobGroup> submit(std::function<void(uint)>&& fn, std::shared_ptr<JobGroup> group = nullptr);
+	// for long jobs nobody waits on right away, queued on the workers other than 0
+	std::shared_ptr<JobGroup> submit_background(std::function<void(uint)>&& fn);
+	// runs jobs on the calling thread until the group is done
+	void wait(JobGroup& group);
+	// fn(idx, worker_idx) for idx in [0, count), chunk indices per job, returns when all are done
+	void run_for(uint count, const std::function<void(uint, uint)>& fn, uint chunk = 1);
+
+	// the result of idx lands at idx whatever worker ran it, so it doesn't depend on the scheduling
+	template <class T, class F>
+	std::vector<T> map(uint count, F&& fn)
+	{
+		static_assert(!std::is_same_v<T, bool>, "vector<bool> can't be written from several threads");
+		std::vector<T> ret(count);
+		run_for(count, [&](uint idx, uint worker_idx) {
+			ret[idx] = fn(idx, worker_idx);
+		});
+		return ret;
+	}
+
+	void push(uint worker_idx, Job&& job);
+	bool run_one(uint worker_idx);
+	void worker_main(uint worker_idx);
+};
+
+extern JobSystem job_system;
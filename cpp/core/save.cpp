@@ -0,0 +1,565 @@
+#include "save.h"
+
+#include <deque>
+#include <condition_variable>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(void*) == sizeof(uint64_t), "the save format keeps pointers in 64 bit offsets");
+
+struct SaveWriter
+{
+	std::vector<char> data;
+
+	template <class T>
+	uint64_t reserve()
+	{
+		data.resize((data.size() + 7) & ~7);
+		auto offset = data.size();
+		data.resize(offset + sizeof(T));
+		return offset;
+	}
+
+	template <class T>
+	T& at(uint64_t offset)
+	{
+		return *(T*)(data.data() + offset);
+	}
+
+	// the records are zeroed, the caller fills them through at()
+	template <class T>
+	SaveArray<T> reserve_array(uint count)
+	{
+		data.resize((data.size() + 7) & ~7);
+		SaveArray<T> ret;
+		memset(&ret, 0, sizeof(ret));
+		ret.offset = data.size();
+		ret.count = count;
+		data.resize(data.size() + sizeof(T) * count);
+		return ret;
+	}
+
+	template <class T>
+	SaveArray<T> write_array(const T* items, uint count)
+	{
+		auto ret = reserve_array<T>(count);
+		if (count > 0)
+			memcpy(data.data() + ret.offset, items, sizeof(T) * count);
+		return ret;
+	}
+};
+
+std::mutex snapshot_mtx;
+std::vector<std::unique_ptr<WorldSnapshot>> free_snapshots;
+
+std::shared_ptr<const WorldSnapshot> take_world_snapshot()
+{
+	std::unique_ptr<WorldSnapshot> snapshot;
+	{
+		std::lock_guard lock(snapshot_mtx);
+		if (!free_snapshots.empty())
+		{
+			snapshot = std::move(free_snapshots.back());
+			free_snapshots.pop_back();
+		}
+	}
+	if (!snapshot)
+		snapshot.reset(new WorldSnapshot);
+
+	snapshot->seed = game_seed;
+	snapshot->day = current_day;
+	snapshot->tile_cx = tile_cx;
+	snapshot->tile_cy = tile_cy;
+	snapshot->lords.resize(lords.size());
+	for (auto i = 0; i < lords.size(); i++)
+	{
+		auto& src = lords[i];
+		auto& dst = snapshot->lords[i];
+		dst.id = src.id;
+		memcpy(dst.resources, src.resources, sizeof(dst.resources));
+		dst.cities = src.cities;
+	}
+	snapshot->neutral_camps = neutral_camps;
+
+	return std::shared_ptr<const WorldSnapshot>(snapshot.release(), [](const WorldSnapshot* p) {
+		std::lock_guard lock(snapshot_mtx);
+		free_snapshots.emplace_back((WorldSnapshot*)p);
+	});
+}
+
+void write_world(std::vector<char>& data, const WorldSnapshot& snapshot)
+{
+	auto& lords = snapshot.lords;
+	auto& neutral_camps = snapshot.neutral_camps;
+
+	SaveWriter writer;
+	writer.data = std::move(data);
+	writer.data.clear();
+	auto header_offset = writer.reserve<SaveHeader>();
+
+	// a record is filled through its offset once its children are written, no reference to
+	//  the buffer is kept over a resize
+	auto lords_array = writer.reserve_array<SaveLord>(lords.size());
+	for (auto i = 0; i < lords.size(); i++)
+	{
+		auto& lord = lords[i];
+		auto cities_array = writer.reserve_array<SaveCity>(lord.cities.size());
+		for (auto j = 0; j < lord.cities.size(); j++)
+		{
+			auto& city = lord.cities[j];
+
+			auto buildings_array = writer.reserve_array<SaveBuilding>(city.buildings.size());
+			for (auto k = 0; k < city.buildings.size(); k++)
+			{
+				auto& building = city.buildings[k];
+				auto& rec = writer.at<SaveBuilding>(buildings_array.offset + k * sizeof(SaveBuilding));
+				rec.slot = building.slot;
+				rec.type = building.type;
+				rec.lv = building.lv;
+			}
+
+			auto captures_array = writer.reserve_array<SaveCapture>(city.captures.size());
+			for (auto k = 0; k < city.captures.size(); k++)
+			{
+				auto& capture = city.captures[k];
+				auto& rec = writer.at<SaveCapture>(captures_array.offset + k * sizeof(SaveCapture));
+				rec.unit_id = capture.unit_id;
+				rec.exclusive_id = capture.exclusive_id;
+				rec.lv = capture.lv;
+				rec.cost_gold = capture.cost_gold;
+			}
+
+			auto units_array = writer.reserve_array<SaveUnit>(city.units.size());
+			for (auto k = 0; k < city.units.size(); k++)
+			{
+				auto& unit = city.units[k];
+				auto learnt_skills = writer.write_array(unit.learnt_skills.data(), unit.learnt_skills.size());
+				auto& rec = writer.at<SaveUnit>(units_array.offset + k * sizeof(SaveUnit));
+				rec.id = unit.id;
+				rec.lv = unit.lv;
+				rec.exp = unit.exp;
+				rec.gain_exp = unit.gain_exp;
+				memcpy(rec.skills, unit.skills, sizeof(rec.skills));
+				rec.learnt_skills = learnt_skills;
+			}
+
+			auto troops_array = writer.reserve_array<SaveTroop>(city.troops.size());
+			for (auto k = 0; k < city.troops.size(); k++)
+			{
+				auto& troop = city.troops[k];
+				auto units = writer.write_array(troop.units.data(), troop.units.size());
+				auto& rec = writer.at<SaveTroop>(troops_array.offset + k * sizeof(SaveTroop));
+				rec.target = troop.target;
+				rec.units = units;
+			}
+
+			auto& rec = writer.at<SaveCity>(cities_array.offset + j * sizeof(SaveCity));
+			rec.tile_id = city.tile_id;
+			rec.loyalty = city.loyalty;
+			rec.production = city.production;
+			rec.buildings = buildings_array;
+			rec.captures = captures_array;
+			rec.units = units_array;
+			rec.troops = troops_array;
+		}
+
+		auto& rec = writer.at<SaveLord>(lords_array.offset + i * sizeof(SaveLord));
+		memcpy(rec.resources, lord.resources, sizeof(rec.resources));
+		rec.cities = cities_array;
+	}
+
+	auto camps_array = writer.reserve_array<SaveCamp>(neutral_camps.size());
+	for (auto i = 0; i < neutral_camps.size(); i++)
+	{
+		auto& camp = neutral_camps[i];
+		auto units_array = writer.reserve_array<SaveCampUnit>(camp.units.size());
+		for (auto j = 0; j < camp.units.size(); j++)
+		{
+			auto& unit = camp.units[j];
+			auto& rec = writer.at<SaveCampUnit>(units_array.offset + j * sizeof(SaveCampUnit));
+			rec.id = unit.id;
+			rec.lv = unit.lv;
+			rec.HP = unit.stats[StatHP];
+			memcpy(rec.skills, unit.skills, sizeof(rec.skills));
+		}
+		auto& rec = writer.at<SaveCamp>(camps_array.offset + i * sizeof(SaveCamp));
+		rec.tile_id = camp.tile_id;
+		rec.chest_type = camp.chest.type;
+		rec.chest_value = camp.chest.value;
+		rec.units = units_array;
+	}
+
+	auto& header = writer.at<SaveHeader>(header_offset);
+	header.magic = SaveHeader::Magic;
+	header.version = SaveHeader::Version;
+	header.seed = snapshot.seed;
+	header.day = snapshot.day;
+	header.tile_cx = snapshot.tile_cx;
+	header.tile_cy = snapshot.tile_cy;
+	header.lords = lords_array;
+	header.camps = camps_array;
+
+	data = std::move(writer.data);
+}
+
+bool save_world(const std::filesystem::path& path)
+{
+	std::vector<char> data;
+	write_world(data, *take_world_snapshot());
+	std::ofstream file(path, std::ios::binary);
+	if (!file.good())
+		return false;
+	file.write(data.data(), data.size());
+	return file.good();
+}
+
+// one thread that runs the save tasks in order, started by the first task
+struct SaveQueue
+{
+	std::thread thread;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<std::function<void()>> tasks;
+	uint pending = 0;	// queued or running
+	bool quit = false;
+
+	~SaveQueue()
+	{
+		{
+			std::lock_guard lock(mtx);
+			quit = true;
+		}
+		cv.notify_all();
+		if (thread.joinable())
+			thread.join();
+	}
+
+	void run()
+	{
+		std::unique_lock lock(mtx);
+		while (true)
+		{
+			cv.wait(lock, [&]() {
+				return quit || !tasks.empty();
+			});
+			// what was submitted before the quit still runs
+			if (tasks.empty())
+				break;
+			auto fn = std::move(tasks.front());
+			tasks.pop_front();
+			lock.unlock();
+			fn();
+			fn = nullptr;
+			lock.lock();
+			pending--;
+			cv.notify_all();
+		}
+	}
+};
+SaveQueue save_queue;
+
+void submit_save_task(std::function<void()>&& fn)
+{
+	{
+		std::lock_guard lock(save_queue.mtx);
+		if (!save_queue.thread.joinable())
+			save_queue.thread = std::thread(&SaveQueue::run, &save_queue);
+		save_queue.tasks.push_back(std::move(fn));
+		save_queue.pending++;
+	}
+	save_queue.cv.notify_all();
+}
+
+bool is_saving()
+{
+	std::lock_guard lock(save_queue.mtx);
+	return save_queue.pending > 0;
+}
+
+void finish_saves()
+{
+	std::unique_lock lock(save_queue.mtx);
+	save_queue.cv.wait(lock, [&]() {
+		return save_queue.pending == 0;
+	});
+}
+
+void save_world_async(const std::filesystem::path& path)
+{
+	submit_save_task([snapshot = take_world_snapshot(), path]() {
+		std::vector<char> data;
+		write_world(data, *snapshot);
+		auto tmp_path = path;
+		tmp_path += ".tmp";
+		{
+			std::ofstream file(tmp_path, std::ios::binary);
+			file.write(data.data(), data.size());
+			if (!file.good())
+				return;
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp_path, path, ec);
+	});
+}
+
+// a private copy-on-write view of a file, writes never reach the file
+struct MappedFile
+{
+	char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	bool open(const std::filesystem::path& path)
+	{
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+			return false;
+		size = file_size.QuadPart;
+		mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (!mapping)
+			return false;
+		data = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		return data != nullptr;
+#else
+		auto fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		size = st.st_size;
+		auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			return false;
+		data = (char*)p;
+		return true;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap(data, size);
+#endif
+	}
+};
+
+// turns the offset of the array into a pointer, fails if it points outside of the file
+template <class T>
+bool fixup(SaveArray<T>& array, const MappedFile& file)
+{
+	auto offset = array.offset;
+	if (offset % alignof(T) != 0 || offset > file.size || (file.size - offset) / sizeof(T) < array.count)
+		return false;
+	array.ptr = (T*)(file.data + offset);
+	return true;
+}
+
+bool load_world(const std::filesystem::path& path)
+{
+	MappedFile file;
+	if (!file.open(path) || file.size < sizeof(SaveHeader))
+		return false;
+
+	auto& header = *(SaveHeader*)file.data;
+	if (header.magic != SaveHeader::Magic || header.version != SaveHeader::Version)
+		return false;
+	if (header.tile_cx < MIN_MAP_SIZE || header.tile_cy < MIN_MAP_SIZE || header.tile_cx > MAX_MAP_SIZE || header.tile_cy > MAX_MAP_SIZE)
+		return false;
+
+	// every record is only reached through its parent, so fixing up top down visits each array once
+	if (!fixup(header.lords, file) || !fixup(header.camps, file))
+		return false;
+	for (auto& lord : header.lords)
+	{
+		if (!fixup(lord.cities, file))
+			return false;
+		for (auto& city : lord.cities)
+		{
+			if (!fixup(city.buildings, file) || !fixup(city.captures, file) || !fixup(city.units, file) || !fixup(city.troops, file))
+				return false;
+			for (auto& unit : city.units)
+			{
+				if (!fixup(unit.learnt_skills, file))
+					return false;
+			}
+			for (auto& troop : city.troops)
+			{
+				if (!fixup(troop.units, file))
+					return false;
+			}
+		}
+	}
+	for (auto& camp : header.camps)
+	{
+		if (!fixup(camp.units, file))
+			return false;
+	}
+	// ids index the data sheets later on, a bad one would only crash in a battle
+	auto tile_count = (uint64_t)header.tile_cx * header.tile_cy;
+	auto skills_ok = [](const int* skills) {
+		for (auto i = 0; i < 4; i++)
+		{
+			if (skills[i] < -1 || skills[i] >= (int)skill_datas.size())
+				return false;
+		}
+		return true;
+	};
+	for (auto& lord : header.lords)
+	{
+		for (auto& city : lord.cities)
+		{
+			// the first troop holds the units that stay in the city, the day update adds to it
+			if (city.tile_id >= tile_count || city.buildings.count != building_slots.size() || city.troops.count == 0)
+				return false;
+			for (auto& building : city.buildings)
+			{
+				if (building.type > BuildingTypeCount || (building.lv > 0 && !get_building_base_data((BuildingType)building.type, building.lv - 1)))
+					return false;
+			}
+			for (auto& unit : city.units)
+			{
+				if (unit.id >= unit_datas.size() || !skills_ok(unit.skills))
+					return false;
+				for (auto skill : unit.learnt_skills)
+				{
+					if (skill >= skill_datas.size())
+						return false;
+				}
+			}
+			for (auto& capture : city.captures)
+			{
+				if (capture.unit_id >= unit_datas.size())
+					return false;
+			}
+			for (auto& troop : city.troops)
+			{
+				if (troop.target >= tile_count)
+					return false;
+				for (auto idx : troop.units)
+				{
+					if (idx >= city.units.count)
+						return false;
+				}
+			}
+		}
+	}
+	for (auto& camp : header.camps)
+	{
+		if (camp.tile_id >= tile_count)
+			return false;
+		for (auto& unit : camp.units)
+		{
+			if (unit.id >= unit_datas.size() || !skills_ok(unit.skills))
+				return false;
+		}
+	}
+
+	game_seed = header.seed;
+	current_day = header.day;
+	if (tile_cx != header.tile_cx || tile_cy != header.tile_cy || tiles.size() == 0)
+	{
+		tile_cx = header.tile_cx;
+		tile_cy = header.tile_cy;
+		init_tiles();
+	}
+	clear_world();
+
+	for (auto i = 0; i < header.lords.count; i++)
+	{
+		auto& src = header.lords[i];
+		auto& lord = lords.emplace_back();
+		lord.id = i;
+		memcpy(lord.resources, src.resources, sizeof(lord.resources));
+		for (auto& src_city : src.cities)
+		{
+			if (!lord.build_city(src_city.tile_id))
+				continue;
+			auto& city = lord.cities.back();
+			city.loyalty = src_city.loyalty;
+			city.production = src_city.production;
+
+			for (auto j = 0; j < city.buildings.size(); j++)
+			{
+				auto& building = city.buildings[j];
+				building.slot = src_city.buildings[j].slot;
+				building.type = (BuildingType)src_city.buildings[j].type;
+				building.lv = src_city.buildings[j].lv;
+			}
+			city.captures.resize(src_city.captures.count);
+			for (auto j = 0; j < city.captures.size(); j++)
+			{
+				auto& capture = city.captures[j];
+				capture.unit_id = src_city.captures[j].unit_id;
+				capture.exclusive_id = src_city.captures[j].exclusive_id;
+				capture.lv = src_city.captures[j].lv;
+				capture.cost_gold = src_city.captures[j].cost_gold;
+			}
+			city.units.resize(src_city.units.count);
+			for (auto j = 0; j < city.units.size(); j++)
+			{
+				auto& unit = city.units[j];
+				auto& src_unit = src_city.units[j];
+				unit.id = src_unit.id;
+				unit.lv = src_unit.lv;
+				unit.exp = src_unit.exp;
+				unit.gain_exp = src_unit.gain_exp;
+				memcpy(unit.skills, src_unit.skills, sizeof(unit.skills));
+				unit.learnt_skills.assign(src_unit.learnt_skills.begin(), src_unit.learnt_skills.end());
+			}
+			city.troops.resize(src_city.troops.count);
+			for (auto j = 0; j < city.troops.size(); j++)
+			{
+				auto& troop = city.troops[j];
+				troop.units.assign(src_city.troops[j].units.begin(), src_city.troops[j].units.end());
+				city.set_troop_target(troop, src_city.troops[j].target);
+			}
+		}
+	}
+
+	for (auto& src : header.camps)
+	{
+		std::vector<NeutralUnit> units(src.units.count);
+		for (auto i = 0; i < units.size(); i++)
+		{
+			units[i].id = src.units[i].id;
+			units[i].lv = src.units[i].lv;
+			memcpy(units[i].skills, src.units[i].skills, sizeof(units[i].skills));
+		}
+		if (add_neutral_camp(src.tile_id, units, (ChestType)src.chest_type, src.chest_value))
+		{
+			auto& camp = neutral_camps.back();
+			for (auto i = 0; i < camp.units.size(); i++)
+				camp.units[i].stats[StatHP] = std::min(src.units[i].HP, camp.units[i].HP_MAX);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "world.h"
+
+// binary snapshot of the world at the start of a day. the file is mapped copy-on-write and
+//  the offsets in it are turned into pointers in place, so loading is one pass over the records.
+//  the xml 1.save of the game stays as the export/import format
+//  little endian and 64 bit only, a save from another version is refused
+
+template <class T>
+struct SaveArray
+{
+	union
+	{
+		uint64_t offset;	// from the start of the file, until the array is fixed up
+		T* ptr;
+	};
+	uint count;
+	uint pad;
+
+	T* begin() const { return ptr; }
+	T* end() const { return ptr + count; }
+	T& operator[](uint idx) const { return ptr[idx]; }
+};
+
+struct SaveBuilding
+{
+	uint slot;
+	uint type;
+	uint lv;
+};
+
+struct SaveCapture
+{
+	uint unit_id;
+	uint exclusive_id;
+	uint lv;
+	uint cost_gold;
+};
+
+struct SaveUnit
+{
+	uint id;
+	uint lv;
+	uint exp;
+	uint gain_exp;
+	int skills[4];
+	SaveArray<uint> learnt_skills;
+};
+
+struct SaveTroop
+{
+	uint target;
+	uint pad;
+	SaveArray<uint> units;
+};
+
+struct SaveCity
+{
+	uint tile_id;
+	uint loyalty;
+	uint production;
+	uint pad;
+	SaveArray<SaveBuilding> buildings;
+	SaveArray<SaveCapture> captures;
+	SaveArray<SaveUnit> units;
+	SaveArray<SaveTroop> troops;
+};
+
+struct SaveLord
+{
+	uint resources[ResourceTypeCount];
+	uint pad;
+	SaveArray<SaveCity> cities;
+};
+
+struct SaveCampUnit
+{
+	uint id;
+	uint lv;
+	uint HP;
+	int skills[4];
+};
+
+struct SaveCamp
+{
+	uint tile_id;
+	uint chest_type;
+	uint chest_value;
+	uint pad;
+	SaveArray<SaveCampUnit> units;
+};
+
+struct SaveHeader
+{
+	static constexpr uint Magic = 0x53565657; // "WVVS"
+	static constexpr uint Version = 1;
+
+	uint magic;
+	uint version;
+	uint64_t seed;
+	uint day;
+	uint tile_cx;
+	uint tile_cy;
+	uint pad;
+	SaveArray<SaveLord> lords;
+	SaveArray<SaveCamp> camps;
+};
+
+// what a save holds of the world, copied so it can be written while the world moves on. the
+//  lords only have their id, resources and cities
+struct WorldSnapshot
+{
+	uint64_t seed;
+	uint day;
+	uint tile_cx;
+	uint tile_cy;
+	std::vector<Lord> lords;
+	std::vector<NeutralCamp> neutral_camps;
+};
+
+// the copy goes into a snapshot that was released before if there is one, so it mostly
+//  reuses the buffers of the last save
+std::shared_ptr<const WorldSnapshot> take_world_snapshot();
+// the image in memory, what save_world writes to the file
+void write_world(std::vector<char>& data, const WorldSnapshot& snapshot);
+bool save_world(const std::filesystem::path& path);
+// the snapshot is taken now, the image is built and written on the save thread. the file is
+//  replaced by a rename, so a reader never sees half of it
+void save_world_async(const std::filesystem::path& path);
+
+// runs fn on the save thread, after every task submitted before it
+void submit_save_task(std::function<void()>&& fn);
+// a task is queued or running
+bool is_saving();
+// waits for every task submitted so far
+void finish_saves();
+// the world is left untouched when the file can't be used
+bool load_world(const std::filesystem::path& path);
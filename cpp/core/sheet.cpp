@@ -0,0 +1,140 @@
+#include "sheet.h"
+
+static std::wstring decode_xml_text(std::string_view str)
+{
+	std::wstring ret;
+	ret.reserve(str.size());
+	for (auto i = 0; i < str.size(); )
+	{
+		uint ch = (uint8_t)str[i];
+		if (ch == '&')
+		{
+			auto end = str.find(';', i);
+			if (end != std::string_view::npos)
+			{
+				auto entity = str.substr(i + 1, end - i - 1);
+				auto code = 0U;
+				if (entity == "amp") code = '&';
+				else if (entity == "lt") code = '<';
+				else if (entity == "gt") code = '>';
+				else if (entity == "quot") code = '"';
+				else if (entity == "apos") code = '\'';
+				else if (entity.size() > 1 && entity[0] == '#')
+				{
+					if (entity[1] == 'x')
+						code = strtoul(std::string(entity.substr(2)).c_str(), nullptr, 16);
+					else
+						code = strtoul(std::string(entity.substr(1)).c_str(), nullptr, 10);
+				}
+				if (code != 0)
+				{
+					ret += (wchar_t)code;
+					i = end + 1;
+					continue;
+				}
+			}
+		}
+
+		// utf-8
+		auto len = 1;
+		if (ch >= 0xf0) { ch &= 0x07; len = 4; }
+		else if (ch >= 0xe0) { ch &= 0x0f; len = 3; }
+		else if (ch >= 0xc0) { ch &= 0x1f; len = 2; }
+		for (auto j = 1; j < len && i + j < str.size(); j++)
+			ch = (ch << 6) | ((uint8_t)str[i + j] & 0x3f);
+		ret += (wchar_t)ch;
+		i += len;
+	}
+	return ret;
+}
+
+bool DataSheet::load(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.good())
+		return false;
+	std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::string_view text = content;
+
+	columns.clear();
+	rows.clear();
+
+	// calls fn(name, value) for each attribute of the element starting at pos, returns the end of the element
+	auto read_attributes = [&](size_t pos, auto&& fn) {
+		while (pos < text.size())
+		{
+			while (pos < text.size() && isspace((uint8_t)text[pos]))
+				pos++;
+			if (pos >= text.size() || text[pos] == '/' || text[pos] == '>')
+				break;
+			auto eq = text.find('=', pos);
+			if (eq == std::string_view::npos)
+				break;
+			auto name = text.substr(pos, eq - pos);
+			while (!name.empty() && isspace((uint8_t)name.back()))
+				name.remove_suffix(1);
+			auto quote_begin = text.find_first_of("\"'", eq);
+			if (quote_begin == std::string_view::npos)
+				break;
+			auto quote_end = text.find(text[quote_begin], quote_begin + 1);
+			if (quote_end == std::string_view::npos)
+				break;
+			fn(name, text.substr(quote_begin + 1, quote_end - quote_begin - 1));
+			pos = quote_end + 1;
+		}
+		return text.find('>', pos);
+	};
+
+	for (auto pos = text.find("<column "); pos != std::string_view::npos; pos = text.find("<column ", pos))
+	{
+		pos = read_attributes(pos + 8, [&](std::string_view name, std::string_view value) {
+			if (name == "name")
+				columns.emplace_back(value);
+		});
+	}
+	for (auto pos = text.find("<row "); pos != std::string_view::npos; pos = text.find("<row ", pos))
+	{
+		auto& row = rows.emplace_back();
+		row.resize(columns.size());
+		pos = read_attributes(pos + 5, [&](std::string_view name, std::string_view value) {
+			if (auto idx = find_column(name); idx != -1)
+				row[idx] = decode_xml_text(value);
+		});
+	}
+	return true;
+}
+
+int DataSheet::find_column(std::string_view name) const
+{
+	for (auto i = 0; i < columns.size(); i++)
+	{
+		if (columns[i] == name)
+			return i;
+	}
+	return -1;
+}
+
+std::wstring_view DataSheet::get_as_wstr(uint row, std::string_view name) const
+{
+	if (auto idx = find_column(name); idx != -1)
+		return rows[row][idx];
+	return {};
+}
+
+std::vector<std::wstring_view> split_string(std::wstring_view str, wchar_t delimiter)
+{
+	std::vector<std::wstring_view> ret;
+	while (!str.empty())
+	{
+		auto pos = str.find(delimiter);
+		if (pos == std::wstring_view::npos)
+		{
+			ret.push_back(str);
+			break;
+		}
+		if (pos > 0)
+			ret.push_back(str.substr(0, pos));
+		str.remove_prefix(pos + 1);
+	}
+	return ret;
+}
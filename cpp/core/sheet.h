@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+// reads the rows of a .sht sheet without the flame foundation, cells are kept as text
+struct DataSheet
+{
+	std::vector<std::string> columns;
+	std::vector<std::vector<std::wstring>> rows;
+
+	bool load(const std::filesystem::path& path);
+	int find_column(std::string_view name) const;
+	std::wstring_view get_as_wstr(uint row, std::string_view name) const;
+
+	template <class T>
+	T get_as(uint row, std::string_view name) const
+	{
+		auto str = get_as_wstr(row, name);
+		if (str.empty())
+			return T(0);
+		if constexpr (std::is_floating_point_v<T>)
+			return (T)wcstod(std::wstring(str).c_str(), nullptr);
+		else
+			return (T)wcstoll(std::wstring(str).c_str(), nullptr, 10);
+	}
+};
+
+std::vector<std::wstring_view> split_string(std::wstring_view str, wchar_t delimiter);
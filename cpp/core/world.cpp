@@ -0,0 +1,1471 @@
+#include "world.h"
+#include "autosave.h"
+#include "datapack.h"
+#include "jobs.h"
+
+#include <unordered_set>
+
+const wchar_t* get_building_name(BuildingType type)
+{
+	switch (type)
+	{
+	case BuildingTownCenter: return L"Town Center";
+	case BuildingHouse: return L"House";
+	//case BuildingBarracks: return L"Barracks";
+	case BuildingPark: return L"Park";
+	case BuildingTrainingMachine: return L"Training Machine";
+	case BuildingTower: return L"Tower";
+	case BuildingWall: return L"Wall";
+	}
+	return L"";
+}
+
+const wchar_t* get_building_description(BuildingType type)
+{
+	switch (type)
+	{
+	case BuildingTownCenter: return L"";
+	case BuildingHouse: return L"Increase Gold Production";
+	//case BuildingBarracks: return L"";
+	case BuildingPark: return L"Captures Pokemons Every Turn";
+	case BuildingTrainingMachine: return L"Training Pokemons\nEach Machine will train one \npokemon in the city with the \norder of from highest to lowest \nlevel of the machines";
+	case BuildingTower: return L"";
+	case BuildingWall: return L"";
+	}
+	return L"";
+}
+
+BuildingType get_building_type_from_name(std::wstring_view name)
+{
+	static const auto names = make_enum_names(BuildingTypeCount, [](uint i) {
+		return get_building_name((BuildingType)i);
+	});
+	if (auto id = names.find(name); id != -1)
+		return (BuildingType)id;
+	return BuildingTypeCount;
+}
+
+bool is_building_unique(BuildingType type)
+{
+	switch (type)
+	{
+	case BuildingTownCenter: return true;
+	case BuildingHouse: return false;
+	//case BuildingBarracks: return true;
+	case BuildingPark: return true;
+	case BuildingTrainingMachine: return false;
+	case BuildingTower: return true;
+	case BuildingWall: return true;
+	}
+	return false;
+}
+
+uint tile_cx = 12;
+
+uint tile_cy = 4;
+
+TileMap tiles;
+
+void init_tiles()
+{
+	tiles.resize(tile_cx, tile_cy);
+	invalidate_paths();
+}
+
+float get_tile_distance(uint id1, uint id2)
+{
+	const auto sqrt3 = 1.732050807569f;
+	auto x1 = get_tile_x(id1), y1 = get_tile_y(id1);
+	auto x2 = get_tile_x(id2), y2 = get_tile_y(id2);
+	auto ax = x1 * 0.75f; auto ay = y1 * sqrt3 * 0.5f + (x1 % 2) * sqrt3 * 0.25f;
+	auto bx = x2 * 0.75f; auto by = y2 * sqrt3 * 0.5f + (x2 % 2) * sqrt3 * 0.25f;
+	return sqrtf((ax - bx) * (ax - bx) + (ay - by) * (ay - by));
+}
+
+uint get_tile_hex_distance(uint id1, uint id2)
+{
+	// odd columns are shifted down, convert to axial coordinates first
+	int x1 = get_tile_x(id1), y1 = get_tile_y(id1);
+	int x2 = get_tile_x(id2), y2 = get_tile_y(id2);
+	auto q1 = x1; auto r1 = y1 - (x1 - (x1 & 1)) / 2;
+	auto q2 = x2; auto r2 = y2 - (x2 - (x2 & 1)) / 2;
+	auto dq = q1 - q2;
+	auto dr = r1 - r2;
+	return (abs(dq) + abs(dr) + abs(dq + dr)) / 2;
+}
+
+// tiles.size() fits in uint16, larger maps only use a*
+const uint MAX_PATH_TABLE_TILES = 0xfffe;
+const uint16_t PATH_UNREACHABLE = 0xffff;
+
+// distance rows, one per destination, built on the first query to that destination.
+// row[id] is the number of steps from id to the destination, the next hop from id is
+//  the first neighbor whose value is one less, this relies on the tile links being symmetric.
+// the rows together stay within PATH_ROWS_BUDGET, the least recently used one goes first. a
+//  row is shared, so a query that still walks an evicted row keeps it alive
+const size_t PATH_ROWS_BUDGET = 64 << 20;
+
+struct PathRow
+{
+	std::shared_ptr<const uint16_t[]> dist;
+	uint64_t last_use = 0;
+};
+std::vector<PathRow> path_rows;	// by destination
+std::vector<uint> path_row_ids;	// the destinations that have a row
+uint path_rows_cap = 0;
+uint64_t path_rows_tick = 0;
+uint path_rows_generation = 0;
+std::mutex path_rows_mtx;
+
+struct PathScratch
+{
+	std::vector<uint> g;
+	std::vector<int> parent;
+	std::vector<uint> stamps;
+	uint stamp = 0;
+	std::vector<std::tuple<uint, uint, uint>> open;	// (f, h, tile id), kept as a min heap, ties go to the node closer to the end
+
+	void prepare()
+	{
+		if (stamps.size() != tiles.size())
+		{
+			g.assign(tiles.size(), 0);
+			parent.assign(tiles.size(), -1);
+			stamps.assign(tiles.size(), 0);
+			stamp = 0;
+		}
+		if (++stamp == 0)
+		{
+			std::fill(stamps.begin(), stamps.end(), 0);
+			stamp = 1;
+		}
+		open.clear();
+	}
+};
+thread_local PathScratch path_scratch;
+
+void invalidate_paths()
+{
+	std::lock_guard lock(path_rows_mtx);
+	path_rows.clear();
+	path_row_ids.clear();
+	path_rows_generation++;
+	if (tiles.size() <= MAX_PATH_TABLE_TILES)
+	{
+		path_rows.resize(tiles.size());
+		path_rows_cap = std::max<size_t>(1, PATH_ROWS_BUDGET / (std::max<size_t>(1, tiles.size()) * sizeof(uint16_t)));
+	}
+}
+
+std::shared_ptr<const uint16_t[]> get_path_row(uint end_id)
+{
+	uint generation;
+	{
+		std::lock_guard lock(path_rows_mtx);
+		if (path_rows.size() != tiles.size())
+			return nullptr;
+		auto& row = path_rows[end_id];
+		if (row.dist)
+		{
+			row.last_use = ++path_rows_tick;
+			return row.dist;
+		}
+		generation = path_rows_generation;
+	}
+
+	// breadth first from the destination, all steps cost the same. built without the lock, two
+	//  threads may build the same row and the later one takes the row of the first
+	std::shared_ptr<uint16_t[]> dist(new uint16_t[tiles.size()]);
+	std::fill_n(dist.get(), tiles.size(), PATH_UNREACHABLE);
+	// every tile is queued at most once
+	auto& arena = job_system.scratch();
+	auto mark = arena.mark();
+	auto queue = arena.alloc_array<uint>(tiles.size());
+	auto queue_end = 0U;
+	queue[queue_end++] = end_id;
+	dist[end_id] = 0;
+	for (auto i = 0; i < queue_end; i++)
+	{
+		auto id = queue[i];
+		for (auto dir = 0; dir < 6; dir++)
+		{
+			auto nid = get_tile_neighbor(id, dir);
+			if (nid != -1 && dist[nid] == PATH_UNREACHABLE)
+			{
+				dist[nid] = dist[id] + 1;
+				queue[queue_end++] = nid;
+			}
+		}
+	}
+	arena.restore(mark);
+
+	std::lock_guard lock(path_rows_mtx);
+	// the links changed meanwhile, the row is only good for this query
+	if (generation != path_rows_generation)
+		return dist;
+	auto& row = path_rows[end_id];
+	if (!row.dist)
+	{
+		if (path_row_ids.size() >= path_rows_cap)
+		{
+			auto oldest = 0;
+			for (auto i = 1; i < path_row_ids.size(); i++)
+			{
+				if (path_rows[path_row_ids[i]].last_use < path_rows[path_row_ids[oldest]].last_use)
+					oldest = i;
+			}
+			path_rows[path_row_ids[oldest]].dist.reset();
+			path_row_ids[oldest] = path_row_ids.back();
+			path_row_ids.pop_back();
+		}
+		row.dist = std::move(dist);
+		path_row_ids.push_back(end_id);
+	}
+	row.last_use = ++path_rows_tick;
+	return row.dist;
+}
+
+std::vector<uint> find_path_astar(uint start_id, uint end_id)
+{
+	auto& s = path_scratch;
+	s.prepare();
+	auto cmp = [](const std::tuple<uint, uint, uint>& a, const std::tuple<uint, uint, uint>& b) {
+		return a > b;
+	};
+
+	s.stamps[start_id] = s.stamp;
+	s.g[start_id] = 0;
+	s.parent[start_id] = -1;
+	auto h0 = get_tile_hex_distance(start_id, end_id);
+	s.open.emplace_back(h0, h0, start_id);
+	while (!s.open.empty())
+	{
+		std::pop_heap(s.open.begin(), s.open.end(), cmp);
+		auto [f, h, id] = s.open.back();
+		s.open.pop_back();
+		if (f > s.g[id] + h)
+			continue; // stale entry
+
+		if (id == end_id)
+		{
+			std::vector<uint> ret;
+			for (auto i = (int)end_id; i != -1; i = s.parent[i])
+				ret.push_back(i);
+			std::reverse(ret.begin(), ret.end());
+			return ret;
+		}
+
+		for (auto dir = 0; dir < 6; dir++)
+		{
+			auto nid = get_tile_neighbor(id, dir);
+			if (nid == -1)
+				continue;
+			auto g = s.g[id] + 1;
+			if (s.stamps[nid] != s.stamp || g < s.g[nid])
+			{
+				s.stamps[nid] = s.stamp;
+				s.g[nid] = g;
+				s.parent[nid] = id;
+				auto h = get_tile_hex_distance(nid, end_id);
+				s.open.emplace_back(g + h, h, nid);
+				std::push_heap(s.open.begin(), s.open.end(), cmp);
+			}
+		}
+	}
+	return {};
+}
+
+std::vector<uint> find_path(uint start_id, uint end_id)
+{
+	if (start_id == end_id)
+		return { start_id };
+	if (auto row = get_path_row(end_id); row)
+	{
+		if (row[start_id] == PATH_UNREACHABLE)
+			return {};
+		std::vector<uint> ret;
+		ret.reserve(row[start_id] + 1);
+		auto id = start_id;
+		ret.push_back(id);
+		while (id != end_id)
+		{
+			auto next = -1;
+			for (auto dir = 0; dir < 6; dir++)
+			{
+				auto nid = get_tile_neighbor(id, dir);
+				if (nid != -1 && row[nid] + 1 == row[id])
+				{
+					next = nid;
+					break;
+				}
+			}
+			if (next == -1)
+				return {};
+			id = next;
+			ret.push_back(id);
+		}
+		return ret;
+	}
+	return find_path_astar(start_id, end_id);
+}
+
+int get_path_distance(uint start_id, uint end_id)
+{
+	if (auto row = get_path_row(end_id); row)
+		return row[start_id] == PATH_UNREACHABLE ? -1 : row[start_id];
+	return (int)find_path_astar(start_id, end_id).size() - 1;
+}
+
+std::vector<TownCenterData> town_center_datas;
+
+std::vector<HouseData> house_datas;
+
+std::vector<BarracksData> barracks_datas;
+
+std::vector<ParkData> park_datas;
+
+std::vector<TrainingMachineData> training_machine_datas;
+
+std::vector<TowerData> tower_datas;
+
+std::vector<WallData> wall_datas;
+
+BuildingBaseData* get_building_base_data(BuildingType type, uint lv)
+{
+	BuildingBaseData* ret = nullptr;
+	switch (type)
+	{
+	case BuildingTownCenter: 
+		if (town_center_datas.size() > lv)
+			ret = &town_center_datas[lv];
+		break;
+	case BuildingHouse:
+		if (house_datas.size() > lv)
+			ret = &house_datas[lv];
+		break;
+	//case BuildingBarracks:
+	//	if (barracks_datas.size() > lv)
+	//		ret = &barracks_datas[lv];
+	//	break;
+	case BuildingPark:
+		if (park_datas.size() > lv)
+			ret = &park_datas[lv];
+		break;
+	case BuildingTrainingMachine:
+		if (training_machine_datas.size() > lv)
+			ret = &training_machine_datas[lv];
+		break;
+	case BuildingTower:
+		if (tower_datas.size() > lv)
+			ret = &tower_datas[lv];
+		break;
+	case BuildingWall:
+		if (wall_datas.size() > lv)
+			ret = &wall_datas[lv];
+		break;
+	}
+	return ret;
+}
+
+std::vector<BuildingSlot> building_slots;
+
+std::vector<NeutralCamp> neutral_camps;
+bool neutral_camps_dirty = true;
+
+bool add_neutral_camp(uint tile_id, const std::vector<NeutralUnit>& units, ChestType chest_type, uint chest_value)
+{
+	auto& tile = tiles[tile_id];
+	if (tile.type != TileField)
+		return false;
+
+	NeutralCamp camp;
+	camp.tile_id = tile_id;
+	camp.units.resize(units.size());
+	for (auto i = 0; i < units.size(); i++)
+	{
+		auto& unit = units[i];
+		camp.units[i].init(unit.id, unit.lv, unit.skills);
+		camp.defeat_gain_exp += calc_gain_exp(unit.lv);
+	}
+	camp.chest.type = chest_type;
+	camp.chest.value = chest_value;
+
+	tile.type = TileNeutralCamp;
+	tile.idx1 = neutral_camps.size();
+
+	neutral_camps.push_back(camp);
+	neutral_camps_dirty = true;
+	return true;
+}
+
+std::vector<ResourceFieldData> resource_field_datas[ResourceTypeCount];
+
+const wchar_t* get_resource_field_name(ResourceType type)
+{
+	switch (type)
+	{
+	case ResourceWood: return L"Woodcutter";
+	case ResourceClay: return L"Clay Pit";
+	case ResourceIron: return L"Iron Mine";
+	case ResourceCrop: return L"Crop Field";
+	}
+	return L"";
+}
+
+std::vector<Lord> lords;
+
+uint main_player_id = 0;
+
+int add_lord(uint tile_id)
+{
+	Lord lord;
+	lord.id = lords.size();
+
+	//lord.resources[ResourceWood] = 800;
+	//lord.resources[ResourceClay] = 800;
+	//lord.resources[ResourceIron] = 800;
+	//lord.resources[ResourceCrop] = 800;
+	lord.resources[ResourceGold] = 300;
+	//lord.provide_population = 10;
+	lord.consume_population = 0;
+
+	lord.build_city(tile_id);
+
+	auto id = lords.size();
+	lords.push_back(lord);
+	return id;
+}
+
+// tries random tiles first, on big maps that finds a spot without scanning the whole map,
+//  the full scan only runs when the map is nearly full
+template <class F>
+int search_tile(Rng& rng, F&& is_ok)
+{
+	for (auto n = 0; n < 32; n++)
+	{
+		auto i = (uint)rng.range(0, (int)tiles.size() - 1);
+		if (is_ok(i))
+			return i;
+	}
+	std::vector<uint> candidates;
+	for (auto i = 0; i < tiles.size(); i++)
+	{
+		if (is_ok(i))
+			candidates.push_back(i);
+	}
+	if (candidates.empty())
+		return -1;
+	auto idx = rng.range(0, (int)candidates.size() - 1);
+	return candidates[idx];
+}
+
+int search_lord_location(Rng& rng)
+{
+	return search_tile(rng, [](uint i) {
+		if (tiles[i].type != TileField)
+			return false;
+		auto x = get_tile_x(i), y = get_tile_y(i);
+		if (x == 0 || y == 0 || x >= tile_cx - 1 || y >= tile_cy - 1)
+			return false;
+		for (auto& lord : lords)
+		{
+			for (auto& city : lord.cities)
+			{
+				if (get_tile_distance(city.tile_id, i) < 4.5f)
+					return false;
+			}
+		}
+		return true;
+	});
+}
+
+int search_neutral_camp_location(Rng& rng)
+{
+	return search_tile(rng, [](uint i) {
+		return tiles[i].type == TileField;
+	});
+}
+
+City* search_random_hostile_city(uint lord_id, Rng& rng)
+{
+	if (lords.size() < 2)
+		return nullptr;
+
+	std::vector<uint> candidates;
+	for (auto i = 0; i < lords.size(); i++)
+	{
+		if (i != lord_id)
+			candidates.push_back(i);
+	}
+	auto& target_lord = lords[candidates[rng.range(0, (int)candidates.size() - 1)]];
+	if (target_lord.cities.empty())
+		return nullptr;
+	return &target_lord.cities[rng.range(0, (int)target_lord.cities.size() - 1)];
+}
+
+bool main_player_ai = false;
+uint exp_multiplier = 1;
+uint city_damage_multiplier = 1;
+uint night_battle_idx = 0;
+bool game_over = false;
+bool victory = false;
+
+bool load_world_datas(const std::filesystem::path& assets_path)
+{
+	if (load_data_pack(assets_path))
+		return true;
+	return load_world_sheets(assets_path);
+}
+
+bool load_world_sheets(const std::filesystem::path& assets_path)
+{
+	if (!load_skill_datas(assets_path / L"skill.sht"))
+		return false;
+	if (!load_unit_datas(assets_path / L"pokemon.sht"))
+		return false;
+
+	DataSheet sht;
+	if (sht.load(assets_path / L"building_slots.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			BuildingSlot slot;
+			auto sp = split_string(sht.get_as_wstr(i, "pos"), ',');
+			if (sp.size() == 2)
+			{
+				slot.pos_x = wcstof(std::wstring(sp[0]).c_str(), nullptr);
+				slot.pos_y = wcstof(std::wstring(sp[1]).c_str(), nullptr);
+			}
+			slot.radius = sht.get_as<float>(i, "radius");
+			slot.type = get_building_type_from_name(sht.get_as_wstr(i, "building"));
+			building_slots.push_back(slot);
+		}
+	}
+	building_slots.push_back({ .type = BuildingTower });
+	building_slots.push_back({ .type = BuildingWall });
+	if (sht.load(assets_path / L"town_center.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			TownCenterData data;
+			data.read(sht, i);
+			town_center_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"house.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			HouseData data;
+			data.read(sht, i);
+			data.gold_production = sht.get_as<uint>(i, "gold_production");
+			data.provide_population = sht.get_as<uint>(i, "provide_population");
+			house_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"barracks.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			BarracksData data;
+			data.read(sht, i);
+			barracks_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"park.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			ParkData data;
+			data.read(sht, i);
+			for (auto t : split_string(sht.get_as_wstr(i, "encounter_list"), ','))
+			{
+				auto sp = split_string(t, ':');
+				if (sp.size() == 2)
+				{
+					auto id = find_unit(sp[0]);
+					auto weight = (uint)wcstoul(std::wstring(sp[1]).c_str(), nullptr, 10);
+					if (id != -1)
+						data.encounter_list.emplace_back(id, weight);
+				}
+			}
+			data.capture_num = sht.get_as<uint>(i, "capture_num");
+			park_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"training_machine.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			TrainingMachineData data;
+			data.read(sht, i);
+			data.exp = sht.get_as<uint>(i, "exp");
+			training_machine_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"tower.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			TowerData data;
+			data.read(sht, i);
+			tower_datas.push_back(data);
+		}
+	}
+	if (sht.load(assets_path / L"wall.sht"))
+	{
+		for (auto i = 0; i < sht.rows.size(); i++)
+		{
+			WallData data;
+			data.read(sht, i);
+			wall_datas.push_back(data);
+		}
+	}
+	const std::pair<ResourceType, const wchar_t*> resource_sheets[] = {
+		{ ResourceWood, L"woodcutter.sht" },
+		{ ResourceClay, L"clay_pit.sht" },
+		{ ResourceIron, L"iron_mine.sht" },
+		{ ResourceCrop, L"crop_field.sht" }
+	};
+	for (auto [type, name] : resource_sheets)
+	{
+		if (sht.load(assets_path / name))
+		{
+			for (auto i = 0; i < sht.rows.size(); i++)
+			{
+				ResourceFieldData data;
+				data.read(sht, i);
+				resource_field_datas[type].push_back(data);
+			}
+		}
+	}
+	return true;
+}
+
+void clear_world()
+{
+	lords.clear();
+	neutral_camps.clear();
+	neutral_camps_dirty = true;
+	restart_autosave();
+	for (auto& tile : tiles)
+	{
+		tile.type = TileField;
+		tile.idx1 = tile.idx2 = -1;
+	}
+	invalidate_troop_index();
+	game_over = false;
+	victory = false;
+}
+
+void generate_world(uint lord_count, uint camp_count)
+{
+	init_tiles();
+	clear_world();
+
+	auto world_gen_rng = get_rng(RngWorldGen);
+	for (auto i = 0; i < lord_count; i++)
+	{
+		if (auto tile_id = search_lord_location(world_gen_rng); tile_id != -1)
+			add_lord(tile_id);
+	}
+
+	for (auto i = 0; i < camp_count; i++)
+	{
+		if (auto tile_id = search_neutral_camp_location(world_gen_rng); tile_id != -1)
+		{
+			auto n = (uint)world_gen_rng.range(2, 5);
+			std::vector<NeutralUnit> units;
+			units.resize(n);
+			for (auto i = 0; i < n; i++)
+			{
+				auto& unit = units[i];
+				std::vector<uint> cands;
+				for (auto id = 9; id < 20; id++)
+				{
+					if (unit_datas[id].evolution_lv != 0 &&
+						unit_datas[id - 1].evolution_lv == 0)
+						cands.push_back(id);
+				}
+				unit.id = cands[world_gen_rng.range(0, (int)cands.size() - 1)];
+				unit.lv = world_gen_rng.range(5, 10);
+				unit.learn_skills();
+			}
+			auto chest_type = world_gen_rng.range(0, 100) < 50 ? ChestGold : ChestProduction;
+			auto chest_value = chest_type == ChestGold ? n * 50 + world_gen_rng.range(0, 100) : 1;
+			add_neutral_camp(tile_id, units, chest_type, chest_value);
+		}
+	}
+}
+
+// production, captures and training in the cities of the lord
+void produce_lord_day(Lord& lord)
+{
+	for (auto& city : lord.cities)
+	{
+		city.production += 1;
+		city.dirty = true;
+
+		std::vector<uint> training_exps;
+
+		for (auto& building : city.buildings)
+		{
+			switch (building.type)
+			{
+			case BuildingHouse:
+			{
+				if (building.lv > 0)
+				{
+					auto& house_data = house_datas[building.lv - 1];
+					lord.resources[ResourceGold] += house_data.gold_production;
+					lord.dirty = true;
+				}
+			}
+				break;
+			case BuildingPark:
+			{
+				if (building.lv > 0)
+				{
+					auto& park_data = park_datas[building.lv - 1];
+					// a level without encounters in the sheet captures nothing
+					if (park_data.encounter_list.empty())
+						break;
+					auto rng = get_rng(RngPark, city.tile_id);
+					for (auto i = 0; i < park_data.capture_num; i++)
+						city.add_capture(rng.weighted(park_data.encounter_list), 5, 100);
+				}
+			}
+				break;
+			case BuildingTrainingMachine:
+			{
+				if (building.lv > 0)
+				{
+					auto& machine_data = training_machine_datas[building.lv - 1];
+					training_exps.push_back(machine_data.exp);
+				}
+			}
+				break;
+			}
+		}
+
+		std::sort(training_exps.begin(), training_exps.end(), [](const auto& a, const auto& b) {
+			return a > b;
+		});
+
+		auto& city_units = city.troops.front().units;
+		auto n = std::min((int)training_exps.size(), (int)city_units.size());
+		for (auto i = 0; i < n; i++)
+		{
+			auto& unit = city.units[city_units[i]];
+			unit.gain_exp += training_exps[i];
+		}
+	}
+}
+
+// a computer lord builds, buys units and sends a troop to a random hostile city
+void run_lord_ai(Lord& lord)
+{
+	auto rng = get_rng(RngLordAI, lord.id);
+
+	for (auto& city : lord.cities)
+	{
+		while (true)
+		{
+			std::vector<std::pair<uint, uint>> cands;
+			auto get_weight = [&](BuildingType type) {
+				auto ret = 1;
+				switch (type)
+				{
+				case BuildingHouse:
+					if (lord.resources[ResourceGold] < 100)
+						ret = 100;
+					break;
+				case BuildingTrainingMachine:
+					ret = 0;
+					break;
+				}
+				return ret;
+			};
+			for (auto i = 0; i < building_slots.size(); i++)
+			{
+				auto& slot = building_slots[i];
+				if (slot.type == BuildingTypeCount)
+				{
+					for (int j = BuildingInTownBegin; j <= BuildingInTownEnd; j++)
+					{
+						if (j == BuildingTownCenter)
+							continue;
+						if (auto base_data = get_building_base_data((BuildingType)j, 0); base_data)
+						{
+							auto cost_production = base_data->cost_production;
+							if (cost_production <= city.production)
+								cands.emplace_back(i * 100 + j, get_weight((BuildingType)j));
+						}
+					}
+				}
+				else
+				{
+					auto& building = city.buildings[i];
+					if (auto base_data = get_building_base_data(building.type, building.lv); base_data)
+					{
+						auto cost_production = base_data->cost_production;
+						if (cost_production <= city.production)
+							cands.emplace_back(i * 100, get_weight(building.type));
+					}
+				}
+			}
+			if (cands.empty())
+				break;
+			auto sel = rng.weighted(cands);
+			auto i = sel / 100;
+			auto j = sel % 100;
+			auto& slot = building_slots[i];
+			if (slot.type == BuildingTypeCount)
+				lord.upgrade_building(city, i, (BuildingType)j);
+			else
+				lord.upgrade_building(city, i, slot.type);
+		}
+
+		while (true)
+		{
+			std::vector<uint> cands;
+			for (auto i = 0; i < city.captures.size(); i++)
+			{
+				if (city.captures[i].cost_gold <= lord.resources[ResourceGold])
+					cands.push_back(i);
+			}
+			if (cands.empty())
+				break;
+			auto i = cands[rng.range(0, (int)cands.size() - 1)];
+			lord.buy_unit(city, i);
+		}
+
+		if (auto target_city = search_random_hostile_city(lord.id, rng); target_city)
+		{
+			city.troops.front().units.clear();
+			city.troops.resize(2);
+
+			auto& troop = city.troops[1];
+			troop.units.clear();
+			for (auto i = 1; i < city.units.size(); i++)
+				troop.units.push_back(i);
+			city.set_troop_target(troop, target_city->tile_id);
+		}
+	}
+}
+
+void new_day()
+{
+	current_day++;
+	invalidate_troop_index();
+
+	// a lord only changes its own cities during the day, the hostile city lookup reads the city
+	//  tiles of other lords but those only change at night. the rng streams are keyed by lord and
+	//  city, so every lord can run on its own thread and the result doesn't depend on the order
+	parallel_for(lords.size(), [](uint idx, uint) {
+		auto& lord = lords[idx];
+		lord.troop_instances.clear();
+		produce_lord_day(lord);
+		if (idx != main_player_id || main_player_ai)
+			run_lord_ai(lord);
+	}, 0, 1);
+
+	autosave();
+}
+
+void prepare_night()
+{
+	night_battle_idx = 0;
+	invalidate_troop_index();
+
+	for (auto& lord : lords)
+	{
+		for (auto& city : lord.cities)
+		{
+			city.captures.clear();
+			for (auto& unit : city.units)
+				unit.gain_exp = 0;
+			city.dirty = true;
+
+			for (auto i = 0; i < city.troops.size(); i++)
+			{
+				auto& troop = city.troops[i];
+				TroopInstance troop_ins;
+				troop_ins.lord_id = lord.id;
+				troop_ins.city_id = city.id;
+				troop_ins.id = i;
+				troop_ins.path = troop.path;
+				for (auto idx : troop.units)
+				{
+					auto& unit = city.units[idx];
+					UnitInstance unit_ins;
+					unit_ins.init(unit);
+					troop_ins.units.push_back(unit_ins);
+					troop_ins.defeat_gain_exp += calc_gain_exp(unit.lv);
+				}
+				lord.troop_instances.push_back(troop_ins);
+			}
+		}
+	}
+}
+
+void cleanup_night()
+{
+	for (auto& lord : lords)
+	{
+		auto removed = false;
+		for (auto i = 0; i < lord.cities.size(); )
+		{
+			if (lord.cities[i].loyalty == 0)
+			{
+				auto tile_id = lord.cities[i].tile_id;
+				auto& tile = tiles[tile_id];
+				tile.type = TileField;
+				tile.idx1 = tile.idx2 = -1;
+
+				// the troops of the fallen city leave the night with it
+				std::erase_if(lord.troop_instances, [&](const auto& troop) {
+					return troop.city_id == i;
+				});
+				invalidate_troop_index();
+				for (auto& troop : lord.troop_instances)
+				{
+					if (troop.city_id > i)
+						troop.city_id--;
+				}
+				lord.cities.erase(lord.cities.begin() + i);
+				lord.remove_city_territory(tile_id);
+				lord.dirty = true;
+				removed = true;
+
+				// troops that were sent to it go home, erasing them would shift the indices the troop instances refer to
+				for (auto& _lord : lords)
+				{
+					for (auto& _city : _lord.cities)
+					{
+						for (auto& troop : _city.troops)
+						{
+							if (troop.target == tile_id)
+								_city.set_troop_target(troop, _city.tile_id);
+						}
+					}
+				}
+			}
+			else
+				i++;
+		}
+		if (removed)
+		{
+			for (auto i = 0; i < lord.cities.size(); i++)
+			{
+				lord.cities[i].id = i;
+				tiles[lord.cities[i].tile_id].idx2 = i;
+			}
+		}
+	}
+
+	auto removed = false;
+	for (auto it = neutral_camps.begin(); it != neutral_camps.end();)
+	{
+		if (it->units.empty())
+		{
+			auto& tile = tiles[it->tile_id];
+			tile.type = TileField;
+			tile.idx1 = tile.idx2 = -1;
+			it = neutral_camps.erase(it);
+			neutral_camps_dirty = true;
+			removed = true;
+		}
+		else
+			it++;
+	}
+	if (removed)
+	{
+		for (auto i = 0; i < neutral_camps.size(); i++)
+			tiles[neutral_camps[i].tile_id].idx1 = i;
+	}
+}
+
+void end_night()
+{
+	if (lords[main_player_id].cities.empty())
+	{
+		game_over = true;
+		victory = false;
+	}
+	else
+	{
+		auto no_opponents = true;
+		for (auto i = 0; i < lords.size(); i++)
+		{
+			if (i != main_player_id)
+			{
+				if (!lords[i].cities.empty())
+					no_opponents = false;
+				break;
+			}
+		}
+		if (no_opponents)
+		{
+			game_over = true;
+			victory = true;
+		}
+	}
+}
+
+// tile -> troops index for encounter detection. every troop instance has an entry, linked into
+//  the list of the tile it stands on. moving a troop relinks its entry, erasing troop instances
+//  shifts their indices so the index is rebuilt after that
+struct TroopEntry
+{
+	uint lord_id;
+	uint idx;
+	uint tile_id;
+	int next;
+};
+std::vector<TroopEntry> troop_entries;
+std::vector<uint> lord_entry_bases;
+std::vector<int> tile_troops;		// first entry on each tile, -1 if none
+std::vector<uint> contested_tiles;	// tiles that got troops of different lords, may be stale
+std::vector<uint> arrived_entries;	// troops that reached a hostile city or a camp, may be stale
+bool troop_index_dirty = true;
+
+void invalidate_troop_index()
+{
+	troop_index_dirty = true;
+}
+
+TroopInstance& get_troop(const TroopEntry& entry)
+{
+	return lords[entry.lord_id].troop_instances[entry.idx];
+}
+
+bool is_arrived(const TroopInstance& troop)
+{
+	if (troop.path_idx != troop.path.size() - 1)
+		return false;
+	auto& tile = tiles[troop.path.back()];
+	return (tile.type == TileCity && tile.idx1 != troop.lord_id) || tile.type == TileNeutralCamp;
+}
+
+void link_troop_entry(uint entry_idx)
+{
+	auto& entry = troop_entries[entry_idx];
+	auto& troop = get_troop(entry);
+	entry.tile_id = troop.path[troop.path_idx];
+	for (auto i = tile_troops[entry.tile_id]; i != -1; i = troop_entries[i].next)
+	{
+		if (troop_entries[i].lord_id != entry.lord_id)
+		{
+			contested_tiles.push_back(entry.tile_id);
+			break;
+		}
+	}
+	entry.next = tile_troops[entry.tile_id];
+	tile_troops[entry.tile_id] = entry_idx;
+	if (is_arrived(troop))
+		arrived_entries.push_back(entry_idx);
+}
+
+void unlink_troop_entry(uint entry_idx)
+{
+	auto& entry = troop_entries[entry_idx];
+	for (auto* p = &tile_troops[entry.tile_id]; *p != -1; p = &troop_entries[*p].next)
+	{
+		if (*p == entry_idx)
+		{
+			*p = entry.next;
+			break;
+		}
+	}
+}
+
+void rebuild_troop_index()
+{
+	if (tile_troops.size() != tiles.size())
+		tile_troops.assign(tiles.size(), -1);
+	else
+	{
+		for (auto& entry : troop_entries)
+			tile_troops[entry.tile_id] = -1;
+	}
+	troop_entries.clear();
+	lord_entry_bases.clear();
+	contested_tiles.clear();
+	arrived_entries.clear();
+	for (auto& lord : lords)
+	{
+		lord_entry_bases.push_back(troop_entries.size());
+		for (auto i = 0; i < lord.troop_instances.size(); i++)
+		{
+			troop_entries.push_back({ lord.id, (uint)i, 0, -1 });
+			link_troop_entry(troop_entries.size() - 1);
+		}
+	}
+	troop_index_dirty = false;
+}
+
+// the first two troops of different lords on the tile that are not taken yet
+bool find_tile_pair(uint tile_id, const std::unordered_set<const void*>& taken, Encounter& encounter, bool& any_pair)
+{
+	any_pair = false;
+	for (auto i = tile_troops[tile_id]; i != -1; i = troop_entries[i].next)
+	{
+		auto& troop = get_troop(troop_entries[i]);
+		if (troop.units.empty())
+			continue;
+		for (auto j = troop_entries[i].next; j != -1; j = troop_entries[j].next)
+		{
+			auto& _troop = get_troop(troop_entries[j]);
+			if (troop.lord_id != _troop.lord_id && !_troop.units.empty())
+			{
+				any_pair = true;
+				if (taken.contains(&troop) || taken.contains(&_troop))
+					continue;
+				encounter.troop0 = troop.lord_id < _troop.lord_id ? &troop : &_troop;
+				encounter.troop1 = troop.lord_id < _troop.lord_id ? &_troop : &troop;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void find_encounters(std::vector<Encounter>& encounters)
+{
+	encounters.clear();
+	if (troop_index_dirty)
+		rebuild_troop_index();
+
+	// a tile gives one battle per batch, the winner may fight the next troop there in the next batch
+	std::unordered_set<const void*> taken;
+	for (auto i = (int)contested_tiles.size() - 1; i >= 0; i--)
+	{
+		Encounter encounter;
+		auto any_pair = false;
+		if (find_tile_pair(contested_tiles[i], taken, encounter, any_pair))
+		{
+			taken.insert(encounter.troop0);
+			taken.insert(encounter.troop1);
+			encounters.push_back(encounter);
+		}
+		else if (!any_pair)
+			contested_tiles.erase(contested_tiles.begin() + i);
+	}
+
+	for (auto i = (int)arrived_entries.size() - 1; i >= 0; i--)
+	{
+		auto& troop = get_troop(troop_entries[arrived_entries[i]]);
+		if (!is_arrived(troop))
+		{
+			arrived_entries.erase(arrived_entries.begin() + i);
+			continue;
+		}
+		Encounter encounter;
+		auto& tile = tiles[troop.path.back()];
+		if (tile.type == TileCity)
+			encounter.city0 = &lords[tile.idx1].cities[tile.idx2];
+		else
+			encounter.camp0 = &neutral_camps[tile.idx1];
+		encounter.troop1 = &troop;
+		auto target = encounter.city0 ? (const void*)encounter.city0 : (const void*)encounter.camp0;
+		if (taken.contains(&troop) || taken.contains(target))
+			continue;
+		taken.insert(&troop);
+		taken.insert(target);
+		encounters.push_back(encounter);
+	}
+}
+
+// set while results of a batch are applied, removed troops are erased after the batch
+//  so that the pointers in the other encounters stay valid
+std::vector<TroopInstance*>* deferred_troop_removals = nullptr;
+
+void resolve_encounters(const std::vector<Encounter>& encounters, std::vector<BattleReplay>* replays)
+{
+	// the rng of a battle is picked by its place in the batch, not by the thread that runs it
+	std::vector<uint> battle_idxs(encounters.size());
+	for (auto i = 0; i < encounters.size(); i++)
+	{
+		if (!encounters[i].city0)
+			battle_idxs[i] = night_battle_idx++;
+	}
+	if (replays)
+	{
+		replays->clear();
+		replays->resize(encounters.size());
+	}
+
+	std::vector<int> winners(encounters.size(), -1);
+	parallel_for(encounters.size(), [&](uint idx, uint) {
+		auto& encounter = encounters[idx];
+		if (encounter.city0)
+			return;
+		BattleReplay replay;
+		auto p_replay = replays ? &(*replays)[idx] : &replay;
+		BattleSim sim;
+		sim.setup(encounter.troop0 ? encounter.troop0->units : encounter.camp0->units, encounter.troop1->units,
+			get_rng(RngBattle, battle_idxs[idx]), replays || record_replays ? p_replay : nullptr);
+		winners[idx] = sim.run();
+		if (record_replays)
+			p_replay->save(get_replay_path(*p_replay));
+	}, 0, 1);
+
+	std::vector<TroopInstance*> removals;
+	deferred_troop_removals = &removals;
+	for (auto i = 0; i < encounters.size(); i++)
+	{
+		auto& encounter = encounters[i];
+		if (encounter.city0)
+			resolve_siege(*encounter.troop1, *encounter.city0);
+		else
+			end_battle(encounter.troop0, encounter.camp0, encounter.troop1, winners[i]);
+	}
+	deferred_troop_removals = nullptr;
+
+	// erasing from the back of each list keeps the pointers to the front valid
+	std::sort(removals.begin(), removals.end(), std::greater<>());
+	for (auto troop : removals)
+		remove_troop_instance(*troop);
+}
+
+void relink_troop_entry(TroopInstance& troop)
+{
+	auto& lord = lords[troop.lord_id];
+	auto entry_idx = lord_entry_bases[lord.id] + (uint)(&troop - lord.troop_instances.data());
+	unlink_troop_entry(entry_idx);
+	link_troop_entry(entry_idx);
+}
+
+uint step_night_tick()
+{
+	if (troop_index_dirty)
+		rebuild_troop_index();
+
+	uint moved = 0;
+	for (auto& lord : lords)
+	{
+		for (auto& troop : lord.troop_instances)
+		{
+			if (troop.path_idx + 1 < troop.path.size())
+			{
+				troop.path_idx++;
+				troop.move_t = 0.f;
+				relink_troop_entry(troop);
+				moved++;
+			}
+			else
+				troop.move_t = 1.f;
+		}
+	}
+	if (moved == 0)
+		return 0;
+
+	// two troops of different lords that swapped tiles have crossed each other on the way,
+	//  the one of the higher lord stays where it was so that they meet there
+	for (auto& lord : lords)
+	{
+		for (auto& troop : lord.troop_instances)
+		{
+			if (troop.move_t != 0.f)
+				continue;
+			auto from = troop.path[troop.path_idx - 1];
+			auto to = troop.path[troop.path_idx];
+			for (auto i = tile_troops[from]; i != -1; i = troop_entries[i].next)
+			{
+				auto& _troop = get_troop(troop_entries[i]);
+				if (_troop.lord_id > troop.lord_id && _troop.move_t == 0.f && _troop.path[_troop.path_idx - 1] == to)
+				{
+					_troop.path_idx--;
+					_troop.move_t = 1.f;
+					relink_troop_entry(_troop);
+					break;
+				}
+			}
+		}
+	}
+	return moved;
+}
+
+void remove_troop_instance(TroopInstance& troop)
+{
+	if (deferred_troop_removals)
+	{
+		deferred_troop_removals->push_back(&troop);
+		return;
+	}
+	auto& lord = lords[troop.lord_id];
+	for (auto it = lord.troop_instances.begin(); it != lord.troop_instances.end(); it++)
+	{
+		if (&*it == &troop)
+		{
+			lord.troop_instances.erase(it);
+			invalidate_troop_index();
+			break;
+		}
+	}
+}
+
+void give_battle_exp(TroopInstance& winner, uint exp)
+{
+	auto& win_troop_city = lords[winner.lord_id].cities[winner.city_id];
+	auto& original_win_troop = win_troop_city.troops[winner.id];
+	exp /= original_win_troop.units.size();
+	exp *= exp_multiplier;
+	for (auto idx : original_win_troop.units)
+		win_troop_city.units[idx].gain_exp += exp;
+	win_troop_city.dirty = true;
+}
+
+void end_battle(TroopInstance* troop0, NeutralCamp* camp0, TroopInstance* troop1, int winner)
+{
+	// the battle left its damage on the units of the camp
+	if (camp0)
+		neutral_camps_dirty = true;
+	if (winner == 1 && troop1)
+		give_battle_exp(*troop1, troop0 ? troop0->defeat_gain_exp : camp0->defeat_gain_exp);
+	else if (winner == 0 && troop0)
+		give_battle_exp(*troop0, troop1->defeat_gain_exp);
+
+	if (winner == -1)
+	{
+		// a draw, the troop that is away from home gives up its march so the two don't meet again
+		if (troop1 && troop1->id != 0)
+			remove_troop_instance(*troop1);
+		else if (troop0 && troop0->id != 0)
+			remove_troop_instance(*troop0);
+		return;
+	}
+
+	for (auto troop : { troop0, troop1 })
+	{
+		if (troop && troop->id != 0 && troop->units.empty())
+			remove_troop_instance(*troop);
+	}
+}
+
+int resolve_battle(TroopInstance* troop0, NeutralCamp* camp0, TroopInstance& troop1, const Rng& rng)
+{
+	BattleReplay replay;
+	BattleSim sim;
+	sim.setup(troop0 ? troop0->units : camp0->units, troop1.units, rng, record_replays ? &replay : nullptr);
+	auto winner = sim.run();
+	if (record_replays)
+		replay.save(get_replay_path(replay));
+	end_battle(troop0, camp0, &troop1, winner);
+	return winner;
+}
+
+uint get_siege_damage(const UnitInstance& unit)
+{
+	return std::max(1U, unit.lv / 10) * city_damage_multiplier;
+}
+
+void end_siege(TroopInstance& troop, City& city, uint damage)
+{
+	{
+		// each unit that attacked the enemy city will level up
+		auto& troop_city = lords[troop.lord_id].cities[troop.city_id];
+		for (auto idx : troop_city.troops[troop.id].units)
+		{
+			auto& unit = troop_city.units[idx];
+			unit.gain_exp += calc_exp(unit.lv + 1);
+		}
+		troop_city.dirty = true;
+	}
+	remove_troop_instance(troop);
+	city.dirty = true;
+
+	if (city.loyalty > damage)
+		city.loyalty -= damage;
+	else
+		city.loyalty = 0;
+}
+
+void resolve_siege(TroopInstance& troop, City& city)
+{
+	uint damage = 0;
+	for (auto& unit : troop.units)
+		damage += get_siege_damage(unit);
+	end_siege(troop, city, damage);
+}
+
+void finish_night()
+{
+	std::vector<Encounter> encounters;
+	while (true)
+	{
+		cleanup_night();
+		find_encounters(encounters);
+		if (!encounters.empty())
+		{
+			resolve_encounters(encounters);
+			continue;
+		}
+		if (step_night_tick() == 0)
+			break;
+	}
+	end_night();
+}
+
+void run_night()
+{
+	prepare_night();
+	finish_night();
+	apply_gained_exp();
+}
+
+void apply_gained_exp()
+{
+	for (auto& lord : lords)
+	{
+		for (auto& city : lord.cities)
+		{
+			for (auto& unit : city.units)
+			{
+				if (unit.gain_exp > 0)
+					city.dirty = true;
+				auto old_lv = unit.lv;
+				unit.exp += unit.gain_exp;
+				unit.gain_exp = 0;
+				auto next_lv_exp = calc_exp(unit.lv + 1);
+
+				while (true)
+				{
+					if (unit.exp < next_lv_exp)
+						break;
+					unit.lv++;
+					next_lv_exp = calc_exp(unit.lv + 1);
+				}
+
+				if (unit.lv != old_lv)
+				{
+					city.dirty = true;
+					while (true)
+					{
+						auto& unit_data = unit_datas[unit.id];
+						if (unit_data.evolution_lv != 0 && unit.lv >= unit_data.evolution_lv)
+							unit.id = unit.id + 1;
+						else
+							break;
+					}
+
+					unit.learn_skills();
+					if (lord.id != main_player_id || main_player_ai)
+					{
+						for (auto i = 0; i < 4; i++)
+							unit.skills[i] = -1;
+						auto n = 0;
+						for (auto it = unit.learnt_skills.rbegin(); it != unit.learnt_skills.rend(); it++)
+						{
+							if (n >= 4)
+								break;
+							unit.skills[n] = *it;
+							n++;
+						}
+					}
+				}
+			}
+		}
+	}
+}
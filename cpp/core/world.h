@@ -0,0 +1,775 @@
+#pragma once
+
+#include "battle.h"
+#include "sheet.h"
+
+enum TileType
+{
+	TileField,
+	TileCity,
+	TileNeutralCamp,
+	TileResourceField,
+
+	TileTypeCount
+};
+
+enum ResourceType
+{
+	ResourceWood,
+	ResourceClay,
+	ResourceIron,
+	ResourceCrop,
+	ResourceGold,
+
+	ResourceTypeCount
+};
+
+enum BuildingType
+{
+	BuildingTownCenter,
+	BuildingHouse,
+	//BuildingBarracks,
+	BuildingPark,
+	BuildingTrainingMachine,
+	BuildingTower,
+	BuildingWall,
+
+	BuildingTypeCount,
+	BuildingInTownBegin = BuildingTownCenter,
+	BuildingInTownEnd = BuildingTrainingMachine,
+};
+
+const wchar_t* get_building_name(BuildingType type);
+
+const wchar_t* get_building_description(BuildingType type);
+
+BuildingType get_building_type_from_name(std::wstring_view name);
+
+bool is_building_unique(BuildingType type);
+
+extern uint tile_cx;	// map size, set before generate_world
+extern uint tile_cy;
+const uint MIN_MAP_SIZE = 3;
+const uint MAX_MAP_SIZE = 4096;	// per side, so the tile ids fit in the int of get_tile_neighbor
+
+// tile ids are y * tile_cx + x, the position and the neighbors are derived from the id
+struct Tile
+{
+	uint type : 4;		// TileType
+	int idx1 : 28;		// owner lord for cities and resource fields, index for camps
+	int16_t idx2;		// index of the city or resource field in its lord
+};
+
+inline uint get_tile_x(uint id) { return id % tile_cx; }
+inline uint get_tile_y(uint id) { return id / tile_cx; }
+
+// neighbor in direction lt, t, rt, lb, b, rb, or -1 at the map border
+inline int get_tile_neighbor(uint id, uint dir)
+{
+	int x = get_tile_x(id), y = get_tile_y(id);
+	auto odd = x & 1;
+	switch (dir)
+	{
+	case 0: x--; y -= 1 - odd; break;
+	case 1: y--; break;
+	case 2: x++; y -= 1 - odd; break;
+	case 3: x--; y += odd; break;
+	case 4: y++; break;
+	case 5: x++; y += odd; break;
+	}
+	if (x < 0 || y < 0 || x >= tile_cx || y >= tile_cy)
+		return -1;
+	return y * tile_cx + x;
+}
+
+// tiles are stored in 8x8 chunks so that neighbors are mostly in the same few cache lines
+struct TileMap
+{
+	static const uint ChunkShift = 3;
+	static const uint ChunkSize = 1 << ChunkShift;
+
+	std::vector<Tile> data;
+	uint chunks_x = 0;
+
+	void resize(uint cx, uint cy)
+	{
+		chunks_x = (cx + ChunkSize - 1) >> ChunkShift;
+		auto chunks_y = (cy + ChunkSize - 1) >> ChunkShift;
+		data.assign(chunks_x * chunks_y * ChunkSize * ChunkSize, { TileField, -1, -1 });
+	}
+
+	uint size() const
+	{
+		return data.empty() ? 0 : tile_cx * tile_cy;
+	}
+
+	Tile& operator[](uint id)
+	{
+		auto x = get_tile_x(id), y = get_tile_y(id);
+		auto chunk = (y >> ChunkShift) * chunks_x + (x >> ChunkShift);
+		return data[(chunk << (ChunkShift * 2)) + ((y & (ChunkSize - 1)) << ChunkShift) + (x & (ChunkSize - 1))];
+	}
+
+	// in storage order, includes the padding of the border chunks
+	auto begin() { return data.begin(); }
+	auto end() { return data.end(); }
+};
+extern TileMap tiles;
+
+// fills tiles with a tile_cx * tile_cy hex grid, odd columns are shifted down by half a tile
+void init_tiles();
+// distance between tile centers, in tile widths
+float get_tile_distance(uint id1, uint id2);
+
+// number of steps between two tiles on an open grid, used as the a* heuristic
+uint get_tile_hex_distance(uint id1, uint id2);
+// drops the cached path tables, must be called whenever the tile links change
+void invalidate_paths();
+// shortest path including both ends, empty if end_id cannot be reached
+std::vector<uint> find_path(uint start_id, uint end_id);
+// number of steps of the shortest path, -1 if end_id cannot be reached
+int get_path_distance(uint start_id, uint end_id);
+
+struct BuildingBaseData
+{
+	uint cost_wood;
+	uint cost_clay;
+	uint cost_iron;
+	uint cost_crop;
+	uint cost_gold;
+	uint cost_population;
+	uint cost_production;
+
+	void read(const DataSheet& sht, uint row)
+	{
+		cost_wood = sht.get_as<uint>(row, "cost_wood");
+		cost_clay = sht.get_as<uint>(row, "cost_clay");
+		cost_iron = sht.get_as<uint>(row, "cost_iron");
+		cost_crop = sht.get_as<uint>(row, "cost_crop");
+		cost_gold = sht.get_as<uint>(row, "cost_gold");
+		cost_population = sht.get_as<uint>(row, "cost_population");
+		cost_production = sht.get_as<uint>(row, "cost_production");
+	}
+};
+
+struct TownCenterData : BuildingBaseData
+{
+};
+extern std::vector<TownCenterData> town_center_datas;
+
+struct HouseData : BuildingBaseData
+{
+	uint gold_production;
+	uint provide_population;
+};
+extern std::vector<HouseData> house_datas;
+
+struct BarracksData : BuildingBaseData
+{
+};
+extern std::vector<BarracksData> barracks_datas;
+
+struct ParkData : BuildingBaseData
+{
+	std::vector<std::pair<uint, uint>> encounter_list;
+	uint capture_num;
+};
+extern std::vector<ParkData> park_datas;
+
+struct TrainingMachineData : BuildingBaseData
+{
+	uint exp;
+};
+extern std::vector<TrainingMachineData> training_machine_datas;
+
+struct TowerData : BuildingBaseData
+{
+};
+extern std::vector<TowerData> tower_datas;
+
+struct WallData : BuildingBaseData
+{
+};
+extern std::vector<WallData> wall_datas;
+
+BuildingBaseData* get_building_base_data(BuildingType type, uint lv);
+
+struct Building
+{
+	uint slot;
+	BuildingType type;
+	uint lv = 0;
+};
+
+struct Troop
+{
+	uint				target = 0;	// tile id
+	std::vector<uint>	units;		// indices
+	std::vector<uint>	path;
+};
+
+struct PokemonCapture
+{
+	uint unit_id;
+	uint exclusive_id;
+	uint lv;
+	uint cost_gold;
+};
+
+struct City
+{
+	uint id;
+	uint tile_id;
+	uint lord_id;
+	uint loyalty;
+	uint production;
+	std::vector<Building> buildings;
+	std::vector<PokemonCapture> captures;
+	std::vector<Unit> units;
+	std::vector<Troop> troops;
+	bool dirty = true;	// changed since the last autosave, set by whatever changes the members above
+
+	int get_building_lv(BuildingType type, int slot = -1)
+	{
+		if (slot != -1)
+			return buildings[slot].lv;
+		for (auto& building : buildings)
+		{
+			if (building.type == type)
+				return building.lv;
+		}
+		return -1;
+	}
+
+	void add_capture_ll(uint unit_id, uint exclusive_id, uint lv, uint cost_gold)
+	{
+		auto& unit_data = unit_datas[unit_id];
+		PokemonCapture capture;
+		capture.unit_id = unit_id;
+		capture.exclusive_id = exclusive_id;
+		capture.lv = lv;
+		capture.cost_gold = cost_gold;
+
+		captures.push_back(capture);
+		dirty = true;
+	}
+
+	void add_capture(uint unit_id, uint lv, uint cost_gold)
+	{
+		add_capture_ll(unit_id, 0, lv, cost_gold);
+	}
+
+	void add_exclusive_captures(const std::vector<uint>& unit_ids, uint exclusive_id, uint lv, uint cost_gold)
+	{
+		for (auto unit_id : unit_ids)
+			add_capture_ll(unit_id, exclusive_id, lv, cost_gold);
+	}
+
+	void add_unit(uint unit_id, uint lv)
+	{
+		auto& unit_data = unit_datas[unit_id];
+
+		Unit unit;
+		unit.id = unit_id;
+		unit.lv = lv;
+		unit.exp = calc_exp(lv);
+		unit.learn_skills();
+		{
+			auto n = 0;
+			for (auto it = unit.learnt_skills.rbegin(); it != unit.learnt_skills.rend(); it++)
+			{
+				if (n >= 4)
+					break;
+				unit.skills[n] = *it;
+				n++;
+			}
+		}
+
+		units.push_back(unit);
+
+		troops.front().units.push_back(units.size() - 1);
+		dirty = true;
+	}
+
+	void set_troop_target(Troop& troop, uint target)
+	{
+		troop.target = target;
+		troop.path = find_path(tile_id, target);
+		dirty = true;
+	}
+};
+
+struct TroopInstance
+{
+	uint lord_id;
+	uint city_id;
+	uint id;
+	std::vector<UnitInstance> units;
+	std::vector<uint> path;
+	uint path_idx = 0;
+	float move_t = 1.f;	// progress from the previous tile of the path, 0 right after a tick moved the troop, only used for display
+	uint defeat_gain_exp = 0;
+};
+
+struct BuildingSlot
+{
+	float pos_x = 0.f;	// layout in the city view
+	float pos_y = 0.f;
+	float radius = 0.f;
+	BuildingType type;
+};
+extern std::vector<BuildingSlot> building_slots;
+
+const uint HERO_EXCLUSIVE_ID = 1;
+
+enum ChestType
+{
+	ChestGold,
+	ChestProduction
+};
+
+struct Chest
+{
+	ChestType type;
+	uint value;
+};
+
+struct NeutralCamp
+{
+	uint tile_id;
+	std::vector<UnitInstance> units;
+	Chest chest;
+	uint defeat_gain_exp;
+};
+extern std::vector<NeutralCamp> neutral_camps;
+extern bool neutral_camps_dirty;	// a camp changed since the last autosave
+
+struct NeutralUnit
+{
+	uint id;
+	uint lv;
+	int skills[4] = { -1, -1, -1, -1 };
+
+	void learn_skills()
+	{
+		auto& unit_data = unit_datas[id];
+		auto n = 0;
+		for (auto it = unit_data.skillset.rbegin(); it != unit_data.skillset.rend(); it++)
+		{
+			if (it->first <= lv)
+			{
+				skills[n] = it->second;
+				n++;
+				if (n >= 4)
+					break;
+			}
+		}
+	}
+};
+
+bool add_neutral_camp(uint tile_id, const std::vector<NeutralUnit>& units, ChestType chest_type, uint chest_value);
+
+const wchar_t* get_resource_field_name(ResourceType type);
+
+struct ResourceField
+{
+	uint tile_id;
+	uint lv;
+	ResourceType type;
+	uint production;
+};
+
+struct ResourceFieldData
+{
+	uint cost_wood;
+	uint cost_clay;
+	uint cost_iron;
+	uint cost_crop;
+	uint cost_gold;
+	uint cost_population;
+	uint production;
+
+	void read(const DataSheet& sht, uint row)
+	{
+		cost_wood = sht.get_as<uint>(row, "cost_wood");
+		cost_clay = sht.get_as<uint>(row, "cost_clay");
+		cost_iron = sht.get_as<uint>(row, "cost_iron");
+		cost_crop = sht.get_as<uint>(row, "cost_crop");
+		cost_gold = sht.get_as<uint>(row, "cost_gold");
+		cost_population = sht.get_as<uint>(row, "cost_population");
+		production = sht.get_as<uint>(row, "production");
+	}
+};
+
+extern std::vector<ResourceFieldData> resource_field_datas[ResourceTypeCount];
+
+struct Lord
+{
+	uint id;
+
+	uint resources[ResourceTypeCount];
+	uint provide_population;
+	uint consume_population;
+
+	std::vector<City> cities;
+	std::vector<uint> territories;			// unordered
+	std::vector<uint64_t> territory_bits;	// one bit per tile, for has_territory
+	std::vector<ResourceField> resource_fields;
+
+	std::vector<TroopInstance> troop_instances;
+
+	bool dirty = true;	// the resources or the city list changed since the last autosave
+
+	// a city claims itself and its six neighbors
+	void add_city_territory(uint city_tile_id)
+	{
+		set_territory(city_tile_id, true);
+		for (auto dir = 0; dir < 6; dir++)
+		{
+			if (auto id = get_tile_neighbor(city_tile_id, dir); id != -1)
+				set_territory(id, true);
+		}
+	}
+
+	// the tile of the city must not be a city of this lord anymore
+	void remove_city_territory(uint city_tile_id)
+	{
+		auto covered = [&](uint tile_id) {
+			auto is_own_city = [&](int id) {
+				return id != -1 && tiles[id].type == TileCity && tiles[id].idx1 == (int)this->id;
+			};
+			if (is_own_city(tile_id))
+				return true;
+			for (auto dir = 0; dir < 6; dir++)
+			{
+				if (is_own_city(get_tile_neighbor(tile_id, dir)))
+					return true;
+			}
+			return false;
+		};
+		if (!covered(city_tile_id))
+			set_territory(city_tile_id, false);
+		for (auto dir = 0; dir < 6; dir++)
+		{
+			if (auto id = get_tile_neighbor(city_tile_id, dir); id != -1 && !covered(id))
+				set_territory(id, false);
+		}
+	}
+
+	void set_territory(uint tile_id, bool v)
+	{
+		if (territory_bits.size() * 64 < tiles.size())
+			territory_bits.resize((tiles.size() + 63) / 64);
+		auto& word = territory_bits[tile_id / 64];
+		auto bit = 1ULL << (tile_id % 64);
+		if (((word & bit) != 0) == v)
+			return;
+		word ^= bit;
+		if (v)
+			territories.push_back(tile_id);
+		else
+		{
+			auto it = std::find(territories.begin(), territories.end(), tile_id);
+			*it = territories.back();
+			territories.pop_back();
+		}
+	}
+
+	bool has_territory(uint tile_id) const
+	{
+		return tile_id / 64 < territory_bits.size() && (territory_bits[tile_id / 64] >> (tile_id % 64) & 1);
+	}
+
+	int find_resource_field(uint tile_id)
+	{
+		for (auto i = 0; i < resource_fields.size(); i++)
+		{
+			if (resource_fields[i].tile_id == tile_id)
+				return i;
+		}
+		return -1;
+	}
+
+	int find_city(uint tile_id)
+	{
+		for (auto i = 0; i < cities.size(); i++)
+		{
+			if (cities[i].tile_id == tile_id)
+				return i;
+		}
+		return -1;
+	}
+
+	bool build_resource_field(uint tile_id, ResourceType type, bool free = false)
+	{
+		auto& tile = tiles[tile_id];
+		if (tile.type != TileField)
+			return false;
+
+		if (resource_field_datas[type].empty())
+			return false;
+
+		auto& first_level = resource_field_datas[type].front();
+
+		if (!free)
+		{
+			if (resources[ResourceWood] < first_level.cost_wood ||
+				resources[ResourceClay] < first_level.cost_clay ||
+				resources[ResourceIron] < first_level.cost_iron ||
+				resources[ResourceCrop] < first_level.cost_crop ||
+				resources[ResourceGold] < first_level.cost_gold ||
+				provide_population < consume_population + first_level.cost_population)
+				return false;
+
+			resources[ResourceWood] -= first_level.cost_wood;
+			resources[ResourceClay] -= first_level.cost_clay;
+			resources[ResourceIron] -= first_level.cost_iron;
+			resources[ResourceCrop] -= first_level.cost_crop;
+			resources[ResourceGold] -= first_level.cost_gold;
+			consume_population += first_level.cost_population;
+			dirty = true;
+		}
+
+		ResourceField resource_field;
+		resource_field.tile_id = tile_id;
+		resource_field.lv = 1;
+		resource_field.type = type;
+		resource_field.production = first_level.production;
+
+		tile.type = TileResourceField;
+		tile.idx1 = id;
+		tile.idx2 = resource_fields.size();
+
+		resource_fields.push_back(resource_field);
+
+		return true;
+	}
+
+	bool build_city(uint tile_id)
+	{
+		auto& tile = tiles[tile_id];
+		if (tile.type != TileField)
+			return false;
+
+		City city;
+		city.id = cities.size();
+		city.tile_id = tile_id;
+		city.lord_id = id;
+		city.loyalty = 30;
+		city.production = 0;
+		city.buildings.resize(building_slots.size());
+		for (auto i = 0; i < building_slots.size(); i++)
+		{
+			auto type = building_slots[i].type;
+			auto& building = city.buildings[i];
+			building.slot = i;
+			building.type = type;
+		}
+		upgrade_building(city, 0, BuildingTownCenter, true);
+
+		city.add_exclusive_captures({ 0, 3, 6 }, HERO_EXCLUSIVE_ID, 5, 200);
+		auto& troop = city.troops.emplace_back();
+		city.set_troop_target(troop, tile_id);
+
+		city.add_unit(find_unit(L"City Defense 1"), 50);
+
+		tile.type = TileCity;
+		tile.idx1 = id;
+		tile.idx2 = cities.size();
+
+		cities.push_back(city);
+		add_city_territory(tile_id);
+		dirty = true;
+		return true;
+	}
+
+	bool upgrade_resource_field(ResourceField& resource_field, bool free = false)
+	{
+		if (resource_field_datas[resource_field.type].size() <= resource_field.lv)
+			return false;
+
+		auto& next_level = resource_field_datas[resource_field.type][resource_field.lv];
+
+		if (!free)
+		{
+			if (resources[ResourceWood] < next_level.cost_wood ||
+				resources[ResourceClay] < next_level.cost_clay ||
+				resources[ResourceIron] < next_level.cost_iron ||
+				resources[ResourceCrop] < next_level.cost_crop ||
+				resources[ResourceGold] < next_level.cost_gold ||
+				provide_population < consume_population + next_level.cost_population)
+				return false;
+
+			resources[ResourceWood] -= next_level.cost_wood;
+			resources[ResourceClay] -= next_level.cost_clay;
+			resources[ResourceIron] -= next_level.cost_iron;
+			resources[ResourceCrop] -= next_level.cost_crop;
+			resources[ResourceGold] -= next_level.cost_gold;
+			consume_population += next_level.cost_population;
+			dirty = true;
+		}
+
+		resource_field.lv++;
+		resource_field.production = next_level.production;
+
+		return true;
+	}
+
+	bool upgrade_building(City& city, uint slot, BuildingType type, bool free = false)
+	{
+		auto& building = city.buildings[slot];
+		if (type == BuildingTypeCount)
+			type = building.type;
+
+		if (!free)
+		{
+			if (auto base_data = get_building_base_data(type, building.lv); base_data)
+			{
+				if (/*resources[ResourceWood] < base_data->cost_wood ||
+					resources[ResourceClay] < base_data->cost_clay ||
+					resources[ResourceIron] < base_data->cost_iron ||
+					resources[ResourceCrop] < base_data->cost_crop ||
+					resources[ResourceGold] < base_data->cost_gold ||
+					provide_population < consume_population + base_data->cost_population ||*/
+					city.production < base_data->cost_production)
+					return false;
+
+				//resources[ResourceWood] -= base_data->cost_wood;
+				//resources[ResourceClay] -= base_data->cost_clay;
+				//resources[ResourceIron] -= base_data->cost_iron;
+				//resources[ResourceCrop] -= base_data->cost_crop;
+				//resources[ResourceGold] -= base_data->cost_gold;
+				//consume_population += base_data->cost_population;
+				city.production -= base_data->cost_production;
+			}
+		}
+
+		building.type = type;
+
+		switch (building.type)
+		{
+		case BuildingHouse:
+		{
+			auto& data = house_datas[building.lv];
+			//if (building.lv > 0)
+			//	provide_population -= house_datas[building.lv - 1].provide_population;
+			//provide_population += data.provide_population;
+		}
+			break;
+		}
+		building.lv++;
+		city.dirty = true;
+
+		return true;
+	}
+
+	bool buy_unit(City& city, uint capture_id)
+	{
+		auto& capture = city.captures[capture_id];
+		auto& unit_data = unit_datas[capture.unit_id];
+		if (resources[ResourceGold] < capture.cost_gold/* ||
+			provide_population < consume_population + unit_data.cost_population*/)
+			return false;
+
+		resources[ResourceGold] -= capture.cost_gold;
+		//consume_population += unit_data.cost_population;
+		dirty = true;
+
+		city.add_unit(capture.unit_id, capture.lv);
+
+		auto exclusive_id = capture.exclusive_id;
+		if (exclusive_id != 0)
+		{
+			for (auto it = city.captures.begin(); it != city.captures.end();)
+			{
+				if (it->exclusive_id == exclusive_id)
+					it = city.captures.erase(it);
+				else
+					it++;
+			}
+		}
+		else
+			city.captures.erase(city.captures.begin() + capture_id);
+		return true;
+	}
+
+	uint get_production(ResourceType type)
+	{
+		uint ret = 0;
+		for (auto& field : resource_fields)
+		{
+			if (field.type == type)
+				ret += field.production;
+		}
+		return ret;
+	}
+};
+extern std::vector<Lord> lords;
+extern uint main_player_id;
+
+int add_lord(uint tile_id);
+
+int search_lord_location(Rng& rng);
+
+int search_neutral_camp_location(Rng& rng);
+
+City* search_random_hostile_city(uint lord_id, Rng& rng);
+
+extern bool main_player_ai;	// let the ai play the main player too, for headless runs
+extern uint exp_multiplier;
+extern uint city_damage_multiplier;
+extern uint night_battle_idx;
+extern bool game_over;
+extern bool victory;
+
+// loads every sheet the world needs: units, skills, buildings and resource fields. the data pack
+//  of the directory is used instead while it is up to date
+bool load_world_datas(const std::filesystem::path& assets_path);
+bool load_world_sheets(const std::filesystem::path& assets_path);
+// removes the lords and camps, the map keeps its size
+void clear_world();
+void generate_world(uint lord_count = 2, uint camp_count = 10);
+
+// production, captures and training, then the ai of the computer lords
+void new_day();
+// creates the troop instances that move during the night
+void prepare_night();
+// removes the cities and camps that were defeated
+void cleanup_night();
+// called once no troop can move anymore, updates game_over and victory
+void end_night();
+
+// what a troop ran into, troop1 is always the moving troop
+struct Encounter
+{
+	TroopInstance* troop0 = nullptr;
+	City* city0 = nullptr;
+	NeutralCamp* camp0 = nullptr;
+	TroopInstance* troop1 = nullptr;
+};
+// every encounter that can be resolved at once: no troop, city or camp is in two of them
+void find_encounters(std::vector<Encounter>& encounters);
+// runs the battles of the encounters in parallel and applies the results in order, sieges included.
+//  replays receives the replay of each encounter when given, the ones of sieges stay empty
+void resolve_encounters(const std::vector<Encounter>& encounters, std::vector<BattleReplay>* replays = nullptr);
+// must be called after adding or erasing troop instances outside of the functions here
+void invalidate_troop_index();
+// moves every troop that has not reached the end of its path by one tile at once,
+//  returns how many moved. encounters must be resolved before the next tick
+uint step_night_tick();
+void remove_troop_instance(TroopInstance& troop);
+
+void give_battle_exp(TroopInstance& winner, uint exp);
+void end_battle(TroopInstance* troop0, NeutralCamp* camp0, TroopInstance* troop1, int winner);
+// resolves a troop vs troop/camp battle instantly
+int resolve_battle(TroopInstance* troop0, NeutralCamp* camp0, TroopInstance& troop1, const Rng& rng);
+uint get_siege_damage(const UnitInstance& unit);
+// the troop leaves the night, its units gain exp and the city loses loyalty
+void end_siege(TroopInstance& troop, City& city, uint damage);
+void resolve_siege(TroopInstance& troop, City& city);
+// resolves every encounter and tick left in the current night, then calls end_night
+void finish_night();
+// runs the whole night without animations
+void run_night();
+// turns the exp gained during the night into levels, evolutions and skills
+void apply_gained_exp();
@@ -1,31 +1,14 @@
 #include "game.h"
 
 #include <flame/xml.h>
-#include <flame/foundation/sheet.h>
 #include <flame/foundation/system.h>
 #include <flame/foundation/network.h>
 #include <flame/graphics/canvas.h>
 
-template <class T>
-bool has(const std::vector<T>& list, T v)
-{
-	for (auto _v : list)
-	{
-		if (_v == v)
-			return true;
-	}
-	return false;
-}
-
-enum TileType
-{
-	TileField,
-	TileCity,
-	TileNeutralCamp,
-	TileResourceField,
-
-	TileTypeCount
-};
+#include "core/world.h"
+#include "core/jobs.h"
+#include "core/save.h"
+#include "core/autosave.h"
 
 enum GameState
 {
@@ -35,147 +18,6 @@ enum GameState
 	GameBattle
 };
 
-enum ResourceType
-{
-	ResourceWood,
-	ResourceClay,
-	ResourceIron,
-	ResourceCrop,
-	ResourceGold,
-
-	ResourceTypeCount
-};
-
-enum BuildingType
-{
-	BuildingTownCenter,
-	BuildingHouse,
-	//BuildingBarracks,
-	BuildingPark,
-	BuildingTrainingMachine,
-	BuildingTower,
-	BuildingWall,
-
-	BuildingTypeCount,
-	BuildingInTownBegin = BuildingTownCenter,
-	BuildingInTownEnd = BuildingTrainingMachine,
-};
-
-const wchar_t* get_building_name(BuildingType type)
-{
-	switch (type)
-	{
-	case BuildingTownCenter: return L"Town Center";
-	case BuildingHouse: return L"House";
-	//case BuildingBarracks: return L"Barracks";
-	case BuildingPark: return L"Park";
-	case BuildingTrainingMachine: return L"Training Machine";
-	case BuildingTower: return L"Tower";
-	case BuildingWall: return L"Wall";
-	}
-	return L"";
-}
-
-const wchar_t* get_building_description(BuildingType type)
-{
-	switch (type)
-	{
-	case BuildingTownCenter: return L"";
-	case BuildingHouse: return L"Increase Gold Production";
-	//case BuildingBarracks: return L"";
-	case BuildingPark: return L"Captures Pokemons Every Turn";
-	case BuildingTrainingMachine: return L"Training Pokemons\nEach Machine will train one \npokemon in the city with the \norder of from highest to lowest \nlevel of the machines";
-	case BuildingTower: return L"";
-	case BuildingWall: return L"";
-	}
-	return L"";
-}
-
-BuildingType get_building_type_from_name(std::wstring_view name)
-{
-	for (auto i = 0; i < BuildingTypeCount; i++)
-	{
-		if (name == get_building_name((BuildingType)i))
-			return (BuildingType)i;
-	}
-	return BuildingTypeCount;
-}
-
-bool is_building_unique(BuildingType type)
-{
-	switch (type)
-	{
-	case BuildingTownCenter: return true;
-	case BuildingHouse: return false;
-	//case BuildingBarracks: return true;
-	case BuildingPark: return true;
-	case BuildingTrainingMachine: return false;
-	case BuildingTower: return true;
-	case BuildingWall: return true;
-	}
-	return false;
-}
-
-enum PokemonType
-{
-	PokemonNormal,
-	PokemonFire,
-	PokemonWater,
-	PokemonElectric,
-	PokemonGrass,
-	PokemonIce,
-	PokemonFighting,
-	PokemonPoison,
-	PokemonGround,
-	PokemonFlying,
-	PokemonPsychic,
-	PokemonBug,
-	PokemonRock,
-	PokemonGhost,
-	PokemonDragon,
-	PokemonDark,
-	PokemonSteel,
-	PokemonFairy,
-
-	PokemonTypeCount
-};
-
-const wchar_t* get_pokemon_type_name(PokemonType type)
-{
-	switch (type)
-	{
-	case PokemonNormal: return L"Normal";
-	case PokemonFire: return L"Fire";
-	case PokemonWater: return L"Water";
-	case PokemonElectric: return L"Electric";
-	case PokemonGrass: return L"Grass";
-	case PokemonIce: return L"Ice";
-	case PokemonFighting: return L"Fighting";
-	case PokemonPoison: return L"Poison";
-	case PokemonGround: return L"Ground";
-	case PokemonFlying: return L"Flying";
-	case PokemonPsychic: return L"Psychic";
-	case PokemonBug: return L"Bug";
-	case PokemonRock: return L"Rock";
-	case PokemonGhost: return L"Ghost";
-	case PokemonDragon: return L"Dragon";
-	case PokemonDark: return L"Dark";
-	case PokemonSteel: return L"Steel";
-	case PokemonFairy: return L"Fairy";
-	}
-	return L"";
-}
-
-PokemonType get_pokemon_type_from_name(std::wstring_view name)
-{
-	for (auto i = 0; i < PokemonTypeCount; i++)
-	{
-		if (name == get_pokemon_type_name((PokemonType)i))
-			return (PokemonType)i;
-	}
-	return PokemonTypeCount;
-}
-
 cvec4 get_pokemon_type_color(PokemonType type)
 {
 	switch (type)
@@ -202,2942 +44,720 @@ cvec4 get_pokemon_type_color(PokemonType type)
 	return cvec4(0, 0, 0, 255);
 }
 
-float pokemon_type_effectiveness[PokemonTypeCount][PokemonTypeCount]; // attacker, defender
+cCameraPtr camera;
 
-enum Stat
-{
-	StatHP,
-	StatATK,
-	StatDEF,
-	StatSA,
-	StatSD,
-	StatSP,
-	StatACC,
-	StatEVA,
-
-	StatCount
-};
+graphics::CanvasPtr canvas;
 
-const wchar_t* get_stat_name(Stat stat)
-{
-	switch (stat)
-	{
-	case StatHP: return L"HP";
-	case StatATK: return L"ATK";
-	case StatDEF: return L"DEF";
-	case StatSA: return L"SA";
-	case StatSD: return L"SD";
-	case StatSP: return L"SP";
-	case StatACC: return L"ACC";
-	case StatEVA: return L"EVA";
-	}
-	return L"";
-}
+graphics::ImagePtr img_target;
 
-Stat get_stat_from_name(std::wstring_view name)
-{
-	for (auto i = 0; i < StatCount; i++)
-	{
-		if (name == get_stat_name((Stat)i))
-			return (Stat)i;
-	}
-	return StatCount;
-}
+graphics::ImagePtr img_tile_frame;
+graphics::ImagePtr img_tile_grass;
+graphics::ImagePtr img_tile_castle;
 
-enum SkillCategory
-{
-	SkillCatePhysical,
-	SkillCateSpecial,
-	SkillCateStatus,
+graphics::ImagePtr img_city;
+graphics::ImagePtr img_camp;
+graphics::ImagePtr img_ground;
+graphics::ImagePtr imgs_building[BuildingTypeCount];
 
-	SkillCategoryCount
-};
+graphics::ImagePtr img_resources[ResourceTypeCount] = {};
+graphics::ImagePtr img_population;
+graphics::ImagePtr img_production;
 
-const wchar_t* get_skill_category_name(SkillCategory cate)
-{
-	switch (cate)
-	{
-	case SkillCatePhysical: return L"Physical";
-	case SkillCateSpecial: return L"Special";
-	case SkillCateStatus: return L"Status";
-	}
-	return L"";
-}
+graphics::ImagePtr img_be_hit;
+std::vector<graphics::ImagePtr> unit_icons;
+
+graphics::SamplerPtr sp_repeat;
 
-SkillCategory get_skill_category_from_name(std::wstring_view name)
+void draw_rect(const vec2& pos, const vec2& sz, const vec2& pivot = vec2(0.f), const cvec4& color = cvec4(255))
 {
-	for (auto i = 0; i < SkillCategoryCount; i++)
-	{
-		if (name == get_skill_category_name((SkillCategory)i))
-			return (SkillCategory)i;
-	}
-	return SkillCategoryCount;
+	auto p = pos;
+	p -= pivot * sz;
+	canvas->draw_rect_filled(p, p + sz, color);
 }
 
-enum EffectType
+void draw_image(graphics::ImagePtr img, const vec2& pos, const vec2& sz, const vec2& pivot = vec2(0.f), const cvec4& tint = cvec4(255))
 {
-	EffectUserStat,
-	EffectOpponentStat,
-	EffectStatus,
-	EffectRecover,
-	EffectLifeSteal,
-	EffectMultipleHits,
-	EffectDamageDebuff,
-
-	EffectTypeCount
-};
+	auto p = pos;
+	p -= pivot * sz;
+	canvas->draw_image(img->get_view(), p, p + sz, vec4(0.f, 0.f, 1.f, 1.f), tint);
+}
 
-const wchar_t* get_effect_type_name(EffectType effect)
+void draw_text(std::wstring_view text, uint font_size, const vec2& pos, const vec2& pivot = vec2(0.f), const cvec4& color = cvec4(255), const vec2& shadow_offset = vec2(0.f), const cvec4& shadow_color = cvec4(255))
 {
-	switch (effect)
+	auto p = pos;
+	if (pivot.x != 0.f || pivot.y != 0.f)
 	{
-	case EffectUserStat: return L"UserStat";
-	case EffectOpponentStat: return L"OpponentStat";
-	case EffectStatus: return L"Status";
+		auto sz = canvas->calc_text_size(nullptr, font_size, text);
+		p -= pivot * sz;
 	}
-	return L"";
+	if (shadow_offset.x != 0.f || shadow_offset.y != 0.f)
+		canvas->draw_text(nullptr, font_size, p + shadow_offset, text, shadow_color);
+	canvas->draw_text(nullptr, font_size, p, text, color);
 }
 
-EffectType get_effect_type_from_name(std::wstring_view name)
+auto tile_sz = 100.f;
+auto tile_sz_y = tile_sz * 0.5f * 1.732050807569;
+
+vec2 get_tile_pos(uint id)
 {
-	for (auto i = 0; i < EffectTypeCount; i++)
-	{
-		if (name == get_effect_type_name((EffectType)i))
-			return (EffectType)i;
+	auto x = get_tile_x(id), y = get_tile_y(id);
+	auto pos = vec2(x * tile_sz * 0.75f, y * tile_sz_y) + vec2(0.f, 36.f);
+	if (x % 2 == 1)
+		pos.y += tile_sz_y * 0.5f;
+	return pos;
+}
+
+// the tile under p, -1 if p is outside the map. the tiles are flat topped hexes with a
+//  circumradius of tile_sz / 2, so p is converted to axial coordinates and rounded to the closest center
+int pick_tile(const vec2& p)
+{
+	auto size = tile_sz * 0.5f;
+	auto lp = p - vec2(0.f, 36.f) - vec2(tile_sz * 0.5f);
+	auto fq = lp.x * (2.f / 3.f) / size;
+	auto fr = (lp.x * (-1.f / 3.f) + lp.y * (1.732050807569f / 3.f)) / size;
+	auto fs = -fq - fr;
+	auto q = roundf(fq), r = roundf(fr), s = roundf(fs);
+	auto dq = abs(q - fq), dr = abs(r - fr), ds = abs(s - fs);
+	if (dq > dr && dq > ds)
+		q = -r - s;
+	else if (dr > ds)
+		r = -q - s;
+	auto x = (int)q;
+	auto y = (int)r + (x - (x & 1)) / 2;
+
+	// the rounded tile can be just outside the map while p is still inside the circle of a border tile
+	auto ret = -1;
+	auto best = tile_sz * 0.5f;
+	for (auto yy = y - 1; yy <= y + 1; yy++)
+	{
+		for (auto xx = x - 1; xx <= x + 1; xx++)
+		{
+			if (xx < 0 || yy < 0 || xx >= tile_cx || yy >= tile_cy)
+				continue;
+			auto id = yy * tile_cx + xx;
+			auto d = distance(get_tile_pos(id) + tile_sz * 0.5f, p);
+			if (d < best)
+			{
+				best = d;
+				ret = id;
+			}
+		}
 	}
-	return EffectTypeCount;
+	return ret;
 }
 
-enum AbnormalStatus
+// the troop slides from the previous tile of its path while move_t goes to 1
+vec2 get_troop_pos(const TroopInstance& troop)
 {
-	AbnormalStatusNone,
-	AbnormalStatusBurn,
-	AbnormalStatusFreeze,
-	AbnormalStatusParalysis,
-	AbnormalStatusPoison,
-	AbnormalStatusSleep,
-
-	AbnormalStatusCount
-};
+	auto pos = get_tile_pos(troop.path[troop.path_idx]);
+	if (troop.path_idx > 0 && troop.move_t < 1.f)
+		pos = mix(get_tile_pos(troop.path[troop.path_idx - 1]), pos, troop.move_t);
+	return pos + vec2(tile_sz) * 0.5f;
+}
 
-const wchar_t* get_status_name(AbnormalStatus status)
+int selected_tile = -1;
+
+struct BattlePlayer
 {
-	switch (status)
+	struct UnitDisplay
 	{
-	case AbnormalStatusBurn: return L"Burn";
-	case AbnormalStatusFreeze: return L"Freeze";
-	case AbnormalStatusParalysis: return L"Paralysis";
-	case AbnormalStatusPoison: return L"Poison";
-	case AbnormalStatusSleep: return L"Sleep";
-	}
-	return L"";
-}
+		uint unit_id;
+		vec2 init_pos;
+		vec2 pos; float ang; vec2 scl; float alpha;
+		uint HP;
+		std::wstring label;
+		vec2 label_pos; float label_ang; vec2 label_scl; float label_alpha;
+	};
 
-AbnormalStatus get_status_from_name(std::wstring_view name)
-{
-	for (auto i = 0; i < AbnormalStatusCount; i++)
+	uint side;
+	TroopInstance*	troop = nullptr;
+	City*			city = nullptr;
+	NeutralCamp*	camp = nullptr;
+	std::vector<UnitInstance> replay_units;
+	uint replay_lord_id = 5U;	// colors the side of a replay, 5 is the neutral camps
+	std::vector<UnitDisplay> unit_displays;
+
+	std::vector<UnitInstance>& get_units()
 	{
-		if (name == get_status_name((AbnormalStatus)i))
-			return (AbnormalStatus)i;
+		if (troop)
+			return troop->units;
+		if (camp)
+			return camp->units;
+		return replay_units;
 	}
-	return AbnormalStatusCount;
-}
 
-struct SkillEffect
-{
-	EffectType type;
-	union
+	void refresh_display()
 	{
-		struct
-		{
-			Stat id;
-			int state;
-			float prob;
-		}stat;
-		struct
+		if (!troop && !camp && replay_units.empty())
+			return;
+		auto& units = get_units();
+		unit_displays.resize(units.size());
+		for (auto i = 0; i < units.size(); i++)
 		{
-			AbnormalStatus id;
-			float prob;
-		}status;
-	}data;
+			auto& unit = units[i];
+			auto& display = unit_displays[i];
+			display.unit_id = unit.id;
+			display.init_pos = vec2(136.f + i * 75.f, 240.f + 100.f * (1 - side));
+			display.HP = unit.stats[StatHP];
+			display.pos = display.init_pos;
+			display.scl = vec3(1.f);
+			display.alpha = unit.stats[StatHP] > 0 ? 1.f : 0.f;
+		}
+	}
 };
 
-const uint MAX_TROOP_UNITS = 12;
-const uint IV_VAL = 31;
-const uint BP_VAL = 252;
-const uint BASE_EXP = 100;
-
-uint calc_hp_stat(uint base, uint lv)
-{
-	return uint((base * 2 + IV_VAL + BP_VAL / 4) * lv / 100.f) + lv + 10;
-}
-
-uint calc_stat(uint base, uint lv)
-{
-	return uint((base * 2 + IV_VAL + BP_VAL / 4) * lv / 100.f) + 5;
-}
-
-uint calc_exp(uint lv)
-{
-	return (lv * lv * lv * 4) / 5;
-}
-
-uint calc_gain_exp(uint lv)
+cvec4 hsv(float h, float s, float v, float a)
 {
-	return (BASE_EXP * lv) / 7;
+	return cvec4(vec4(rgbColor(vec3(h, s, v)), a) * 255.f);
 }
 
-enum TargetType
+// fixed capacity queue that overwrites the oldest item when full
+template <class T, uint N>
+struct RingBuffer
 {
-	TargetEnemy,
-	TargetSelf
-};
+	T items[N];
+	uint head = 0;
+	uint count = 0;
 
-struct SkillData
-{
-	std::wstring name;
-	PokemonType type;
-	SkillCategory category;
-	uint power;
-	uint acc;
-	uint pp;
-	std::wstring effect_text;
-	std::vector<SkillEffect> effects;
-	TargetType target_type = TargetEnemy;
-};
-std::vector<SkillData> skill_datas;
+	void push(const T& v)
+	{
+		items[(head + count) % N] = v;
+		if (count < N)
+			count++;
+		else
+			head = (head + 1) % N;
+	}
 
-struct UnitData
-{
-	std::wstring name;
-	uint cost_gold;
-	uint cost_population;
-	uint evolution_lv = 0;
-	uint stats[StatCount];
-	PokemonType type1 = PokemonTypeCount;
-	PokemonType type2 = PokemonTypeCount;
-	std::vector<std::pair<uint, uint>> skillset;
-	std::vector<uint> learnable_skills;
-	graphics::ImagePtr icon = nullptr;
-};
-std::vector<UnitData> unit_datas;
+	void clear()
+	{
+		head = 0;
+		count = 0;
+	}
 
-int find_unit(std::wstring_view name)
-{
-	for (auto i = 0; i < unit_datas.size(); i++)
+	uint size() const
 	{
-		if (unit_datas[i].name == name)
-			return i;
+		return count;
 	}
-	return -1;
-}
 
-struct Unit
-{
-	uint id;
-	uint lv;
-	uint exp;
-	int skills[4] = { -1, -1, -1, -1 };
-	std::vector<uint> learnt_skills;
-	uint gain_exp = 0;
-
-	void learn_skills()
+	// 0 is the oldest
+	const T& operator[](uint i) const
 	{
-		auto& unit_data = unit_datas[id];
-		for (auto& s : unit_data.skillset)
-		{
-			if (s.first <= lv)
-			{
-				if (!has(learnt_skills, s.second))
-					learnt_skills.push_back(s.second);
-			}
-		}
+		return items[(head + i) % N];
 	}
 };
 
-struct UnitInstance
+std::wstring get_stat_change_text(Stat stat, int stage, int v)
 {
-	Unit* original;
-	uint id;
-	uint lv;
-	uint HP_MAX;
-	uint stats[StatCount];
-	PokemonType type1;
-	PokemonType type2;
-	int skills[4] = { -1, -1, -1, -1 };
-	int stat_stage[StatCount] = { 0, 0, 0, 0, 0, 0 };
-	AbnormalStatus abnormal_status = AbnormalStatusNone;
-
-	void init(uint _id, uint _lv, const int* const _skills)
+	auto new_val = clamp(stage + v, -6, +6);
+	if (stage != new_val)
 	{
-		id = _id;
-		lv = _lv;
-		auto& unit_data = unit_datas[id];
-		original = nullptr;
-		HP_MAX = calc_hp_stat(unit_data.stats[StatHP], lv);
-		stats[StatHP] = HP_MAX;
-		for (auto i = (int)StatATK; i < StatCount; i++)
-			stats[i] = calc_stat(unit_data.stats[i], lv);
-		type1 = unit_data.type1;
-		type2 = unit_data.type2;
-		memcpy(skills, _skills, sizeof(skills));
+		switch (new_val - stage)
+		{
+		case -1: return std::format(L"{} fell", get_stat_name(stat));
+		case -2: return std::format(L"{} harshly fell", get_stat_name(stat));
+		case +1: return std::format(L"{} rose", get_stat_name(stat));
+		case +2: return std::format(L"{} rose sharply", get_stat_name(stat));
+		}
+		return L"";
 	}
+	if (v < 0)
+		return std::format(L"{} won't go any lower", get_stat_name(stat));
+	return std::format(L"{} won't go any higher", get_stat_name(stat));
+}
 
-	void init(Unit& unit)
-	{
-		init(unit.id, unit.lv, unit.skills);
-		original = &unit;
+// a battle action as plain data, it is only turned into text when the hud draws it
+struct BattleLogRecord
+{
+	uint caster_id;
+	uint caster_lv;
+	uint target_id;
+	uint target_lv;
+	int skill_id;
+	SkillResult result;
+	uint damage;
+	bool stat_changed;
+	int8_t stat_stage_before[StatCount];
+	int8_t stat_change[StatCount];
+
+	std::wstring format_label() const
+	{
+		std::wstring ret;
+		if (result == SkillMiss)
+			ret = L"Miss";
+		if (result == SkillNoEffect)
+			ret = L"No Effect";
+		if (damage > 0)
+			ret = wstr(damage);
+		if (stat_changed)
+		{
+			for (auto i = (int)StatATK; i < StatCount; i++)
+			{
+				if (auto v = stat_change[i]; v != 0)
+				{
+					if (!ret.empty())
+						ret += L"\n";
+					ret += get_stat_change_text((Stat)i, stat_stage_before[i], v);
+				}
+			}
+		}
+		return ret;
 	}
 
-	int choose_skill(UnitInstance& target)
+	std::wstring format_log() const
 	{
-		std::vector<std::pair<uint, uint>> cands;
-		for (auto i = 0; i < 4; i++)
+		auto ret = std::format(L"{} LV{} cast {} to {} LV{}", unit_datas[caster_id].name, caster_lv, skill_datas[skill_id].name, unit_datas[target_id].name, target_lv);
+		if (result == SkillMiss)
+			ret += L", missed";
+		if (result == SkillNoEffect)
+			ret += L", no effect";
+		if (damage > 0)
+			ret += std::format(L", inflicted {} damage", damage);
+		if (stat_changed)
 		{
-			if (auto skill_id = skills[i]; skill_id != -1)
+			for (auto i = (int)StatATK; i < StatCount; i++)
 			{
-				auto& skill_data = skill_datas[skill_id];
-				auto weight = 100;
-				if (skill_data.category == SkillCateStatus)
+				if (auto v = stat_change[i]; v != 0)
 				{
-					weight = 0;
-					for (auto& e : skill_data.effects)
-					{
-						if (e.type == EffectOpponentStat)
-						{
-							auto old_state = target.stat_stage[e.data.stat.id];
-							auto new_state = clamp(old_state + e.data.stat.state, -6, +6);
-							if (old_state != new_state)
-							{
-								for (auto i = abs(old_state) + 1; i <= abs(new_state); i++)
-									weight += 100 * (pow(0.8f, i) * e.data.stat.prob);
-							}
-						}
-					}
+					if (auto str = get_stat_change_text((Stat)i, stat_stage_before[i], v); !str.empty())
+						ret += L", target " + str;
 				}
-				cands.emplace_back(skill_id, weight);
 			}
 		}
-		if (cands.empty())
-			return -1;
-		return weighted_random(cands);
+		return ret;
 	}
 };
 
-float get_stage_modifier(int stage)
+GameState state = GameInit;
+bool show_result = false;
+BattlePlayer battle_players[2];
+BattleSim battle_sim;
+BattleReplay last_replay;
+BattleReplay replay_source;
+uint replay_event_idx = 0;
+int replay_diverged_at = -1;	// the first event the sim disagreed with the replay on
+BattleEstimate battle_estimate;	// of the battle on screen, runs is 0 until one is made
+std::shared_ptr<JobGroup> estimate_job;
+std::shared_ptr<BattleEstimate> pending_estimate;	// where estimate_job puts its result
+bool replaying = false;
+bool replaying_night_battle = false;
+struct NightBattle
+{
+	BattleReplay replay;
+	uint lord_ids[2];
+};
+std::deque<NightBattle> night_battles;	// battles of the night that are resolved but not shown yet
+std::vector<Encounter> night_encounters;
+GameState state_before_replay = GameInit;
+Rng interface_rng;
+TurnOrder siege_order;
+bool siege_finishing = false;
+RingBuffer<BattleLogRecord, 5> battle_log;
+uint city_damge = 0;
+float troop_anim_time = 0.f;
+float anim_remain = 0;
+float anim_time_scaling = 1.f;
+std::wstring verify_result;	// of the last replay check, shown under Verify Replays
+bool turbo = false;	// nights, battles and the exp gain are resolved at once without tweens
+
+void start_day()
 {
-	switch (stage)
-	{
-	case -6: return  25.f / 100.f;
-	case -5: return  28.f / 100.f;
-	case -4: return  33.f / 100.f;
-	case -3: return  40.f / 100.f;
-	case -2: return  50.f / 100.f;
-	case -1: return  66.f / 100.f;
-	case +1: return 150.f / 100.f;
-	case +2: return 200.f / 100.f;
-	case +3: return 250.f / 100.f;
-	case +4: return 300.f / 100.f;
-	case +5: return 350.f / 100.f;
-	case +6: return 400.f / 100.f;
-	}
-	return 1.f;
+	if (state == GameDay)
+		return;
+	state = GameDay;
+	new_day();
 }
 
-float get_effectineness(PokemonType skill_type, PokemonType caster_type1, PokemonType caster_type2, PokemonType target_type1, PokemonType target_type2)
+void start_night()
 {
-	auto effectiveness1 = target_type1 != PokemonTypeCount ? pokemon_type_effectiveness[skill_type][target_type1] : 1.f;
-	auto effectiveness2 = target_type2 != PokemonTypeCount ? pokemon_type_effectiveness[skill_type][target_type2] : 1.f;
-	auto effectiveness = effectiveness1 * effectiveness2;
-	if (caster_type1 == skill_type || caster_type2 == skill_type)
-		effectiveness *= 1.5f;
-	return effectiveness;
+	if (state == GameNight)
+		return;
+	state = GameNight;
+	prepare_night();
 }
 
-enum SkillResult
-{
-	SkillHit,
-	SkillMiss,
-	SkillNoEffect
-};
+void start_replay(const BattleReplay& replay);
 
-struct StatChange
+void step_troop_moving()
 {
-	bool changed = false;
-	int stage[StatCount] = { 0, 0, 0, 0, 0, 0 };
-};
+	if (anim_remain > 0.f)
+		return;
+	anim_remain = 0.5f * anim_time_scaling;
 
-SkillResult cast_skill(UnitInstance& caster, UnitInstance& target, uint skill_id, uint& damage, StatChange& caster_stat_changed, StatChange& target_stat_changed)
-{
-	auto& skill_data = skill_datas[skill_id];
-	auto effectiveness = get_effectineness(skill_data.type, caster.type1, caster.type2, target.type1, target.type2);
-	if (effectiveness == 0.f)
-		return SkillNoEffect;
+	if (turbo)
+	{
+		night_battles.clear();
+		finish_night();
+		apply_gained_exp();
+		start_day();
+		return;
+	}
 
+	if (!night_battles.empty())
 	{
-		auto B = skill_data.acc / 100.f;
-		auto C = get_stage_modifier(caster.stat_stage[StatACC]);
-		auto D = get_stage_modifier(target.stat_stage[StatEVA]);
-		auto A = B * C / D;
-		if (linearRand(0.f, 1.f) >= A)
-			return SkillMiss;
+		auto& battle = night_battles.front();
+		last_replay = std::move(battle.replay);
+		start_replay(last_replay);
+		replaying_night_battle = true;
+		for (auto i = 0; i < 2; i++)
+			battle_players[i].replay_lord_id = battle.lord_ids[i];
+		night_battles.pop_front();
+		return;
 	}
 
-	if (skill_data.power > 0)
+	cleanup_night();
+
+	// the battles of a batch are resolved together on the job system and then shown one by one
+	//  as replays, sieges are shown one at a time once no battle is left
+	find_encounters(night_encounters);
+	auto only_sieges = std::all_of(night_encounters.begin(), night_encounters.end(), [](const auto& encounter) {
+		return encounter.city0 != nullptr;
+	});
+	if (!night_encounters.empty() && only_sieges)
+	{
+		auto& siege = night_encounters.front();
+		state = GameBattle;
+		{
+			auto& player = battle_players[0];
+			player.city = siege.city0;
+			player.unit_displays.clear();
+		}
+		{
+			auto& player = battle_players[1];
+			player.troop = siege.troop1;
+			player.refresh_display();
+		}
+		siege_order.clear();
+		siege_finishing = false;
+		battle_log.clear();
+		return;
+	}
+	if (!night_encounters.empty())
 	{
-		auto A = skill_data.category == SkillCatePhysical ? caster.stats[StatATK] : caster.stats[StatSA];
-		auto D = skill_data.category == SkillCatePhysical ? target.stats[StatDEF] : target.stats[StatSD];
-		damage = ((2.f * caster.lv + 10.f) / 250.f * ((float)A / (float)D) * skill_data.power + 2.f) * effectiveness;
+		std::erase_if(night_encounters, [](const auto& encounter) {
+			return encounter.city0 != nullptr;
+		});
+		for (auto& encounter : night_encounters)
+		{
+			auto& battle = night_battles.emplace_back();
+			battle.lord_ids[0] = encounter.troop0 ? encounter.troop0->lord_id : 5U;
+			battle.lord_ids[1] = encounter.troop1->lord_id;
+		}
+		std::vector<BattleReplay> replays;
+		resolve_encounters(night_encounters, &replays);
+		for (auto i = 0; i < replays.size(); i++)
+			night_battles[i].replay = std::move(replays[i]);
+		anim_remain = 0.f;
+		return;
 	}
 
-	for (auto& effect : skill_data.effects)
+	// the tick moves every troop at once, the tween only interpolates their positions
+	if (step_night_tick() > 0)
 	{
-		switch (effect.type)
+		auto tween = sTween::instance();
+		auto id = tween->begin_2d_targets();
+		for (auto& lord : lords)
 		{
-		case EffectUserStat:
-			if (linearRand(0.f, 1.f) <= effect.data.stat.prob)
-			{
-				caster_stat_changed.changed = true;
-				caster_stat_changed.stage[effect.data.stat.id] += effect.data.stat.state;
-			}
-			break;
-		case EffectOpponentStat:
-			if (linearRand(0.f, 1.f) <= effect.data.stat.prob)
+			for (auto& troop : lord.troop_instances)
 			{
-				target_stat_changed.changed = true;
-				target_stat_changed.stage[effect.data.stat.id] += effect.data.stat.state;
+				if (troop.move_t < 1.f)
+					tween->add_2d_target(id, nullptr, nullptr, nullptr, &troop.move_t);
 			}
-			break;
 		}
+		tween->alpha_to(id, 1.f, 0.48f * anim_time_scaling);
+		tween->end(id);
 	}
-
-	return SkillHit;
-}
-
-cCameraPtr camera;
-
-graphics::CanvasPtr canvas;
-
-graphics::ImagePtr img_target;
-
-graphics::ImagePtr img_tile_frame;
-graphics::ImagePtr img_tile_grass;
-graphics::ImagePtr img_tile_castle;
-
-graphics::ImagePtr img_city;
-graphics::ImagePtr img_camp;
-graphics::ImagePtr img_ground;
-graphics::ImagePtr imgs_building[BuildingTypeCount];
-
-graphics::ImagePtr img_resources[ResourceTypeCount] = {};
-graphics::ImagePtr img_population;
-graphics::ImagePtr img_production;
-
-graphics::ImagePtr img_be_hit;
-
-graphics::SamplerPtr sp_repeat;
-
-void draw_rect(const vec2& pos, const vec2& sz, const vec2& pivot = vec2(0.f), const cvec4& color = cvec4(255))
-{
-	auto p = pos;
-	p -= pivot * sz;
-	canvas->draw_rect_filled(p, p + sz, color);
-}
-
-void draw_image(graphics::ImagePtr img, const vec2& pos, const vec2& sz, const vec2& pivot = vec2(0.f), const cvec4& tint = cvec4(255))
-{
-	auto p = pos;
-	p -= pivot * sz;
-	canvas->draw_image(img->get_view(), p, p + sz, vec4(0.f, 0.f, 1.f, 1.f), tint);
-}
-
-void draw_text(std::wstring_view text, uint font_size, const vec2& pos, const vec2& pivot = vec2(0.f), const cvec4& color = cvec4(255), const vec2& shadow_offset = vec2(0.f), const cvec4& shadow_color = cvec4(255))
-{
-	auto p = pos;
-	if (pivot.x != 0.f || pivot.y != 0.f)
+	else
 	{
-		auto sz = canvas->calc_text_size(nullptr, font_size, text);
-		p -= pivot * sz;
+		end_night();
+		if (!game_over)
+			show_result = true;
+		start_day();
 	}
-	if (shadow_offset.x != 0.f || shadow_offset.y != 0.f)
-		canvas->draw_text(nullptr, font_size, p + shadow_offset, text, shadow_color);
-	canvas->draw_text(nullptr, font_size, p, text, color);
 }
 
-auto tile_cx = 12U;
-auto tile_cy = 4U;
-auto tile_sz = 100.f;
-auto tile_sz_y = tile_sz * 0.5f * 1.732050807569;
-
-struct Tile
-{
-	uint id;
-	uint x, y;
-	vec2 pos;
-	TileType type;
-	int idx1;
-	int idx2;
-
-	int tile_lt = -1;
-	int tile_t = -1;
-	int tile_rt = -1;
-	int tile_lb = -1;
-	int tile_b = -1;
-	int tile_rb = -1;
-};
-std::vector<Tile> tiles;
-
-int selected_tile = -1;
-
-std::vector<uint> find_path(uint start_id, uint end_id)
+// plays a recorded battle through the battle view, the game state is restored when it finishes
+void start_replay(const BattleReplay& replay)
 {
-	if (start_id == end_id)
-		return { start_id };
-	std::vector<uint> ret;
-	std::vector<bool> marks;
-	marks.resize(tiles.size());
-	std::vector<std::pair<uint, uint>> candidates;
-	candidates.push_back({ start_id, 0 });
-	marks[start_id] = true;
-	auto path_idx = 0;
-	while (path_idx < candidates.size())
-	{
-		auto [id, parent] = candidates[path_idx];
-
-		if (id == end_id)
-		{
-			ret.push_back(end_id);
-			id = candidates[parent].first;
-			parent = candidates[parent].second;
-			while (id != start_id)
-			{
-				ret.push_back(id);
-				id = candidates[parent].first;
-				parent = candidates[parent].second;
-			}
-			ret.push_back(start_id);
-			break;
-		}
-
-		auto& tile = tiles[id];
-		if (tile.tile_lt != -1 && !marks[tile.tile_lt])
-		{
-			candidates.push_back({ tile.tile_lt, path_idx });
-			marks[tile.tile_lt] = true;
-		}
-		if (tile.tile_t != -1 && !marks[tile.tile_t])
-		{
-			candidates.push_back({ tile.tile_t, path_idx });
-			marks[tile.tile_t] = true;
-		}
-		if (tile.tile_rt != -1 && !marks[tile.tile_rt])
-		{
-			candidates.push_back({ tile.tile_rt, path_idx });
-			marks[tile.tile_rt] = true;
-		}
-		if (tile.tile_lb != -1 && !marks[tile.tile_lb])
-		{
-			candidates.push_back({ tile.tile_lb, path_idx });
-			marks[tile.tile_lb] = true;
-		}
-		if (tile.tile_b != -1 && !marks[tile.tile_b])
-		{
-			candidates.push_back({ tile.tile_b, path_idx });
-			marks[tile.tile_b] = true;
-		}
-		if (tile.tile_rb != -1 && !marks[tile.tile_rb])
-		{
-			candidates.push_back({ tile.tile_rb, path_idx });
-			marks[tile.tile_rb] = true;
-		}
-
-		path_idx++;
-	}
-	std::reverse(ret.begin(), ret.end());
-	return ret;
+	if (state == GameBattle)
+		return;
+	replaying = true;
+	replaying_night_battle = false;
+	replay_source = replay;
+	replay_event_idx = 0;
+	replay_diverged_at = -1;
+	// a job still running for the previous battle finishes into its own result, which nobody reads anymore
+	battle_estimate = {};
+	estimate_job.reset();
+	pending_estimate.reset();
+	state_before_replay = state;
+	state = GameBattle;
+	for (auto i = 0; i < 2; i++)
+	{
+		auto& player = battle_players[i];
+		player.troop = nullptr;
+		player.city = nullptr;
+		player.camp = nullptr;
+		player.replay_units = replay.units[i];
+		player.replay_lord_id = 5U;
+		player.refresh_display();
+	}
+	Rng rng;
+	rng.key = replay.rng_key;
+	rng.counter = replay.rng_counter;
+	battle_sim.setup(battle_players[0].replay_units, battle_players[1].replay_units, rng);
+	battle_sim.damage_multiplier = replay.damage_multiplier;
+	battle_log.clear();
 }
 
-struct BuildingBaseData
-{
-	uint cost_wood;
-	uint cost_clay;
-	uint cost_iron;
-	uint cost_crop;
-	uint cost_gold;
-	uint cost_population;
-	uint cost_production;
-
-	void read(Sheet::Row& row, SheetPtr sht)
-	{
-		cost_wood = sht->get_as<uint>(row, "cost_wood"_h);
-		cost_clay = sht->get_as<uint>(row, "cost_clay"_h);
-		cost_iron = sht->get_as<uint>(row, "cost_iron"_h);
-		cost_crop = sht->get_as<uint>(row, "cost_crop"_h);
-		cost_gold = sht->get_as<uint>(row, "cost_gold"_h);
-		cost_population = sht->get_as<uint>(row, "cost_population"_h);
-		cost_production = sht->get_as<uint>(row, "cost_production"_h);
-	}
-};
-
-struct TownCenterData : BuildingBaseData
-{
-};
-std::vector<TownCenterData> town_center_datas;
-
-struct HouseData : BuildingBaseData
-{
-	uint gold_production;
-	uint provide_population;
-};
-std::vector<HouseData> house_datas;
-
-struct BarracksData : BuildingBaseData
-{
-};
-std::vector<BarracksData> barracks_datas;
-
-struct ParkData : BuildingBaseData
-{
-	std::vector<std::pair<uint, uint>> encounter_list;
-	uint capture_num;
-};
-std::vector<ParkData> park_datas;
-
-struct TrainingMachineData : BuildingBaseData
-{
-	uint exp;
-};
-std::vector<TrainingMachineData> training_machine_datas;
-
-struct TowerData : BuildingBaseData
-{
-};
-std::vector<TowerData> tower_datas;
-
-struct WallData : BuildingBaseData
+// unit battles are resolved before they are shown, the battle view only plays their replays
+bool is_unit_battle()
 {
-};
-std::vector<WallData> wall_datas;
-
-BuildingBaseData* get_building_base_data(BuildingType type, uint lv)
-{
-	BuildingBaseData* ret = nullptr;
-	switch (type)
-	{
-	case BuildingTownCenter: 
-		if (town_center_datas.size() > lv)
-			ret = &town_center_datas[lv];
-		break;
-	case BuildingHouse:
-		if (house_datas.size() > lv)
-			ret = &house_datas[lv];
-		break;
-	//case BuildingBarracks:
-	//	if (barracks_datas.size() > lv)
-	//		ret = &barracks_datas[lv];
-	//	break;
-	case BuildingPark:
-		if (park_datas.size() > lv)
-			ret = &park_datas[lv];
-		break;
-	case BuildingTrainingMachine:
-		if (training_machine_datas.size() > lv)
-			ret = &training_machine_datas[lv];
-		break;
-	case BuildingTower:
-		if (tower_datas.size() > lv)
-			ret = &tower_datas[lv];
-		break;
-	case BuildingWall:
-		if (wall_datas.size() > lv)
-			ret = &wall_datas[lv];
-		break;
-	}
-	return ret;
+	return replaying;
 }
 
-struct Building
-{
-	uint slot;
-	BuildingType type;
-	uint lv = 0;
-};
-
-struct Troop
-{
-	uint				target = 0;	// tile id
-	std::vector<uint>	units;		// indices
-	std::vector<uint>	path;
-};
-
-struct PokemonCapture
-{
-	uint unit_id;
-	uint exclusive_id;
-	uint lv;
-	uint cost_gold;
-};
-
-struct City
-{
-	uint id;
-	uint tile_id;
-	uint lord_id;
-	uint loyalty;
-	uint production;
-	std::vector<Building> buildings;
-	std::vector<PokemonCapture> captures;
-	std::vector<Unit> units;
-	std::vector<Troop> troops;
-
-	int get_building_lv(BuildingType type, int slot = -1)
-	{
-		if (slot != -1)
-			return buildings[slot].lv;
-		for (auto& building : buildings)
-		{
-			if (building.type == type)
-				return building.lv;
-		}
-		return -1;
-	}
-
-	void add_capture_ll(uint unit_id, uint exclusive_id, uint lv, uint cost_gold)
-	{
-		auto& unit_data = unit_datas[unit_id];
-		PokemonCapture capture;
-		capture.unit_id = unit_id;
-		capture.exclusive_id = exclusive_id;
-		capture.lv = lv;
-		capture.cost_gold = cost_gold;
-
-		captures.push_back(capture);
-	}
-
-	void add_capture(uint unit_id, uint lv, uint cost_gold)
-	{
-		add_capture_ll(unit_id, 0, lv, cost_gold);
-	}
-
-	void add_exclusive_captures(const std::vector<uint>& unit_ids, uint exclusive_id, uint lv, uint cost_gold)
-	{
-		for (auto unit_id : unit_ids)
-			add_capture_ll(unit_id, exclusive_id, lv, cost_gold);
-	}
-
-	void add_unit(uint unit_id, uint lv)
-	{
-		auto& unit_data = unit_datas[unit_id];
-
-		Unit unit;
-		unit.id = unit_id;
-		unit.lv = lv;
-		unit.exp = calc_exp(lv);
-		unit.learn_skills();
-		{
-			auto n = 0;
-			for (auto it = unit.learnt_skills.rbegin(); it != unit.learnt_skills.rend(); it++)
-			{
-				if (n >= 4)
-					break;
-				unit.skills[n] = *it;
-				n++;
-			}
-		}
-
-		units.push_back(unit);
-
-		troops.front().units.push_back(units.size() - 1);
-	}
-
-	void set_troop_target(Troop& troop, uint target)
-	{
-		troop.target = target;
-		troop.path = find_path(tile_id, target);
-	}
-};
-
-struct TroopInstance
-{
-	uint lord_id;
-	uint city_id;
-	uint id;
-	std::vector<UnitInstance> units;
-	std::vector<uint> path;
-	uint path_idx = 0;
-	uint moved_flip = 0;
-	vec2 pos;
-	uint defeat_gain_exp = 0;
-};
-
-struct BuildingSlot
-{
-	vec2 pos;
-	float radius;
-	BuildingType type;
-};
-std::vector<BuildingSlot> building_slots;
-
-enum ChestType
-{
-	ChestGold,
-	ChestProduction
-};
-
-struct Chest
-{
-	ChestType type;
-	uint value;
-};
-
-struct NeutralCamp
-{
-	uint tile_id;
-	std::vector<UnitInstance> units;
-	Chest chest;
-	uint defeat_gain_exp;
-};
-std::vector<NeutralCamp> neutral_camps;
-
-struct NeutralUnit
+void step_battle()
 {
-	uint id;
-	uint lv;
-	int skills[4] = { -1, -1, -1, -1 };
+	if (anim_remain > 0.f)
+		return;
+	anim_remain = 0.5f * anim_time_scaling;
 
-	void learn_skills()
+	if (is_unit_battle())
 	{
-		auto& unit_data = unit_datas[id];
-		auto n = 0;
-		for (auto it = unit_data.skillset.rbegin(); it != unit_data.skillset.rend(); it++)
+		BattleEvent event;
+		auto has_event = battle_sim.step(event);
+		auto check_event = [&]() {
+			if (replay_diverged_at == -1 && (replay_event_idx >= replay_source.events.size() || !is_same_event(event, replay_source.events[replay_event_idx])))
+				replay_diverged_at = replay_event_idx;
+		};
+		// replays asked for by the player are always played through, they are asked for to be watched
+		if (turbo && replaying_night_battle)
 		{
-			if (it->first <= lv)
+			while (has_event)
 			{
-				skills[n] = it->second;
-				n++;
-				if (n >= 4)
-					break;
+				check_event();
+				replay_event_idx++;
+				has_event = battle_sim.step(event);
 			}
 		}
-	}
-};
-
-bool add_neutral_camp(uint tile_id, const std::vector<NeutralUnit>& units, ChestType chest_type, uint chest_value)
-{
-	auto& tile = tiles[tile_id];
-	if (tile.type != TileField)
-		return false;
-
-	NeutralCamp camp;
-	camp.tile_id = tile_id;
-	camp.units.resize(units.size());
-	for (auto i = 0; i < units.size(); i++)
-	{
-		auto& unit = units[i];
-		camp.units[i].init(unit.id, unit.lv, unit.skills);
-		camp.defeat_gain_exp += calc_gain_exp(unit.lv);
-	}
-	camp.chest.type = chest_type;
-	camp.chest.value = chest_value;
-
-	tile.type = TileNeutralCamp;
-	tile.idx1 = neutral_camps.size();
-
-	neutral_camps.push_back(camp);
-	return true;
-}
-
-const wchar_t* get_resource_field_name(ResourceType type)
-{
-	switch (type)
-	{
-	case ResourceWood: return L"Woodcutter";
-	case ResourceClay: return L"Clay Pit";
-	case ResourceIron: return L"Iron Mine";
-	case ResourceCrop: return L"Crop Field";
-	}
-	return L"";
-}
-
-struct ResourceField
-{
-	uint tile_id;
-	uint lv;
-	ResourceType type;
-	uint production;
-};
-
-struct ResourceFieldData
-{
-	uint cost_wood;
-	uint cost_clay;
-	uint cost_iron;
-	uint cost_crop;
-	uint cost_gold;
-	uint cost_population;
-	uint production;
-
-	void read(Sheet::Row& row, SheetPtr sht)
-	{
-		cost_wood = sht->get_as<uint>(row, "cost_wood"_h);
-		cost_clay = sht->get_as<uint>(row, "cost_clay"_h);
-		cost_iron = sht->get_as<uint>(row, "cost_iron"_h);
-		cost_crop = sht->get_as<uint>(row, "cost_crop"_h);
-		cost_gold = sht->get_as<uint>(row, "cost_gold"_h);
-		cost_population = sht->get_as<uint>(row, "cost_population"_h);
-		production = sht->get_as<uint>(row, "production"_h);
-	}
-};
-
-std::vector<ResourceFieldData> resource_field_datas[ResourceTypeCount];
-
-struct BattlePlayer
-{
-	struct UnitDisplay
-	{
-		uint unit_id;
-		vec2 init_pos;
-		vec2 pos; float ang; vec2 scl; float alpha;
-		uint HP;
-		std::wstring label;
-		vec2 label_pos; float label_ang; vec2 label_scl; float label_alpha;
-	};
-
-	uint side;
-	TroopInstance*	troop = nullptr;
-	City*			city = nullptr;
-	NeutralCamp*	camp = nullptr;
-	std::vector<UnitDisplay> unit_displays;
-
-	std::vector<UnitInstance>& get_units()
-	{
-		if (troop)
-			return troop->units;
-		return camp->units;
-	}
-
-	void refresh_display()
-	{
-		if (!troop && !camp)
-			return;
-		auto& units = get_units();
-		unit_displays.resize(units.size());
-		for (auto i = 0; i < units.size(); i++)
-		{
-			auto& unit = units[i];
-			auto& display = unit_displays[i];
-			display.unit_id = unit.id;
-			display.init_pos = vec2(136.f + i * 75.f, 240.f + 100.f * (1 - side));
-			display.HP = unit.stats[StatHP];
-			display.pos = display.init_pos;
-			display.scl = vec3(1.f);
-			display.alpha = 1.f;
-		}
-	}
-};
-
-struct Lord
-{
-	uint id;
-
-	uint resources[ResourceTypeCount];
-	uint provide_population;
-	uint consume_population;
-
-	std::vector<City> cities;
-	std::vector<uint> territories;
-	std::vector<ResourceField> resource_fields;
-
-	std::vector<TroopInstance> troop_instances;
-
-	void update_territories()
-	{
-		territories.clear();
-		for (auto id = 0; id < tiles.size(); id++)
-		{
-			auto tile_pos = tiles[id].pos;
-			auto ok = false;
-			for (auto& city : cities)
-			{
-				if (distance(tiles[city.tile_id].pos, tile_pos) < tile_sz * 1.5f)
-				{
-					ok = true;
-					break;
-				}
-			}
-			if (ok)
-				territories.push_back(id);
-		}
-	}
-
-	bool has_territory(uint tile_id)
-	{
-		for (auto& t : territories)
-		{
-			if (t == tile_id)
-				return true;
-		}
-		return false;
-	}
-
-	int find_resource_field(uint tile_id)
-	{
-		for (auto i = 0; i < resource_fields.size(); i++)
-		{
-			if (resource_fields[i].tile_id == tile_id)
-				return i;
-		}
-		return -1;
-	}
-
-	int find_city(uint tile_id)
-	{
-		for (auto i = 0; i < cities.size(); i++)
-		{
-			if (cities[i].tile_id == tile_id)
-				return i;
-		}
-		return -1;
-	}
-
-	bool build_resource_field(uint tile_id, ResourceType type, bool free = false)
-	{
-		auto& tile = tiles[tile_id];
-		if (tile.type != TileField)
-			return false;
-
-		if (resource_field_datas[type].empty())
-			return false;
-
-		auto& first_level = resource_field_datas[type].front();
-
-		if (!free)
-		{
-			if (resources[ResourceWood] < first_level.cost_wood ||
-				resources[ResourceClay] < first_level.cost_clay ||
-				resources[ResourceIron] < first_level.cost_iron ||
-				resources[ResourceCrop] < first_level.cost_crop ||
-				resources[ResourceGold] < first_level.cost_gold ||
-				provide_population < consume_population + first_level.cost_population)
-				return false;
-
-			resources[ResourceWood] -= first_level.cost_wood;
-			resources[ResourceClay] -= first_level.cost_clay;
-			resources[ResourceIron] -= first_level.cost_iron;
-			resources[ResourceCrop] -= first_level.cost_crop;
-			resources[ResourceGold] -= first_level.cost_gold;
-			consume_population += first_level.cost_population;
-		}
-
-		ResourceField resource_field;
-		resource_field.tile_id = tile_id;
-		resource_field.lv = 1;
-		resource_field.type = type;
-		resource_field.production = first_level.production;
-
-		tile.type = TileResourceField;
-		tile.idx1 = id;
-		tile.idx2 = resource_fields.size();
-
-		resource_fields.push_back(resource_field);
-
-		return true;
-	}
-
-	bool build_city(uint tile_id)
-	{
-		auto& tile = tiles[tile_id];
-		if (tile.type != TileField)
-			return false;
-
-		City city;
-		city.id = cities.size();
-		city.tile_id = tile_id;
-		city.lord_id = id;
-		city.loyalty = 30;
-		city.production = 0;
-		city.buildings.resize(building_slots.size());
-		for (auto i = 0; i < building_slots.size(); i++)
-		{
-			auto type = building_slots[i].type;
-			auto& building = city.buildings[i];
-			building.slot = i;
-			building.type = type;
-		}
-		upgrade_building(city, 0, BuildingTownCenter, true);
-
-		city.add_exclusive_captures({ 0, 3, 6 }, "heros"_h, 5, 200);
-		auto& troop = city.troops.emplace_back();
-		city.set_troop_target(troop, tile_id);
-
-		city.add_unit(find_unit(L"City Defense 1"), 50);
-
-		tile.type = TileCity;
-		tile.idx1 = id;
-		tile.idx2 = cities.size();
-
-		cities.push_back(city);
-		update_territories();
-		return true;
-	}
-
-	bool upgrade_resource_field(ResourceField& resource_field, bool free = false)
-	{
-		if (resource_field_datas[resource_field.type].size() <= resource_field.lv)
-			return false;
-
-		auto& next_level = resource_field_datas[resource_field.type][resource_field.lv];
-
-		if (!free)
-		{
-			if (resources[ResourceWood] < next_level.cost_wood ||
-				resources[ResourceClay] < next_level.cost_clay ||
-				resources[ResourceIron] < next_level.cost_iron ||
-				resources[ResourceCrop] < next_level.cost_crop ||
-				resources[ResourceGold] < next_level.cost_gold ||
-				provide_population < consume_population + next_level.cost_population)
-				return false;
-
-			resources[ResourceWood] -= next_level.cost_wood;
-			resources[ResourceClay] -= next_level.cost_clay;
-			resources[ResourceIron] -= next_level.cost_iron;
-			resources[ResourceCrop] -= next_level.cost_crop;
-			resources[ResourceGold] -= next_level.cost_gold;
-			consume_population += next_level.cost_population;
-		}
-
-		resource_field.lv++;
-		resource_field.production = next_level.production;
-
-		return true;
-	}
-
-	bool upgrade_building(City& city, uint slot, BuildingType type, bool free = false)
-	{
-		auto& building = city.buildings[slot];
-		if (type == BuildingTypeCount)
-			type = building.type;
-
-		if (!free)
-		{
-			if (auto base_data = get_building_base_data(type, building.lv); base_data)
-			{
-				if (/*resources[ResourceWood] < base_data->cost_wood ||
-					resources[ResourceClay] < base_data->cost_clay ||
-					resources[ResourceIron] < base_data->cost_iron ||
-					resources[ResourceCrop] < base_data->cost_crop ||
-					resources[ResourceGold] < base_data->cost_gold ||
-					provide_population < consume_population + base_data->cost_population ||*/
-					city.production < base_data->cost_production)
-					return false;
-
-				//resources[ResourceWood] -= base_data->cost_wood;
-				//resources[ResourceClay] -= base_data->cost_clay;
-				//resources[ResourceIron] -= base_data->cost_iron;
-				//resources[ResourceCrop] -= base_data->cost_crop;
-				//resources[ResourceGold] -= base_data->cost_gold;
-				//consume_population += base_data->cost_population;
-				city.production -= base_data->cost_production;
-			}
-		}
-
-		building.type = type;
-
-		switch (building.type)
-		{
-		case BuildingHouse:
-		{
-			auto& data = house_datas[building.lv];
-			//if (building.lv > 0)
-			//	provide_population -= house_datas[building.lv - 1].provide_population;
-			//provide_population += data.provide_population;
-		}
-			break;
-		}
-		building.lv++;
-
-		return true;
-	}
-
-	bool buy_unit(City& city, uint capture_id)
-	{
-		auto& capture = city.captures[capture_id];
-		auto& unit_data = unit_datas[capture.unit_id];
-		if (resources[ResourceGold] < capture.cost_gold/* ||
-			provide_population < consume_population + unit_data.cost_population*/)
-			return false;
-
-		resources[ResourceGold] -= capture.cost_gold;
-		//consume_population += unit_data.cost_population;
-
-		city.add_unit(capture.unit_id, capture.lv);
-
-		auto exclusive_id = capture.exclusive_id;
-		if (exclusive_id != 0)
-		{
-			for (auto it = city.captures.begin(); it != city.captures.end();)
-			{
-				if (it->exclusive_id == exclusive_id)
-					it = city.captures.erase(it);
-				else
-					it++;
-			}
-		}
-		else
-			city.captures.erase(city.captures.begin() + capture_id);
-	}
-
-	uint get_production(ResourceType type)
-	{
-		uint ret = 0;
-		for (auto& field : resource_fields)
-		{
-			if (field.type == type)
-				ret += field.production;
-		}
-		return ret;
-	}
-};
-std::vector<Lord> lords;
-uint main_player_id = 0;
-
-int add_lord(uint tile_id)
-{
-	Lord lord;
-	lord.id = lords.size();
-
-	//lord.resources[ResourceWood] = 800;
-	//lord.resources[ResourceClay] = 800;
-	//lord.resources[ResourceIron] = 800;
-	//lord.resources[ResourceCrop] = 800;
-	lord.resources[ResourceGold] = 300;
-	//lord.provide_population = 10;
-	lord.consume_population = 0;
-
-	lord.build_city(tile_id);
-
-	auto id = lords.size();
-	lords.push_back(lord);
-	return id;
-}
-
-int search_lord_location()
-{
-	std::vector<uint> candidates;
-	for (auto i = 0; i < tiles.size(); i++)
-	{
-		auto& tile = tiles[i];
-		if (tile.type == TileField)
-		{
-			if (tile.x > 0 && tile.y > 0 && tile.x < tile_cx - 1 && tile.y < tile_cy - 1)
-			{
-				auto ok = true;
-				for (auto& lord : lords)
-				{
-					for (auto& city : lord.cities)
-					{
-						if (distance(tiles[city.tile_id].pos, tile.pos) < tile_sz * 4.5f)
-						{
-							ok = false;
-							break;
-						}
-					}
-				}
-				if (ok)
-					candidates.push_back(i);
-			}
-		}
-	}
-	if (candidates.empty())
-		return -1;
-	auto idx = linearRand(0, (int)candidates.size() - 1);
-	return candidates[idx];
-}
-
-int search_neutral_camp_location()
-{
-	std::vector<uint> candidates;
-	for (auto i = 0; i < tiles.size(); i++)
-	{
-		auto& tile = tiles[i];
-		if (tile.type == TileField)
-			candidates.push_back(i);
-	}
-	if (candidates.empty())
-		return -1;
-	auto idx = linearRand(0, (int)candidates.size() - 1);
-	return candidates[idx];
-}
-
-City* search_random_hostile_city(uint lord_id)
-{
-	if (lords.size() < 2)
-		return nullptr;
-
-	std::vector<uint> candidates;
-	for (auto i = 0; i < lords.size(); i++)
-	{
-		if (i != lord_id)
-			candidates.push_back(i);
-	}
-	auto& target_lord = lords[candidates[linearRand(0, (int)candidates.size() - 1)]];
-	if (target_lord.cities.empty())
-		return nullptr;
-	return &target_lord.cities[linearRand(0, (int)target_lord.cities.size() - 1)];
-}
-
-cvec4 hsv(float h, float s, float v, float a)
-{
-	return cvec4(vec4(rgbColor(vec3(h, s, v)), a) * 255.f);
-}
-
-GameState state = GameInit;
-bool game_over = false;
-bool victory = false;
-bool show_result = false;
-BattlePlayer battle_players[2];
-std::vector<int> battle_action_list;
-std::vector<std::wstring> battle_log;
-uint city_damge = 0;
-float troop_anim_time = 0.f;
-float anim_remain = 0;
-float anim_time_scaling = 1.f;
-uint exp_multiplier = 1;
-uint damage_multiplier = 1;
-uint city_damage_multiplier = 1;
-
-void new_day()
-{
-	if (state == GameDay)
-		return;
-	state = GameDay;
-
-	for (auto& lord : lords)
-	{
-		lord.troop_instances.clear();
-
-		for (auto& city : lord.cities)
-		{
-			city.production += 1;
-
-			std::vector<uint> training_exps;
-
-			for (auto& building : city.buildings)
-			{
-				switch (building.type)
-				{
-				case BuildingHouse:
-				{
-					if (building.lv > 0)
-					{
-						auto& house_data = house_datas[building.lv - 1];
-						lord.resources[ResourceGold] += house_data.gold_production;
-					}
-				}
-					break;
-				case BuildingPark:
-				{
-					if (building.lv > 0)
-					{
-						auto& park_data = park_datas[building.lv - 1];
-						for (auto i = 0; i < park_data.capture_num; i++)
-							city.add_capture(weighted_random(park_data.encounter_list), 5, 100);
-					}
-				}
-					break;
-				case BuildingTrainingMachine:
-				{
-					if (building.lv > 0)
-					{
-						auto& machine_data = training_machine_datas[building.lv - 1];
-						training_exps.push_back(machine_data.exp);
-					}
-				}
-					break;
-				}
-			}
-
-			std::sort(training_exps.begin(), training_exps.end(), [](const auto& a, const auto& b) {
-				return a > b;
-			});
-
-			auto& city_units = city.troops.front().units;
-			auto n = min((int)training_exps.size(), (int)city_units.size());
-			for (auto i = 0; i < n; i++)
-			{
-				auto& unit = city.units[city_units[i]];
-				unit.gain_exp += training_exps[i];
-			}
-		}
-	}
-
-	// do ai for all computer players
-	for (auto i = 1; i < lords.size(); i++)
-	{
-		auto& lord = lords[i];
-
-		for (auto& city : lord.cities)
-		{
-			while (true)
-			{
-				std::vector<std::pair<uint, uint>> cands;
-				auto get_weight = [&](BuildingType type) {
-					auto ret = 1;
-					switch (type)
-					{
-					case BuildingHouse:
-						if (lord.resources[ResourceGold] < 100)
-							ret = 100;
-						break;
-					case BuildingTrainingMachine:
-						ret = 0;
-						break;
-					}
-					return ret;
-				};
-				for (auto i = 0; i < building_slots.size(); i++)
-				{
-					auto& slot = building_slots[i];
-					if (slot.type == BuildingTypeCount)
-					{
-						for (int j = BuildingInTownBegin; j <= BuildingInTownEnd; j++)
-						{
-							if (j == BuildingTownCenter)
-								continue;
-							if (auto base_data = get_building_base_data((BuildingType)j, 0); base_data)
-							{
-								auto cost_production = base_data->cost_production;
-								if (cost_production <= city.production)
-									cands.emplace_back(i * 100 + j, get_weight((BuildingType)j));
-							}
-						}
-					}
-					else
-					{
-						auto& building = city.buildings[i];
-						if (auto base_data = get_building_base_data(building.type, building.lv); base_data)
-						{
-							auto cost_production = base_data->cost_production;
-							if (cost_production <= city.production)
-								cands.emplace_back(i * 100, get_weight(building.type));
-						}
-					}
-				}
-				if (cands.empty())
-					break;
-				auto sel = weighted_random(cands);
-				auto i = sel / 100;
-				auto j = sel % 100;
-				auto& slot = building_slots[i];
-				if (slot.type == BuildingTypeCount)
-					lord.upgrade_building(city, i, (BuildingType)j);
-				else
-					lord.upgrade_building(city, i, slot.type);
-			}
-
-			while (true)
-			{
-				std::vector<uint> cands;
-				for (auto i = 0; i < city.captures.size(); i++)
-				{
-					if (city.captures[i].cost_gold <= lord.resources[ResourceGold])
-						cands.push_back(i);
-				}
-				if (cands.empty())
-					break;
-				auto i = cands[linearRand(0, (int)cands.size() - 1)];
-				lord.buy_unit(city, i);
-			}
-
-			if (auto target_city = search_random_hostile_city(lord.id); target_city)
-			{
-				city.troops.front().units.clear();
-				city.troops.resize(2);
-
-				auto& troop = city.troops[1];
-				troop.units.clear();
-				for (auto i = 1; i < city.units.size(); i++)
-					troop.units.push_back(i);
-				city.set_troop_target(troop, target_city->tile_id);
-			}
-		}
-	}
-}
-
-void start_battle()
-{
-	if (state == GameNight)
-		return;
-	state = GameNight;
-
-	for (auto& lord : lords)
-	{
-		for (auto& city : lord.cities)
-		{
-			city.captures.clear();
-			for (auto& unit : city.units)
-				unit.gain_exp = 0;
-
-			for (auto i = 0; i < city.troops.size(); i++)
-			{
-				auto& troop = city.troops[i];
-				TroopInstance troop_ins;
-				troop_ins.lord_id = lord.id;
-				troop_ins.city_id = city.id;
-				troop_ins.id = i;
-				troop_ins.path = troop.path;
-				troop_ins.pos = tiles[troop_ins.path.front()].pos + vec2(tile_sz) * 0.5f;
-				for (auto idx : troop.units)
-				{
-					auto& unit = city.units[idx];
-					UnitInstance unit_ins;
-					unit_ins.init(unit);
-					troop_ins.units.push_back(unit_ins);
-					troop_ins.defeat_gain_exp += calc_gain_exp(unit.lv);
-				}
-				lord.troop_instances.push_back(troop_ins);
-			}
-		}
-	}
-}
-
-void step_troop_moving()
-{
-	if (anim_remain > 0.f)
-		return;
-	anim_remain = 0.5f * anim_time_scaling;
-
-	for (auto& lord : lords)
-	{
-		for (auto it = lord.cities.begin(); it != lord.cities.end(); )
-		{
-			if (it->loyalty == 0)
-			{
-				auto& tile = tiles[it->tile_id];
-				tile.type = TileField;
-				tile.idx1 = tile.idx2 = -1;
-				it = lord.cities.erase(it);
-
-				for (auto& _lord : lords)
-				{
-					for (auto& _city : _lord.cities)
-					{
-						for (auto it2 = _city.troops.begin(); it2 != _city.troops.end(); )
-						{
-							if (it2->target == tile.id)
-								it2 = _city.troops.erase(it2);
-							else
-								it2++;
-						}
-					}
-				}
-			}
-			else
-				it++;
-		}
-	}
-
-	for (auto it = neutral_camps.begin(); it != neutral_camps.end();)
-	{
-		if (it->units.empty())
-		{
-			auto& tile = tiles[it->tile_id];
-			tile.type = TileField;
-			tile.idx1 = tile.idx2 = -1;
-			it = neutral_camps.erase(it);
-		}
-		else
-			it++;
-	}
-
-	auto no_troops = true;
-	for (auto& lord : lords)
-	{
-		if (lord.troop_instances.size() > 1)
-		{
-			no_troops = false;
-			break;
-		}
-	}
-	if (no_troops)
-	{
-		if (lords[main_player_id].cities.empty())
-		{
-			game_over = true;
-			victory = false;
-		}
-		else
-		{
-			auto no_opponents = true;
-			for (auto i = 0; i < lords.size(); i++)
-			{
-				if (i != main_player_id)
-				{
-					if (!lords[i].cities.empty())
-						no_opponents = false;
-					break;
-				}
-			}
-			if (no_opponents)
-			{
-				game_over = true;
-				victory = true;
-			}
-		}
-		if (!game_over)
-			show_result = true;
-		new_day();
-		return;
-	}
-
-	for (auto i = 0; i < lords.size(); i++)
-	{
-		auto& lord = lords[i];
-		for (auto j = 0; j < lord.troop_instances.size(); j++)
-		{
-			auto& troop = lord.troop_instances[j];
-			for (auto ii = i + 1; ii < lords.size(); ii++)
-			{
-				auto& _lord = lords[ii];
-				for (auto jj = 0; jj < _lord.troop_instances.size(); jj++)
-				{
-					auto& _troop = _lord.troop_instances[jj];
-					if (troop.lord_id != _troop.lord_id && troop.path[troop.path_idx] == _troop.path[_troop.path_idx])
-					{
-						if (!troop.units.empty() && !_troop.units.empty())
-						{
-							state = GameBattle;
-							{
-								auto& player = battle_players[0];
-								player.troop = &troop;
-								player.refresh_display();
-							}
-							{
-								auto& player = battle_players[1];
-								player.troop = &_troop;
-								player.refresh_display();
-							}
-							battle_action_list.clear();
-							battle_log.clear();
-							return;
-						}
-					}
-				}
-			}
-		}
-	}
-
-	for (auto& lord : lords)
-	{
-		for (auto& troop : lord.troop_instances)
-		{
-			if (troop.path_idx == troop.path.size() - 1)
-			{
-				auto tile_id = troop.path.back();
-				auto& tile = tiles[tile_id];
-				if (tile.type == TileCity && tile.idx1 != troop.lord_id)
-				{
-					auto& city = lords[tile.idx1].cities[tile.idx2];
-					state = GameBattle;
-					{
-						auto& player = battle_players[0];
-						player.city = &city;
-						player.unit_displays.clear();
-					}
-					{
-						auto& player = battle_players[1];
-						player.troop = &troop;
-						player.refresh_display();
-					}
-					battle_action_list.clear();
-					battle_log.clear();
-					return;
-				}
-				else if (tile.type == TileNeutralCamp)
-				{
-					state = GameBattle;
-
-					auto& camp = neutral_camps[tile.idx1];
-					{
-						auto& player = battle_players[0];
-						player.camp = &camp;
-						player.refresh_display();
-					}
-					{
-						auto& player = battle_players[1];
-						player.troop = &troop;
-						player.refresh_display();
-					}
-					battle_action_list.clear();
-					battle_log.clear();
-					return;
-				}
-			}
-		}
-	}
-
-	static int move_flip = 0;
-	{
-		auto found = false;
-		auto not_found = false;
-	b:
-		for (auto& lord : lords)
-		{
-			for (auto& troop : lord.troop_instances)
-			{
-				if (troop.path.size() > 1)
-				{
-					if (troop.path_idx < troop.path.size() - 1)
-					{
-						if (troop.moved_flip != move_flip)
-						{
-							troop.moved_flip = move_flip;
-							auto tween = sTween::instance();
-							auto id = tween->begin_2d_targets();
-							tween->add_2d_target(id, &troop.pos, nullptr, nullptr, nullptr);
-							tween->move_to(id, tiles[troop.path[troop.path_idx + 1]].pos + vec2(tile_sz) * 0.5f, 0.48f);
-							tween->set_callback(id, [&]() {
-								troop.path_idx++;
-							});
-							tween->end(id);
-							found = true;
-						}
-					}
-				}
-				if (found)
-					break;
-			}
-			if (found)
-				break;
-		}
-		if (!found)
-		{
-			if (!not_found)
-			{
-				not_found = true;
-				move_flip = 1 - move_flip;
-				goto b;
-			}
-		}
-	}
-}
-
-void step_battle()
-{
-	if (anim_remain > 0.f)
-		return;
-	anim_remain = 0.5f * anim_time_scaling;
-
-	if ((battle_players[0].troop || battle_players[0].camp) && battle_players[1].troop)
-	{
-		// remove dead units
-		for (auto i = 0; i < 2; i++)
-		{
-			auto& units = battle_players[i].get_units();
-			for (auto j = 0; j < units.size(); j++)
-			{
-				auto& unit = units[j];
-				if (unit.stats[StatHP] <= 0)
-				{
-					for (auto it = battle_action_list.begin(); it != battle_action_list.end(); )
-					{
-						auto v = *it;
-						if (v / 100 == i)
-						{
-							v = v % 100;
-							if (v == j)
-								it = battle_action_list.erase(it);
-							else if (v > j)
-							{
-								*it = i * 100 + (v - 1);
-								it++;
-							}
-							else
-								it++;
-						}
-						else
-							it++;
-					}
-					units.erase(units.begin() + j);
-					j--;
-				}
-			}
-		}
-
-		auto& units0 = battle_players[0].get_units();
-		auto& units1 = battle_players[1].get_units();
-		if (units0.empty() || units1.empty())
-		{
-			auto calc_exp_for_winner = [](BattlePlayer& winner, BattlePlayer& loser) {
-				auto exp = loser.troop ? loser.troop->defeat_gain_exp : loser.camp->defeat_gain_exp;
-				auto& win_troop_city = lords[winner.troop->lord_id].cities[winner.troop->city_id];
-				auto& original_win_troop = win_troop_city.troops[winner.troop->id];
-				exp /= original_win_troop.units.size();
-				exp *= exp_multiplier;
-				for (auto idx : original_win_troop.units)
-					win_troop_city.units[idx].gain_exp += exp;
-			};
-			if (units0.empty() && !units1.empty() && battle_players[1].troop)
-				calc_exp_for_winner(battle_players[1], battle_players[0]);
-			else if (!units0.empty() && units1.empty() && battle_players[0].troop)
-				calc_exp_for_winner(battle_players[0], battle_players[1]);
-
-			for (auto i = 0; i < 2; i++)
-			{
-				auto& player = battle_players[i];
-				if (player.troop && player.troop->id != 0 && player.troop->units.empty())
-				{
-					auto& lord = lords[player.troop->lord_id];
-					lord.troop_instances.erase(lord.troop_instances.begin() + player.troop->id);
-				}
-			}
-			state = GameNight;
-			battle_players[0].troop = battle_players[1].troop = nullptr;
-			battle_players[0].camp = nullptr;
-			return;
-		}
-
-		for (auto i = 0; i < 2; i++)
-			battle_players[i].refresh_display();
-
-		if (battle_action_list.empty())
-		{
-			std::vector<std::pair<uint, uint>> list;
-			for (auto i = 0; i < 2; i++)
-			{
-				auto& units = battle_players[i].get_units();
-				for (auto j = 0; j < units.size(); j++)
-				{
-					auto& unit = units[j];
-					list.emplace_back(i * 100 + j, unit.stats[StatSP]);
-				}
-			}
-			std::sort(list.begin(), list.end(), [](const auto& a, const auto& b) {
-				return a.second > b.second;
-			});
-			battle_action_list.resize(list.size());
-			for (auto i = 0; i < battle_action_list.size(); i++)
-				battle_action_list[i] = list[i].first;
-		}
-
-		auto idx = battle_action_list.front();
-		auto side = idx / 100;
-		idx = idx % 100;
-		auto& action_player = battle_players[side];
-		auto& action_units = action_player.get_units();
-		auto& opponent_player = battle_players[1 - side];
-		auto& opponent_units = opponent_player.get_units();
-		auto& caster = action_units[idx];
-		auto& caster_unit_data = unit_datas[caster.id];
-		auto target_idx = linearRand(0, (int)opponent_units.size() - 1);
-		auto& target = opponent_units[target_idx];
-		auto& target_unit_data = unit_datas[target.id];
-		auto& cast_unit_display = action_player.unit_displays[idx];
-		auto& target_unit_display = opponent_player.unit_displays[target_idx];
-
-		if (auto skill_id = caster.choose_skill(target); skill_id != -1)
-		{
-			auto& skill_data = skill_datas[skill_id];
-
-			uint damage = 0;
-			StatChange caster_stat_change;
-			StatChange target_stat_change;
-
-			auto result = cast_skill(caster, target, skill_id, damage, caster_stat_change, target_stat_change);
-			if (damage_multiplier > 1)
-				damage *= damage_multiplier;
-
-			{
-				auto id = game.tween->begin_2d_targets();
-				game.tween->add_2d_target(id, &cast_unit_display.pos, nullptr, &cast_unit_display.scl, nullptr);
-				game.tween->add_2d_target(id, nullptr, nullptr, nullptr, &target_unit_display.alpha);
-				game.tween->add_2d_target(id, &target_unit_display.label_pos, nullptr, nullptr, nullptr);
-				game.tween->add_int_target(id, (int*)&target_unit_display.HP);
-				game.tween->scale_to(id, vec2(1.5f), 0.3f * anim_time_scaling);
-				auto target_pos = mix(cast_unit_display.pos, target_unit_display.pos, 0.8f);
-				game.tween->move_to(id, target_pos, 0.3f * anim_time_scaling);
-				game.tween->set_ease(id, EaseInCubic);
-				auto time_cast = game.tween->get_time(id);
-
-				game.tween->set_target(id, 2);
-				game.tween->set_channel(id, 2, time_cast);
-				std::wstring caster_label = L"";
-				std::wstring target_label = L"";
-				std::wstring log = L"";
-				log = std::format(L"{} LV{} cast {} to {} LV{}", caster_unit_data.name, caster.lv, skill_data.name, target_unit_data.name, target.lv);
-				if (result == SkillMiss)
-				{
-					target_label = L"Miss";
-					log += L", missed";
-				}
-				if (result == SkillNoEffect)
-				{
-					target_label = L"No Effect";
-					log += L", no effect";
-				}
-				if (damage > 0)
-				{
-					target_label = wstr(damage);
-					log += std::format(L", inflicted {} damage", damage);
-				}
-				if (target_stat_change.changed)
-				{
-					for (auto i = (int)StatATK; i < StatCount; i++)
-					{
-						if (auto v = target_stat_change.stage[i]; v != 0)
-						{
-							if (!target_label.empty())
-								target_label += L"\n";
-							auto stage = target.stat_stage[i];
-							auto new_val = clamp(stage + v, -6, +6);
-							if (stage != new_val)
-							{
-								switch (new_val - stage)
-								{
-								case -1:
-								{
-									auto str = std::format(L"{} fell", get_stat_name((Stat)i));;
-									target_label += str;
-									log += L", target " + str;
-								}
-									break;
-								case -2:
-								{
-									auto str = std::format(L"{} harshly fell", get_stat_name((Stat)i));
-									target_label += str;
-									log += L", target " + str;
-								}
-									break;
-								case +1:
-								{
-									auto str = std::format(L"{} rose", get_stat_name((Stat)i));
-									target_label += str;
-									log += L", target " + str;
-								}
-									break;
-								case +2:
-								{
-									auto str = std::format(L"{} rose sharply", get_stat_name((Stat)i));
-									target_label += str;
-									log += L", target " + str;
-								}
-									break;
-								}
-							}
-							else
-							{
-								if (v < 0)
-								{
-									auto str = std::format(L"{} won't go any lower", get_stat_name((Stat)i));
-									target_label += str;
-									log += L", target " + str;
-								}
-								if (v > 0)
-								{
-									auto str = std::format(L"{} won't go any higher", get_stat_name((Stat)i));
-									target_label += str;
-									log += L", target " + str;
-								}
-							}
-						}
-					}
-				}
-				game.tween->set_callback(id, [&, target_label, log]() {
-					target_unit_display.label = target_label;
-					target_unit_display.label_pos = target_unit_display.init_pos + vec2(0.f, -45.f);
-					battle_log.push_back(log);
-					if (battle_log.size() > 5)
-						battle_log.erase(battle_log.begin());
-				});
-				game.tween->move_to(id, target_unit_display.init_pos + vec2(0.f, -60.f), 0.4f * anim_time_scaling);
-				game.tween->set_callback(id, [&]() {
-					target_unit_display.label = L"";
-				});
-
-				game.tween->set_target(id, 3);
-				game.tween->set_channel(id, 3, time_cast);
-				game.tween->int_val_to(id, max(0, (int)target.stats[StatHP] - (int)damage), 0.4f * anim_time_scaling);
-
-				if (target.stats[StatHP] <= 0)
-				{
-					game.tween->set_target(id, 1);
-					game.tween->alpha_to(id, 0.f, 0.4f * anim_time_scaling);
-					game.tween->set_ease(id, EaseInCubic);
-				}
-
-				game.tween->set_target(id, 0U);
-				game.tween->set_channel(id, 0, time_cast);
-				game.tween->move_to(id, cast_unit_display.pos, 0.3f * anim_time_scaling);
-				game.tween->set_channel(id, 1, time_cast);
-				game.tween->scale_to(id, vec2(1.f), 0.3f * anim_time_scaling);
-				anim_remain = game.tween->end(id) + 0.1f;
-			}
-
-			if (damage > 0)
-				target.stats[StatHP] = max(0, (int)target.stats[StatHP] - (int)damage);
-			if (caster_stat_change.changed)
-			{
-				auto& unit_data = unit_datas[caster.id];
-				for (auto i = (int)StatATK; i < StatCount; i++)
-				{
-					if (auto v = caster_stat_change.stage[i]; v != 0)
-					{
-						auto& stage = caster.stat_stage[i];
-						auto new_val = clamp(stage + v, -6, +6);
-						if (stage != new_val)
-						{
-							stage = new_val;
-							caster.stats[i] = calc_stat(unit_data.stats[i], caster.lv) * get_stage_modifier(stage);
-						}
-					}
-				}
-			}
-			if (target_stat_change.changed)
-			{
-				auto& unit_data = unit_datas[target.id];
-				for (auto i = (int)StatATK; i < StatCount; i++)
-				{
-					if (auto v = target_stat_change.stage[i]; v != 0)
-					{
-						auto& stage = target.stat_stage[i];
-						auto new_val = clamp(stage + v, -6, +6);
-						if (stage != new_val)
-						{
-							stage = new_val;
-							target.stats[i] = calc_stat(unit_data.stats[i], target.lv) * get_stage_modifier(stage);
-						}
-					}
-				}
-			}
-		}
-
-		battle_action_list.erase(battle_action_list.begin());
-	}
-	else if (battle_players[0].city)
-	{
-		auto& action_player = battle_players[1];
-
-		if (battle_action_list.size() == 1 && battle_action_list[0] == -1)
-		{
-			{
-				auto troop = battle_players[1].troop;
-				auto& lord = lords[troop->lord_id];
-				for (auto it = lord.troop_instances.begin(); it != lord.troop_instances.end(); it++)
-				{
-					if (&*it == troop)
-					{
-						lord.troop_instances.erase(it);
-						break;
-					}
-				}
-			}
-
-			{
-				// each unit that attacked the enemy city will level up
-				auto& troop = *battle_players[1].troop;
-				auto& city = lords[troop.lord_id].cities[troop.city_id];
-				for (auto idx : city.troops[troop.id].units)
-				{
-					auto& unit = city.units[idx];
-					unit.gain_exp += calc_exp(unit.lv + 1);
-				}
-			}
-
-			auto& city = *battle_players[0].city;
-			if (city.loyalty > city_damge)
-				city.loyalty -= city_damge;
-			else
-				city.loyalty = 0;
-			city_damge = 0;
-
-			state = GameNight;
-			battle_players[1].troop = nullptr;
-			battle_players[0].city = nullptr;
-			return;
-		}
-
-		if (battle_action_list.empty())
-		{
-			auto& troop = battle_players[1];
-			battle_action_list.resize(troop.troop->units.size());
-			for (auto i = 0; i < battle_action_list.size(); i++)
-				battle_action_list[i] = i;
-		}
-
-		auto idx = battle_action_list.front() % 100;
-		auto& caster = action_player.troop->units[idx];
-		auto& cast_unit_display = action_player.unit_displays[idx];
-
-		{
-			auto id = game.tween->begin_2d_targets();
-			game.tween->add_2d_target(id, &cast_unit_display.pos, nullptr, &cast_unit_display.scl, nullptr);
-			game.tween->add_2d_target(id, &cast_unit_display.label_pos, nullptr, nullptr, nullptr);
-			game.tween->scale_to(id, vec2(1.1f), 0.2f * anim_time_scaling);
-			auto damage = max(1U, caster.lv / 10);
-			damage *= city_damage_multiplier;
-			game.tween->set_callback(id, [&, damage]() {
-				cast_unit_display.label = wstr(damage);
-				cast_unit_display.label_pos = cast_unit_display.init_pos + vec2(0.f, 5.f);
-			});
-			game.tween->scale_to(id, vec2(1.f), 0.2f * anim_time_scaling);
-			game.tween->set_target(id, 1);
-			game.tween->move_to(id, vec2(450.f, 300.f), 0.5f * anim_time_scaling);
-			game.tween->set_callback(id, [&, damage]() {
-				cast_unit_display.label = L"";
-				city_damge += damage;
-			});
-			game.tween->end(id);
-		}
-
-		battle_action_list.erase(battle_action_list.begin());
-		if (battle_action_list.empty())
-		{
-			battle_action_list = {-1};
-			anim_remain = 1.5f * anim_time_scaling;
-			return;
-		}
-	}
-}
-
-void Game::init()
-{
-	srand(time(0));
-
-	create("Werewolf VS Vampire", uvec2(1280, 720), WindowStyleFrame, false, true, 
-		{ {"mesh_shader"_h, 0} });
-
-	auto root = world->root.get();
-	root->add_component<cNode>();
-	camera = root->add_component<cCamera>();
-
-	renderer->add_render_task(RenderModeShaded, camera, main_window, {}, graphics::ImageLayoutPresent);
-	canvas = renderer->render_tasks.front()->canvas;
-	hud->canvas = canvas;
-
-	Path::set_root(L"assets", L"assets");
-
-	img_target = graphics::Image::get(L"assets/icons/target.png");
-	img_tile_frame = graphics::Image::get(L"assets/HexTilesetv3.png_slices/00.png");
-	img_tile_grass = graphics::Image::get(L"assets/HexTilesetv3.png_slices/01.png");
-	img_tile_castle = graphics::Image::get(L"assets/HexTilesetv3.png_slices/216.png");
-	img_city = graphics::Image::get(L"assets/city.png");
-	img_camp = graphics::Image::get(L"assets/camp.png");
-	img_ground = graphics::Image::get(L"assets/ground.png");
-	imgs_building[BuildingTownCenter] = graphics::Image::get(L"assets/town_center.png");
-	imgs_building[BuildingHouse] = graphics::Image::get(L"assets/house.png");
-	//imgs_building[BuildingBarracks] = graphics::Image::get(L"assets/barracks.png");
-	imgs_building[BuildingPark] = graphics::Image::get(L"assets/park.png");
-	imgs_building[BuildingTower] = graphics::Image::get(L"assets/tower.png");
-	imgs_building[BuildingWall] = graphics::Image::get(L"assets/wall.png");
-	img_resources[ResourceWood] = graphics::Image::get(L"assets/icons/wood.png");
-	img_resources[ResourceClay] = graphics::Image::get(L"assets/icons/clay.png");
-	img_resources[ResourceIron] = graphics::Image::get(L"assets/icons/iron.png");
-	img_resources[ResourceCrop] = graphics::Image::get(L"assets/icons/crop.png");
-	img_resources[ResourceGold] = graphics::Image::get(L"assets/icons/gold.png");
-	img_population = graphics::Image::get(L"assets/icons/population.png");
-	img_production = graphics::Image::get(L"assets/icons/production.png");
-	img_be_hit = graphics::Image::get(L"assets/be_hit.png");
-
-	sp_repeat = graphics::Sampler::get(graphics::FilterLinear, graphics::FilterLinear, false, graphics::AddressRepeat);
-
-	tiles.resize(tile_cx * tile_cy);
-	for (auto y = 0; y < tile_cy; y++)
-	{
-		for (auto x = 0; x < tile_cx; x++)
-		{
-			auto id = y * tile_cx + x;
-			auto& tile = tiles[id];
-			tile.id = id;
-			tile.x = x; tile.y = y;
-			tile.pos = vec2(x * tile_sz * 0.75f, y * tile_sz_y) + vec2(0.f, 36.f);
-			tile.type = TileField;
-			if (x % 2 == 1)
-				tile.pos.y += tile_sz_y * 0.5f;
-			
-			if (x % 2 == 0)
-			{
-				if (x > 0 && y > 0)
-					tile.tile_lt = id - tile_cx - 1;
-				if (x < tile_cx - 1 && y > 0)
-					tile.tile_rt = id - tile_cx + 1;
-				if (x > 0 && y < tile_cy - 1)
-					tile.tile_lb = id - 1;
-				if (x < tile_cx - 1 && y < tile_cy - 1)
-					tile.tile_rb = id + 1;
-			}
-			else
-			{
-				tile.tile_lt = id - 1;
-				if (x < tile_cx - 1)
-					tile.tile_rt = id + 1;
-				if (y < tile_cy - 1)
-					tile.tile_lb = id + tile_cx - 1;
-				if (x < tile_cx - 1 && y < tile_cy - 1)
-					tile.tile_rb = id + tile_cx + 1;
-			}
-
-			if (y > 0)
-				tile.tile_t = id - tile_cx;
-			if (y < tile_cy - 1)
-				tile.tile_b = id + tile_cx;
-		}
-	}
-
-	battle_players[0].side = 0;
-	battle_players[1].side = 1;
-
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonNormal];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		0.5f;
-		effectiveness[PokemonGhost] =		0.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonFire];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		0.5f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		2.f;
-		effectiveness[PokemonIce] =			2.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			2.f;
-		effectiveness[PokemonRock] =		0.5f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		0.5f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		2.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonWater];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		2.f;
-		effectiveness[PokemonWater] =		0.5f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		0.5f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		2.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		2.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		0.5f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		1.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonElectric];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		2.f;
-		effectiveness[PokemonElectric] =	0.5f;
-		effectiveness[PokemonGrass] =		0.5f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		0.f;
-		effectiveness[PokemonFlying] =		2.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		0.5f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		1.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonGrass];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		2.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		0.5f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		0.5f;
-		effectiveness[PokemonGround] =		2.f;
-		effectiveness[PokemonFlying] =		0.5f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			0.5f;
-		effectiveness[PokemonRock] =		2.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		0.5f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonIce];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		0.5f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		2.f;
-		effectiveness[PokemonIce] =			0.5f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		2.f;
-		effectiveness[PokemonFlying] =		2.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		2.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonFighting];
-		effectiveness[PokemonNormal] =		2.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			2.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		0.5f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		0.5f;
-		effectiveness[PokemonPsychic] =		0.5f;
-		effectiveness[PokemonBug] =			0.5f;
-		effectiveness[PokemonRock] =		2.f;
-		effectiveness[PokemonGhost] =		0.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		2.f;
-		effectiveness[PokemonSteel] =		2.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonPoison];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		2.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		0.5f;
-		effectiveness[PokemonGround] =		0.5f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		0.5f;
-		effectiveness[PokemonGhost] =		0.5f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.f;
-		effectiveness[PokemonFairy] =		2.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonGround];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		2.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	2.f;
-		effectiveness[PokemonGrass] =		0.5f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		2.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		0.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			0.5f;
-		effectiveness[PokemonRock] =		2.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		2.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonFlying];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	0.5f;
-		effectiveness[PokemonGrass] =		2.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	2.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			2.f;
-		effectiveness[PokemonRock] =		0.5f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonPsychic];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	2.f;
-		effectiveness[PokemonPoison] =		2.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		0.5f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		0.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonBug];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		2.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	0.5f;
-		effectiveness[PokemonPoison] =		0.5f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		0.5f;
-		effectiveness[PokemonPsychic] =		2.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		0.5f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		2.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		0.5f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonRock];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		2.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			2.f;
-		effectiveness[PokemonFighting] =	0.5f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		0.5f;
-		effectiveness[PokemonFlying] =		2.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			2.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonGhost];
-		effectiveness[PokemonNormal] =		0.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		2.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		2.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		0.5f;
-		effectiveness[PokemonSteel] =		1.f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonDragon];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		2.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		0.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonDark];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		1.f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	0.5f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		2.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		2.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		0.5f;
-		effectiveness[PokemonSteel] =		1.f;
-		effectiveness[PokemonFairy] =		0.5f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonSteel];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		0.5f;
-		effectiveness[PokemonElectric] =	0.5f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			2.f;
-		effectiveness[PokemonFighting] =	1.f;
-		effectiveness[PokemonPoison] =		1.f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		2.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		1.f;
-		effectiveness[PokemonDark] =		1.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		2.f;
-	}
-	{
-		auto effectiveness = pokemon_type_effectiveness[PokemonFairy];
-		effectiveness[PokemonNormal] =		1.f;
-		effectiveness[PokemonFire] =		0.5f;
-		effectiveness[PokemonWater] =		1.f;
-		effectiveness[PokemonElectric] =	1.f;
-		effectiveness[PokemonGrass] =		1.f;
-		effectiveness[PokemonIce] =			1.f;
-		effectiveness[PokemonFighting] =	2.f;
-		effectiveness[PokemonPoison] =		0.5f;
-		effectiveness[PokemonGround] =		1.f;
-		effectiveness[PokemonFlying] =		1.f;
-		effectiveness[PokemonPsychic] =		1.f;
-		effectiveness[PokemonBug] =			1.f;
-		effectiveness[PokemonRock] =		1.f;
-		effectiveness[PokemonGhost] =		1.f;
-		effectiveness[PokemonDragon] =		2.f;
-		effectiveness[PokemonDark] =		2.f;
-		effectiveness[PokemonSteel] =		0.5f;
-		effectiveness[PokemonFairy] =		1.f;
-	}
-
-	if (auto sht = Sheet::get(L"assets/skill.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			SkillData data;
-			auto& row = sht->rows[i];
-			data.name = sht->get_as_wstr(row, "name"_h);
-			data.type = get_pokemon_type_from_name(sht->get_as_wstr(row, "type"_h));
-			data.category = get_skill_category_from_name(sht->get_as_wstr(row, "category"_h));
-			data.power = sht->get_as<uint>(row, "power"_h);
-			data.acc = sht->get_as<uint>(row, "acc"_h);
-			data.pp = sht->get_as<uint>(row, "pp"_h);
-			data.effect_text = sht->get_as_wstr(row, "effect_text"_h);
-			auto effect = sht->get_as_wstr(row, "effect"_h);
-			for (auto t : SUW::split(effect, ';'))
-			{
-				auto sp = SUW::split(t, ',');
-				if (sp.size() > 0)
-				{
-					auto type = get_effect_type_from_name(sp[0]);
-					if (type != EffectTypeCount)
-					{
-						switch (type)
-						{
-						case EffectUserStat:
-							if (sp.size() == 4)
-							{
-								SkillEffect effect;
-								effect.type = type;
-								effect.data.stat.id = get_stat_from_name(sp[1]);
-								effect.data.stat.state = s2t<int>(std::wstring(sp[2]));
-								effect.data.stat.prob = s2t<float>(std::wstring(sp[3]));
-								data.effects.push_back(effect);
-							}
-							break;
-						case EffectOpponentStat:
-							if (sp.size() == 4)
-							{
-								SkillEffect effect;
-								effect.type = type;
-								effect.data.stat.id = get_stat_from_name(sp[1]);
-								effect.data.stat.state = s2t<int>(std::wstring(sp[2]));
-								effect.data.stat.prob = s2t<float>(std::wstring(sp[3]));
-								data.effects.push_back(effect);
-							}
-							break;
-						case EffectStatus:
-
-							break;
-						}
-					}
-				}
-			}
-			if (data.category == SkillCateStatus)
-			{
-				auto no_target = true;
-				for (auto& effect : data.effects)
-				{
-					if (effect.type == EffectOpponentStat)
-					{
-						no_target = false;
-						break;
-					}
-				}
-				if (no_target)
-					data.target_type = TargetSelf;
-			}
-			skill_datas.push_back(data);
-		}
-	}
-	//if (auto sht = Sheet::get(L"assets/units.sht"); sht)
-	//{
-	//	for (auto i = 0; i < sht->rows.size(); i++)
-	//	{
-	//		UnitData data;
-	//		auto& row = sht->rows[i];
-	//		data.name = sht->get_as_wstr(row, "name"_h);
-	//		data.cost_gold = sht->get_as<uint>(row, "cost_gold"_h);
-	//		data.cost_population = sht->get_as<uint>(row, "cost_population"_h);
-	//		data.HP = sht->get_as<uint>(row, "HP"_h);
-	//		data.ATK = sht->get_as<uint>(row, "ATK"_h);
-	//		data.DEF = sht->get_as<uint>(row, "DEF"_h);
-	//		data.SA = sht->get_as<uint>(row, "SA"_h);
-	//		data.SD = sht->get_as<uint>(row, "SD"_h);
-	//		data.SP = sht->get_as<uint>(row, "SP"_h);
-	//		data.icon = graphics::Image::get(L"assets/icons/troop/" + data.name + L".png");
-	//		unit_datas.push_back(data);
-	//	}
-	//}
-	if (auto sht = Sheet::get(L"assets/pokemon.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			UnitData data;
-			auto& row = sht->rows[i];
-			data.name = sht->get_as_wstr(row, "name"_h);
-			data.cost_gold = sht->get_as<uint>(row, "cost_gold"_h);
-			data.cost_population = sht->get_as<uint>(row, "cost_population"_h);
-			data.evolution_lv = sht->get_as<uint>(row, "evolution_lv"_h);
-			data.stats[StatHP] = sht->get_as<uint>(row, "HP"_h);
-			data.stats[StatATK] = sht->get_as<uint>(row, "ATK"_h);
-			data.stats[StatDEF] = sht->get_as<uint>(row, "DEF"_h);
-			data.stats[StatSA] = sht->get_as<uint>(row, "SA"_h);
-			data.stats[StatSD] = sht->get_as<uint>(row, "SD"_h);
-			data.stats[StatSP] = sht->get_as<uint>(row, "SP"_h);
-			data.type1 = get_pokemon_type_from_name(sht->get_as_wstr(row, "type1"_h));
-			data.type2 = get_pokemon_type_from_name(sht->get_as_wstr(row, "type2"_h));
-			{
-				auto str = sht->get_as_wstr(row, "skillset"_h);
-				for (auto t : SUW::split(str, ','))
-				{
-					auto sp = SUW::split(t, ':');
-					if (sp.size() == 2)
-					{
-						auto lv = s2t<uint>(std::wstring(sp[0]));
-						auto skill_name = std::wstring(sp[1]);
-						auto skill_id = -1;
-						for (auto i = 0; i < skill_datas.size(); i++)
-						{
-							if (skill_datas[i].name == skill_name)
-							{
-								skill_id = i;
-								break;
-							}
-						}
-						if (skill_id != -1)
-							data.skillset.emplace_back(lv, skill_id);
-					}
-				}
-			}
-			{
-				wchar_t buf[32];
-				swprintf(buf, L"%03d", i + 1);
-				data.icon = graphics::Image::get(L"assets/pokemon/" + std::wstring(buf) + L".png");
-			}
-			unit_datas.push_back(data);
-		}
-		for (auto i = 0; i < unit_datas.size(); i++)
-		{
-			auto& unit_data = unit_datas[i];
-			if (unit_data.evolution_lv != 0)
-			{
-				auto& evo_unit_data = unit_datas[i + 1];
-				evo_unit_data.skillset.insert(evo_unit_data.skillset.end(), unit_data.skillset.begin(), unit_data.skillset.end());
-			}
-		}
-		for (auto& unit_data : unit_datas)
-		{
-			for (auto i = 0; i < unit_data.skillset.size(); i++)
-			{
-				auto v = unit_data.skillset[i];
-				for (auto it = unit_data.skillset.begin() + i + 1; it != unit_data.skillset.end(); )
-				{
-					if (it->second == v.second)
-					{
-						if (it->first < v.first)
-							v.first = it->first;
-						it = unit_data.skillset.erase(it);
-					}
-					else
-						it++;
-				}
-			}
-		}
-
-		//auto wtf = network::download_html("https://pokemondb.net/pokedex/mewtwo/moves/1");
-		//pugi::xml_document doc;
-		//auto res = doc.load_buffer(wtf.c_str(), wtf.size());
-		//auto pos = wtf.find("Moves learnt by TM");
-		//int cut = 1;
-	}
-	if (auto sht = Sheet::get(L"assets/building_slots.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			BuildingSlot slot;
-			auto& row = sht->rows[i];
-			slot.pos = sht->get_as<vec2>(row, "pos"_h);
-			slot.radius = sht->get_as<float>(row, "radius"_h);
-			slot.type = get_building_type_from_name(sht->get_as_wstr(row, "building"_h));
-			building_slots.push_back(slot);
-		}
-	}
-	building_slots.push_back({ .type = BuildingTower });
-	building_slots.push_back({ .type = BuildingWall });
-	if (auto sht = Sheet::get(L"assets/town_center.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			TownCenterData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			town_center_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/house.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			HouseData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			data.gold_production = sht->get_as<uint>(row, "gold_production"_h);
-			data.provide_population = sht->get_as<uint>(row, "provide_population"_h);
-			house_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/barracks.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			BarracksData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			barracks_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/park.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			ParkData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			{
-				auto str = sht->get_as_wstr(row, "encounter_list"_h);
-				for (auto t : SUW::split(str, ','))
-				{
-					auto sp = SUW::split(t, ':');
-					if (sp.size() == 2)
-					{
-						auto name = std::wstring(sp[0]);
-						auto weight = s2t<uint>(std::wstring(sp[1]));
-						auto id = -1;
-						for (auto i = 0; i < unit_datas.size(); i++)
-						{
-							if (unit_datas[i].name == name)
-							{
-								id = i;
-								break;
-							}
-						}
-						if (id != -1)
-							data.encounter_list.emplace_back(id, weight);
-					}
-				}
-			}
-			data.capture_num = sht->get_as<uint>(row, "capture_num"_h);
-
-			park_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/training_machine.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			TrainingMachineData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			data.exp = sht->get_as<uint>(row, "exp"_h);
-			training_machine_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/tower.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
-		{
-			TowerData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			tower_datas.push_back(data);
-		}
-	}
-	if (auto sht = Sheet::get(L"assets/wall.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
+		if (!has_event)
 		{
-			WallData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			wall_datas.push_back(data);
+			if (replay_diverged_at == -1 && replay_event_idx != replay_source.events.size())
+				replay_diverged_at = replay_event_idx;
+			if (replay_diverged_at != -1)
+				verify_result = std::format(L"Replay diverged at event {} of {}", replay_diverged_at, replay_source.events.size());
+			replaying = false;
+			replaying_night_battle = false;
+			state = state_before_replay;
+			for (auto i = 0; i < 2; i++)
+			{
+				battle_players[i].replay_units.clear();
+				battle_players[i].unit_displays.clear();
+			}
+			return;
 		}
-	}
-	if (auto sht = Sheet::get(L"assets/woodcutter.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
+		check_event();
+		replay_event_idx++;
+
+		for (auto i = 0; i < 2; i++)
+			battle_players[i].refresh_display();
+
+		auto& action_player = battle_players[event.side];
+		auto& action_units = action_player.get_units();
+		auto& opponent_player = battle_players[1 - event.side];
+		auto& opponent_units = opponent_player.get_units();
+		auto& caster = action_units[event.caster_idx];
+		auto& target = opponent_units[event.target_idx];
+		auto& cast_unit_display = action_player.unit_displays[event.caster_idx];
+		auto& target_unit_display = opponent_player.unit_displays[event.target_idx];
+		target_unit_display.HP = event.target_HP_before;
+		target_unit_display.alpha = 1.f;
+
+		if (auto skill_id = event.skill_id; skill_id != -1)
 		{
-			ResourceFieldData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			resource_field_datas[ResourceWood].push_back(data);
+			auto result = event.result;
+			auto damage = event.damage;
+			auto& target_stat_change = event.target_stat_change;
+
+			{
+				auto id = game.tween->begin_2d_targets();
+				game.tween->add_2d_target(id, &cast_unit_display.pos, nullptr, &cast_unit_display.scl, nullptr);
+				game.tween->add_2d_target(id, nullptr, nullptr, nullptr, &target_unit_display.alpha);
+				game.tween->add_2d_target(id, &target_unit_display.label_pos, nullptr, nullptr, nullptr);
+				game.tween->add_int_target(id, (int*)&target_unit_display.HP);
+				game.tween->scale_to(id, vec2(1.5f), 0.3f * anim_time_scaling);
+				auto target_pos = mix(cast_unit_display.pos, target_unit_display.pos, 0.8f);
+				game.tween->move_to(id, target_pos, 0.3f * anim_time_scaling);
+				game.tween->set_ease(id, EaseInCubic);
+				auto time_cast = game.tween->get_time(id);
+
+				game.tween->set_target(id, 2);
+				game.tween->set_channel(id, 2, time_cast);
+				BattleLogRecord record;
+				record.caster_id = caster.id;
+				record.caster_lv = caster.lv;
+				record.target_id = target.id;
+				record.target_lv = target.lv;
+				record.skill_id = skill_id;
+				record.result = result;
+				record.damage = damage;
+				record.stat_changed = target_stat_change.changed;
+				for (auto i = 0; i < StatCount; i++)
+				{
+					record.stat_stage_before[i] = event.target_stat_stage_before[i];
+					record.stat_change[i] = target_stat_change.stage[i];
+				}
+				game.tween->set_callback(id, [&, record]() {
+					target_unit_display.label = record.format_label();
+					target_unit_display.label_pos = target_unit_display.init_pos + vec2(0.f, -45.f);
+					battle_log.push(record);
+				});
+				game.tween->move_to(id, target_unit_display.init_pos + vec2(0.f, -60.f), 0.4f * anim_time_scaling);
+				game.tween->set_callback(id, [&]() {
+					target_unit_display.label = L"";
+				});
+
+				game.tween->set_target(id, 3);
+				game.tween->set_channel(id, 3, time_cast);
+				game.tween->int_val_to(id, event.target_HP_after, 0.4f * anim_time_scaling);
+
+				if (event.target_HP_after == 0)
+				{
+					game.tween->set_target(id, 1);
+					game.tween->alpha_to(id, 0.f, 0.4f * anim_time_scaling);
+					game.tween->set_ease(id, EaseInCubic);
+				}
+
+				game.tween->set_target(id, 0U);
+				game.tween->set_channel(id, 0, time_cast);
+				game.tween->move_to(id, cast_unit_display.pos, 0.3f * anim_time_scaling);
+				game.tween->set_channel(id, 1, time_cast);
+				game.tween->scale_to(id, vec2(1.f), 0.3f * anim_time_scaling);
+				anim_remain = game.tween->end(id) + 0.1f;
+			}
 		}
 	}
-	if (auto sht = Sheet::get(L"assets/clay_pit.sht"); sht)
+	else if (battle_players[0].city)
 	{
-		for (auto i = 0; i < sht->rows.size(); i++)
+		auto& action_player = battle_players[1];
+
+		if (siege_finishing)
 		{
-			ResourceFieldData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			resource_field_datas[ResourceClay].push_back(data);
+			end_siege(*battle_players[1].troop, *battle_players[0].city, city_damge);
+			city_damge = 0;
+
+			state = GameNight;
+			battle_players[1].troop = nullptr;
+			battle_players[0].city = nullptr;
+			return;
 		}
-	}
-	if (auto sht = Sheet::get(L"assets/iron_mine.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
+
+		if (turbo && siege_order.queue.empty())
 		{
-			ResourceFieldData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			resource_field_datas[ResourceIron].push_back(data);
+			resolve_siege(*battle_players[1].troop, *battle_players[0].city);
+
+			state = GameNight;
+			battle_players[1].troop = nullptr;
+			battle_players[0].city = nullptr;
+			return;
 		}
-	}
-	if (auto sht = Sheet::get(L"assets/crop_field.sht"); sht)
-	{
-		for (auto i = 0; i < sht->rows.size(); i++)
+
+		if (siege_order.queue.empty())
 		{
-			ResourceFieldData data;
-			auto& row = sht->rows[i];
-			data.read(row, sht);
-			resource_field_datas[ResourceCrop].push_back(data);
+			auto& troop = battle_players[1];
+			for (auto i = 0; i < troop.troop->units.size(); i++)
+				siege_order.push({ 1, (uint)i });
 		}
-	}
 
-	if (auto tile_id = search_lord_location(); tile_id != -1)
-	{
-		if (auto id = add_lord(tile_id); id != -1)
+		auto idx = siege_order.pop().idx;
+		auto& caster = action_player.troop->units[idx];
+		auto& cast_unit_display = action_player.unit_displays[idx];
+
 		{
-			auto& lord = lords[id];
-			auto& city = lord.cities.front();
-			//city.add_unit(9); // for testing
-			//city.add_unit(12); // for testing
+			auto id = game.tween->begin_2d_targets();
+			game.tween->add_2d_target(id, &cast_unit_display.pos, nullptr, &cast_unit_display.scl, nullptr);
+			game.tween->add_2d_target(id, &cast_unit_display.label_pos, nullptr, nullptr, nullptr);
+			game.tween->scale_to(id, vec2(1.1f), 0.2f * anim_time_scaling);
+			auto damage = get_siege_damage(caster);
+			game.tween->set_callback(id, [&, damage]() {
+				cast_unit_display.label = wstr(damage);
+				cast_unit_display.label_pos = cast_unit_display.init_pos + vec2(0.f, 5.f);
+			});
+			game.tween->scale_to(id, vec2(1.f), 0.2f * anim_time_scaling);
+			game.tween->set_target(id, 1);
+			game.tween->move_to(id, vec2(450.f, 300.f), 0.5f * anim_time_scaling);
+			game.tween->set_callback(id, [&, damage]() {
+				cast_unit_display.label = L"";
+				city_damge += damage;
+			});
+			game.tween->end(id);
 		}
-	}
-	if (auto tile_id = search_lord_location(); tile_id != -1)
-	{
-		if (auto id = add_lord(tile_id); id != -1)
+
+		if (siege_order.empty())
 		{
-			auto& lord = lords[id];
-			auto& city = lord.cities.front();
-			//city.add_unit(9); // for testing
-			//city.add_unit(12); // for testing
+			siege_finishing = true;
+			anim_remain = 1.5f * anim_time_scaling;
+			return;
 		}
 	}
+}
+
+void Game::init()
+{
+	job_system.init();
+	interface_rng = get_rng(RngInterface);
+
+	create("Werewolf VS Vampire", uvec2(1280, 720), WindowStyleFrame, false, true, 
+		{ {"mesh_shader"_h, 0} });
+
+	auto root = world->root.get();
+	root->add_component<cNode>();
+	camera = root->add_component<cCamera>();
+
+	renderer->add_render_task(RenderModeShaded, camera, main_window, {}, graphics::ImageLayoutPresent);
+	canvas = renderer->render_tasks.front()->canvas;
+	hud->canvas = canvas;
+
+	Path::set_root(L"assets", L"assets");
+
+	img_target = graphics::Image::get(L"assets/icons/target.png");
+	img_tile_frame = graphics::Image::get(L"assets/HexTilesetv3.png_slices/00.png");
+	img_tile_grass = graphics::Image::get(L"assets/HexTilesetv3.png_slices/01.png");
+	img_tile_castle = graphics::Image::get(L"assets/HexTilesetv3.png_slices/216.png");
+	img_city = graphics::Image::get(L"assets/city.png");
+	img_camp = graphics::Image::get(L"assets/camp.png");
+	img_ground = graphics::Image::get(L"assets/ground.png");
+	imgs_building[BuildingTownCenter] = graphics::Image::get(L"assets/town_center.png");
+	imgs_building[BuildingHouse] = graphics::Image::get(L"assets/house.png");
+	//imgs_building[BuildingBarracks] = graphics::Image::get(L"assets/barracks.png");
+	imgs_building[BuildingPark] = graphics::Image::get(L"assets/park.png");
+	imgs_building[BuildingTower] = graphics::Image::get(L"assets/tower.png");
+	imgs_building[BuildingWall] = graphics::Image::get(L"assets/wall.png");
+	img_resources[ResourceWood] = graphics::Image::get(L"assets/icons/wood.png");
+	img_resources[ResourceClay] = graphics::Image::get(L"assets/icons/clay.png");
+	img_resources[ResourceIron] = graphics::Image::get(L"assets/icons/iron.png");
+	img_resources[ResourceCrop] = graphics::Image::get(L"assets/icons/crop.png");
+	img_resources[ResourceGold] = graphics::Image::get(L"assets/icons/gold.png");
+	img_population = graphics::Image::get(L"assets/icons/population.png");
+	img_production = graphics::Image::get(L"assets/icons/production.png");
+	img_be_hit = graphics::Image::get(L"assets/be_hit.png");
+
+	sp_repeat = graphics::Sampler::get(graphics::FilterLinear, graphics::FilterLinear, false, graphics::AddressRepeat);
+
+	battle_players[0].side = 0;
+	battle_players[1].side = 1;
 
-	for (auto i = 0; i < 10; i++)
+	load_world_datas(L"assets");
+	autosave_dir = L"autosave";
+	unit_icons.resize(unit_datas.size());
+	for (auto i = 0; i < unit_datas.size(); i++)
 	{
-		if (auto tile_id = search_neutral_camp_location(); tile_id != -1)
-		{
-			auto n = linearRand(2U, 5U);
-			std::vector<NeutralUnit> units;
-			units.resize(n);
-			for (auto i = 0; i < n; i++)
-			{
-				auto& unit = units[i];
-				std::vector<uint> cands;
-				for (auto id = 9; id < 20; id++)
-				{
-					if (unit_datas[id].evolution_lv != 0 &&
-						unit_datas[id - 1].evolution_lv == 0)
-						cands.push_back(id);
-				}
-				unit.id = cands[linearRand(0U, (uint)cands.size() - 1)];
-				unit.lv = linearRand(5, 10);
-				unit.learn_skills();
-			}
-			auto chest_type = linearRand(0, 100) < 50 ? ChestGold : ChestProduction;
-			auto chest_value = chest_type == ChestGold ? n * 50 + linearRand(0, 100) : 1;
-			add_neutral_camp(tile_id, units, chest_type, chest_value);
-		}
+		wchar_t buf[32];
+		swprintf(buf, L"%03d", i + 1);
+		unit_icons[i] = graphics::Image::get(L"assets/pokemon/" + std::wstring(buf) + L".png");
 	}
+	generate_world();
 
-	new_day();
+	start_day();
 }
 
 void Game::on_render()
@@ -3163,22 +783,24 @@ void Game::on_render()
 		break;
 	}
 
-	for (auto& tile : tiles)
+	auto hovered_tile = pick_tile(mpos);
+	for (auto i = 0; i < tiles.size(); i++)
 	{
-		draw_image(img_tile_grass, tile.pos, vec2(tile_sz, tile_sz_y), vec2(0.f), distance(tile.pos + tile_sz * 0.5f, mpos) < tile_sz * 0.5f ? cvec4(255) : cvec4(230, 230, 230, 255));
-		//canvas->draw_text(nullptr, 16, tile.pos + vec2(10.f), wstr(tile.id), cvec4(255));
+		auto pos = get_tile_pos(i);
+		draw_image(img_tile_grass, pos, vec2(tile_sz, tile_sz_y), vec2(0.f), i == hovered_tile ? cvec4(255) : cvec4(230, 230, 230, 255));
+		//canvas->draw_text(nullptr, 16, pos + vec2(10.f), wstr(i), cvec4(255));
 	}
 	for (auto& lord : lords)
 	{
 		for (auto& city : lord.cities)
 		{
-			auto& tile = tiles[city.tile_id];
-			draw_image(img_city, tile.pos, vec2(tile_sz, tile_sz_y));
-			draw_text(wstr(city.loyalty), 20, tile.pos + vec2(tile_sz, tile_sz_y) * 0.5f + vec2(0.f, -20.f), vec2(0.5f), hsv(lord.id * 60.f, 0.5f, 1.f, 1.f), vec2(1.f), cvec4(0, 0, 0, 255));
+			auto pos = get_tile_pos(city.tile_id);
+			draw_image(img_city, pos, vec2(tile_sz, tile_sz_y));
+			draw_text(wstr(city.loyalty), 20, pos + vec2(tile_sz, tile_sz_y) * 0.5f + vec2(0.f, -20.f), vec2(0.5f), hsv(lord.id * 60.f, 0.5f, 1.f, 1.f), vec2(1.f), cvec4(0, 0, 0, 255));
 		}
 		for (auto& field : lord.resource_fields)
 		{
-			auto pos = tiles[field.tile_id].pos + vec2(tile_sz, tile_sz_y) * 0.5f;
+			auto pos = get_tile_pos(field.tile_id) + vec2(tile_sz, tile_sz_y) * 0.5f;
 			draw_image(img_resources[field.type], pos, vec2(36.f, 24.f), vec2(0.5f));
 		}
 		//{
@@ -3188,7 +810,7 @@ void Game::on_render()
 		//		auto& tile = tiles[id];
 		//		vec2 pos[6];
 		//		for (auto i = 0; i < 6; i++)
-		//			pos[i] = arc_point(tile.pos + vec2(tile_sz, tile_sz_y) * 0.5f, i * 60.f, tile_sz * 0.5f);
+		//			pos[i] = arc_point(get_tile_pos(id) + vec2(tile_sz, tile_sz_y) * 0.5f, i * 60.f, tile_sz * 0.5f);
 		//		if (tile.tile_rb == -1 || !lord.has_territory(tile.tile_rb))
 		//			make_line_strips<2>(pos[0], pos[1], strips);
 		//		if (tile.tile_b == -1 || !lord.has_territory(tile.tile_b))
@@ -3211,7 +833,7 @@ void Game::on_render()
 				for (auto i = 0; i <= path_idx; i++)
 				{
 					auto id = path[i];
-					canvas->path.push_back(tiles[id].pos + vec2(tile_sz) * 0.5f);
+					canvas->path.push_back(get_tile_pos(id) + vec2(tile_sz) * 0.5f);
 				}
 				if (!canvas->path.empty() && distance(canvas->path.back(), end_pos) > 1.f)
 					canvas->path.push_back(end_pos);
@@ -3223,8 +845,8 @@ void Game::on_render()
 				{
 					if (abs(int(i * 4 + j - troop_anim_time * 12.f) % 20) < 4)
 					{
-						auto a = tiles[path[i]].pos;
-						auto b = tiles[path[i + 1]].pos;
+						auto a = get_tile_pos(path[i]);
+						auto b = get_tile_pos(path[i + 1]);
 						canvas->draw_circle_filled(mix(a, b, j / 4.f) + vec2(tile_sz) * 0.5f, 3.f, hsv(lord.id * 60.f, 0.5f, 0.8f, 0.8f));
 					}
 				}
@@ -3247,14 +869,14 @@ void Game::on_render()
 		}
 		for (auto& troop : lord.troop_instances)
 		{
-			draw_troop_path(troop.path, troop.path_idx, troop.pos);
+			draw_troop_path(troop.path, troop.move_t < 1.f ? troop.path_idx - 1 : troop.path_idx, get_troop_pos(troop));
 			//if (!troop.units.empty())
 			//{
 			//	auto n = troop.units.size();
 			//	if (n == 1)
 			//	{
 			//		auto& unit_data = unit_datas[troop.units[0].id];
-			//		draw_image(unit_data.icon, troop.pos, vec2(tile_sz) * 0.33f, vec2(0.5f));
+			//		draw_image(unit_data.icon, get_troop_pos(troop), vec2(tile_sz) * 0.33f, vec2(0.5f));
 			//	}
 			//	else
 			//	{
@@ -3266,23 +888,15 @@ void Game::on_render()
 	}
 	for (auto& camp : neutral_camps)
 	{
-		auto& tile = tiles[camp.tile_id];
-		draw_image(img_camp, tile.pos + vec2(tile_sz, tile_sz_y) * 0.5f, vec2(tile_sz, tile_sz_y) * 0.7f, vec2(0.5f));
+		draw_image(img_camp, get_tile_pos(camp.tile_id) + vec2(tile_sz, tile_sz_y) * 0.5f, vec2(tile_sz, tile_sz_y) * 0.7f, vec2(0.5f));
 	}
 
 	if (!hud->is_modal())
 	{
 		if (input->mpressed(Mouse_Left))
 		{
-			for (auto i = 0; i < tiles.size(); i++)
-			{
-				auto& tile = tiles[i];
-				if (distance(tile.pos + tile_sz * 0.5f, mpos) < tile_sz * 0.5f)
-				{
-					selected_tile = i;
-					break;
-				}
-			}
+			if (hovered_tile != -1)
+				selected_tile = hovered_tile;
 		}
 	}
 
@@ -3505,7 +1119,7 @@ void Game::on_render()
 							auto& slot = building_slots[i];
 							if (slot.type != BuildingTypeCount && slot.type > BuildingInTownEnd)
 								break;
-							if (distance(mpos, c + slot.pos) < slot.radius)
+							if (distance(mpos, c + vec2(slot.pos_x, slot.pos_y)) < slot.radius)
 							{
 								hovering_slot = i;
 								ok = true;
@@ -3583,12 +1197,12 @@ void Game::on_render()
 						if (slot.type != BuildingTypeCount)
 						{
 							auto img = imgs_building[slot.type];
-							draw_image(img, c + slot.pos, vec2(img->extent) * 0.5f, vec2(0.5f, 0.8f), col);
+							draw_image(img, c + vec2(slot.pos_x, slot.pos_y), vec2(img->extent) * 0.5f, vec2(0.5f, 0.8f), col);
 						}
 						else
 						{
 							auto img = imgs_building[BuildingHouse];
-							draw_image(img, c + slot.pos, vec2(img->extent) * 0.5f, vec2(0.5f, 0.8f), col);
+							draw_image(img, c + vec2(slot.pos_x, slot.pos_y), vec2(img->extent) * 0.5f, vec2(0.5f, 0.8f), col);
 						}
 					}
 
@@ -3633,9 +1247,8 @@ void Game::on_render()
 							hud->begin_layout(HudHorizontal);
 							for (auto i = 0; i < encounter_list.size(); i++)
 							{
-								auto& unit_data = unit_datas[encounter_list[i].first];
-								if (unit_data.icon)
-									hud->image(vec2(48.f), unit_data.icon);
+								if (unit_icons[encounter_list[i].first])
+									hud->image(vec2(48.f), unit_icons[encounter_list[i].first]);
 
 							}
 							hud->end_layout();
@@ -3772,10 +1385,10 @@ void Game::on_render()
 					{
 						auto& capture = city.captures[i];
 						auto& unit_data = unit_datas[capture.unit_id];
-						if (unit_data.icon)
+						if (unit_icons[capture.unit_id])
 						{
 							hud->begin_layout(HudVertical);
-							hud->image_button(vec2(64.f), unit_data.icon);
+							hud->image_button(vec2(64.f), unit_icons[capture.unit_id]);
 							if (hud->item_hovered())
 								hovered_unit = i;
 							const auto scl = 0.7f;
@@ -3820,9 +1433,9 @@ void Game::on_render()
 					{
 						auto& unit = city.units[i];
 						auto& unit_data = unit_datas[unit.id];
-						if (unit_data.icon)
+						if (unit_icons[unit.id])
 						{
-							if (hud->image_button(vec2(size), unit_data.icon))
+							if (hud->image_button(vec2(size), unit_icons[unit.id]))
 								selected_unit = i;
 							if (hud->item_hovered())
 								hovered_unit = i;
@@ -3868,6 +1481,7 @@ void Game::on_render()
 										}
 										unit.skills[i] = skill_id;
 									}
+									city.dirty = true;
 								}
 							}
 							if (hud->item_clicked())
@@ -3904,7 +1518,10 @@ void Game::on_render()
 												n++;
 										}
 										if (n > 1)
+										{
 											unit.skills[dragging_skill - 1001] = -1;
+											city.dirty = true;
+										}
 									}
 								}
 							}
@@ -3976,6 +1593,7 @@ void Game::on_render()
 											{
 												_troop.units.erase(_troop.units.begin() + j);
 												troop.units.push_back(dragging_unit);
+												city.dirty = true;
 												ok = true;
 												break;
 											}
@@ -3997,10 +1615,9 @@ void Game::on_render()
 						{
 							auto idx = troop.units[i];
 							auto& unit = city.units[idx];
-							auto& unit_data = unit_datas[unit.id];
-							if (unit_data.icon)
+							if (unit_icons[unit.id])
 							{
-								if (hud->image_button(vec2(size), unit_data.icon))
+								if (hud->image_button(vec2(size), unit_icons[unit.id]))
 								{
 									if (idx != 0)
 										dragging_unit = idx;
@@ -4042,7 +1659,7 @@ void Game::on_render()
 							if (hud->image_button(vec2(32.f), img_target))
 								dragging_target = tidx;
 							if (hud->item_hovered())
-								draw_image(img_target, tiles[troop.target].pos + vec2(tile_sz) * 0.5f, vec2(32.f), vec2(0.5f, 0.5f), cvec4(255, 255, 255, 200));
+								draw_image(img_target, get_tile_pos(troop.target) + vec2(tile_sz) * 0.5f, vec2(32.f), vec2(0.5f, 0.5f), cvec4(255, 255, 255, 200));
 						}
 						hud->end_layout();
 					};
@@ -4054,7 +1671,7 @@ void Game::on_render()
 						show_troop(i);
 					if (hud->button(L"New"))
 					{
-						if (auto target_city = search_random_hostile_city(lord.id); target_city)
+						if (auto target_city = search_random_hostile_city(lord.id, interface_rng); target_city)
 						{
 							auto& troop = city.troops.emplace_back();
 							city.set_troop_target(troop, target_city ? target_city->tile_id : city.tile_id);
@@ -4075,15 +1692,11 @@ void Game::on_render()
 						dragging_unit = -1;
 						if (dragging_target != -1)
 						{
-							for (auto i = 0; i < tiles.size(); i++)
+							if (auto i = pick_tile(mpos); i != -1)
 							{
 								auto& tile = tiles[i];
-								if (distance(tile.pos + tile_sz * 0.5f, mpos) < tile_sz * 0.5f)
-								{
-									if (tile.idx1 != main_player_id && (tile.type == TileCity || tile.type == TileNeutralCamp))
-										city.set_troop_target(city.troops[dragging_target], i);
-									break;
-								}
+								if (tile.idx1 != main_player_id && (tile.type == TileCity || tile.type == TileNeutralCamp))
+									city.set_troop_target(city.troops[dragging_target], i);
 							}
 						}
 						dragging_target = -1;
@@ -4091,9 +1704,8 @@ void Game::on_render()
 					if (dragging_unit != -1)
 					{
 						auto& unit = city.units[dragging_unit];
-						auto& unit_data = unit_datas[unit.id];
-						if (unit_data.icon)
-							draw_image(unit_data.icon, mpos, vec2(64.f), vec2(0.5f, 0.5f), cvec4(255, 255, 255, 127));
+						if (unit_icons[unit.id])
+							draw_image(unit_icons[unit.id], mpos, vec2(64.f), vec2(0.5f, 0.5f), cvec4(255, 255, 255, 127));
 					}
 					if (dragging_target != -1)
 						draw_image(img_target, mpos, vec2(32.f), vec2(0.5f, 0.5f), cvec4(255, 255, 255, 127));
@@ -4115,10 +1727,9 @@ void Game::on_render()
 			for (auto i = 0; i < camp.units.size(); i++)
 			{
 				auto& unit = camp.units[i];
-				auto& unit_data = unit_datas[unit.id];
 				hud->begin_layout(HudVertical);
-				if (unit_data.icon)
-					hud->image(vec2(48.f), unit_data.icon);
+				if (unit_icons[unit.id])
+					hud->image(vec2(48.f), unit_icons[unit.id]);
 				hud->text(wstr(unit.lv), 16);
 				hud->end_layout();
 			}
@@ -4197,92 +1808,112 @@ void Game::on_render()
 	hud->end();
 
 	static bool show_cheat = false;
-	hud->begin("top-right"_h, vec2(screen_size.x - 300.f, 30.f), vec2(0.f, 0.f), cvec4(0, 0, 0, 255));
+	hud->begin("top-right"_h, vec2(screen_size.x - 480.f, 30.f), vec2(0.f, 0.f), cvec4(0, 0, 0, 255));
 	hud->begin_layout(HudHorizontal);
 	if (hud->button(L"Cheat"))
 		show_cheat = !show_cheat;
+	// saves are written on the save thread, a load waits for them so it reads what was saved last
 	if (hud->button(L"Save"))
+		save_world_async(L"1.bin");
+	if (hud->button(L"Load"))
 	{
-		pugi::xml_document doc;
-		auto doc_root = doc.append_child("save");
-		auto n_lords = doc_root.append_child("lords");
-		for (auto& lord : lords)
-		{
-			auto n_lord = n_lords.append_child("lord");
-			n_lord.append_attribute("gold").set_value(lord.resources[ResourceGold]);
-			auto n_cities = n_lord.append_child("cities");
-			for (auto& city : lord.cities)
+		finish_saves();
+		if (state == GameDay && load_world(L"1.bin"))
+			interface_rng = get_rng(RngInterface);
+	}
+	if (hud->button(L"Recover"))
+	{
+		if (state == GameDay && load_autosave())
+			interface_rng = get_rng(RngInterface);
+	}
+	// the xml save is kept to read and edit saves by hand
+	if (hud->button(L"Export"))
+	{
+		submit_save_task([snapshot = take_world_snapshot()]() {
+			pugi::xml_document doc;
+			auto doc_root = doc.append_child("save");
+			doc_root.append_attribute("seed").set_value(snapshot->seed);
+			doc_root.append_attribute("day").set_value(snapshot->day);
+			auto n_lords = doc_root.append_child("lords");
+			for (auto& lord : snapshot->lords)
 			{
-				auto n_city = n_cities.append_child("city");
-				n_city.append_attribute("tile_id").set_value(city.tile_id);
-				n_city.append_attribute("loyalty").set_value(city.loyalty);
-				n_city.append_attribute("production").set_value(city.production);
-				auto n_buildings = n_city.append_child("buildings");
-				for (auto& building : city.buildings)
-				{
-					auto n_building = n_buildings.append_child("building");
-					n_building.append_attribute("slot").set_value(building.slot);
-					n_building.append_attribute("type").set_value(building.type);
-					n_building.append_attribute("lv").set_value(building.lv);
-				}
-				auto n_captures = n_city.append_child("captures");
-				for (auto& capture : city.captures)
+				auto n_lord = n_lords.append_child("lord");
+				n_lord.append_attribute("gold").set_value(lord.resources[ResourceGold]);
+				auto n_cities = n_lord.append_child("cities");
+				for (auto& city : lord.cities)
 				{
-					auto n_capture = n_captures.append_child("capture");
-					n_capture.append_attribute("unit_id").set_value(capture.unit_id);
-					n_capture.append_attribute("exclusive_id").set_value(capture.exclusive_id);
-					n_capture.append_attribute("lv").set_value(capture.lv);
-					n_capture.append_attribute("cost_gold").set_value(capture.cost_gold);
+					auto n_city = n_cities.append_child("city");
+					n_city.append_attribute("tile_id").set_value(city.tile_id);
+					n_city.append_attribute("loyalty").set_value(city.loyalty);
+					n_city.append_attribute("production").set_value(city.production);
+					auto n_buildings = n_city.append_child("buildings");
+					for (auto& building : city.buildings)
+					{
+						auto n_building = n_buildings.append_child("building");
+						n_building.append_attribute("slot").set_value(building.slot);
+						n_building.append_attribute("type").set_value(building.type);
+						n_building.append_attribute("lv").set_value(building.lv);
+					}
+					auto n_captures = n_city.append_child("captures");
+					for (auto& capture : city.captures)
+					{
+						auto n_capture = n_captures.append_child("capture");
+						n_capture.append_attribute("unit_id").set_value(capture.unit_id);
+						n_capture.append_attribute("exclusive_id").set_value(capture.exclusive_id);
+						n_capture.append_attribute("lv").set_value(capture.lv);
+						n_capture.append_attribute("cost_gold").set_value(capture.cost_gold);
+					}
+					auto n_units = n_city.append_child("units");
+					for (auto& unit : city.units)
+					{
+						auto n_unit = n_units.append_child("unit");
+						n_unit.append_attribute("id").set_value(unit.id);
+						n_unit.append_attribute("lv").set_value(unit.lv);
+						n_unit.append_attribute("exp").set_value(unit.exp);
+						auto n_skills = n_unit.append_child("skills");
+						for (auto i = 0; i < 4; i++)
+							n_skills.append_child("skill").append_attribute("v").set_value(unit.skills[i]);
+						auto n_learnt_skills = n_unit.append_child("learnt_skills");
+						for (auto i = 0; i < unit.learnt_skills.size(); i++)
+							n_learnt_skills.append_child("skill").append_attribute("v").set_value(unit.learnt_skills[i]);
+					}
+					auto n_troops = n_city.append_child("troops");
+					for (auto& troop : city.troops)
+					{
+						auto n_troop = n_troops.append_child("troop");
+						n_troop.append_attribute("target").set_value(troop.target);
+						auto n_units = n_troop.append_child("units");
+						for (auto i = 0; i < troop.units.size(); i++)
+							n_units.append_child("unit").append_attribute("v").set_value(troop.units[i]);
+					}
 				}
-				auto n_units = n_city.append_child("units");
-				for (auto& unit : city.units)
+			}
+			auto n_camps = doc_root.append_child("neutral_camps");
+			for (auto& camp : snapshot->neutral_camps)
+			{
+				auto n_camp = n_camps.append_child("neutral_camp");
+				n_camp.append_attribute("tile_id").set_value(camp.tile_id);
+				auto n_units = n_camp.append_child("units");
+				for (auto& unit : camp.units)
 				{
 					auto n_unit = n_units.append_child("unit");
 					n_unit.append_attribute("id").set_value(unit.id);
 					n_unit.append_attribute("lv").set_value(unit.lv);
-					n_unit.append_attribute("exp").set_value(unit.exp);
 					auto n_skills = n_unit.append_child("skills");
 					for (auto i = 0; i < 4; i++)
 						n_skills.append_child("skill").append_attribute("v").set_value(unit.skills[i]);
-					auto n_learnt_skills = n_unit.append_child("learnt_skills");
-					for (auto i = 0; i < unit.learnt_skills.size(); i++)
-						n_learnt_skills.append_child("skill").append_attribute("v").set_value(unit.learnt_skills[i]);
-				}
-				auto n_troops = n_city.append_child("troops");
-				for (auto& troop : city.troops)
-				{
-					auto n_troop = n_troops.append_child("troop");
-					n_troop.append_attribute("target").set_value(troop.target);
-					auto n_units = n_troop.append_child("units");
-					for (auto i = 0; i < troop.units.size(); i++)
-						n_units.append_child("unit").append_attribute("v").set_value(troop.units[i]);
 				}
+				n_camp.append_attribute("chest_type").set_value(camp.chest.type);
+				n_camp.append_attribute("chest_value").set_value(camp.chest.value);
 			}
-		}
-		auto n_camps = doc_root.append_child("neutral_camps");
-		for (auto& camp : neutral_camps)
-		{
-			auto n_camp = n_camps.append_child("neutral_camp");
-			n_camp.append_attribute("tile_id").set_value(camp.tile_id);
-			auto n_units = n_camp.append_child("units");
-			for (auto& unit : camp.units)
-			{
-				auto n_unit = n_units.append_child("unit");
-				n_unit.append_attribute("id").set_value(unit.id);
-				n_unit.append_attribute("lv").set_value(unit.lv);
-				auto n_skills = n_unit.append_child("skills");
-				for (auto i = 0; i < 4; i++)
-					n_skills.append_child("skill").append_attribute("v").set_value(unit.skills[i]);
-			}
-			n_camp.append_attribute("chest_type").set_value(camp.chest.type);
-			n_camp.append_attribute("chest_value").set_value(camp.chest.value);
-		}
 
-		auto filename = std::filesystem::path(L"1.save");
-		doc.save_file(filename.c_str());
+			auto filename = std::filesystem::path(L"1.save");
+			doc.save_file(filename.c_str());
+		});
 	}
-	if (hud->button(L"Load"))
+	if (hud->button(L"Import"))
 	{
+		finish_saves();
 		if (state == GameDay)
 		{
 			pugi::xml_document doc;
@@ -4293,13 +1924,11 @@ void Game::on_render()
 			{
 				if (doc.load_file(filename.c_str()) && (doc_root = doc.first_child()).name() == std::string("save"))
 				{
-					lords.clear();
-					neutral_camps.clear();
-					for (auto& tile : tiles)
-					{
-						tile.type = TileField;
-						tile.idx1 = tile.idx2 = -1;
-					}
+					if (auto a = doc_root.attribute("seed"); a)
+						game_seed = a.as_ullong();
+					current_day = doc_root.attribute("day").as_uint();
+					interface_rng = get_rng(RngInterface);
+					clear_world();
 
 					auto lord_id = 0;
 					for (auto n_lord : doc_root.child("lords"))
@@ -4380,6 +2009,8 @@ void Game::on_render()
 			}
 		}
 	}
+	if (is_saving())
+		hud->text(L"Saving...");
 	hud->end_layout();
 	if (show_cheat)
 	{
@@ -4398,6 +2029,8 @@ void Game::on_render()
 			if (it != time_scalings)
 				anim_time_scaling = *(it - 1);
 		}
+		if (hud->button(turbo ? L"Turbo: On" : L"Turbo: Off"))
+			turbo = !turbo;
 		hud->end_layout();
 
 		static uint exp_multipliers[] = {1, 2, 5, 10, 100};
@@ -4450,6 +2083,73 @@ void Game::on_render()
 				city_damage_multiplier = *(it - 1);
 		}
 		hud->end_layout();
+
+		if (state == GameBattle && is_unit_battle())
+		{
+			if (estimate_job && estimate_job->done())
+			{
+				battle_estimate = *pending_estimate;
+				estimate_job.reset();
+				pending_estimate.reset();
+			}
+			if (estimate_job)
+				hud->text(L"Estimating...", 18);
+			else if (hud->button(L"Estimate Battle"))
+			{
+				// runs on the job system while the battle keeps playing, so the units of the start of the battle are copied
+				pending_estimate = std::make_shared<BattleEstimate>();
+				estimate_job = job_system.submit_background([units0 = replay_source.units[0], units1 = replay_source.units[1], result = pending_estimate](uint) {
+					auto get_defeat_gain_exp = [](const std::vector<UnitInstance>& units) {
+						uint ret = 0;
+						for (auto& unit : units)
+							ret += calc_gain_exp(unit.lv);
+						return ret;
+					};
+					*result = estimate_battle(units0, get_defeat_gain_exp(units0), units1, get_defeat_gain_exp(units1), 10000, game_seed);
+				});
+			}
+			if (auto& estimate = battle_estimate; estimate.runs > 0)
+			{
+				for (auto i = 0; i < 2; i++)
+				{
+					hud->text(std::format(L"Side {}: Win {:.1f}% +-{:.1f}%, HP {:.0f} +-{:.0f}, Exp {:.0f} +-{:.0f}", i,
+						estimate.win_rate[i] * 100.f, estimate.win_rate_ci[i] * 100.f, estimate.surviving_HP[i], estimate.surviving_HP_ci[i],
+						estimate.gain_exp[i], estimate.gain_exp_ci[i]), 18);
+				}
+			}
+		}
+
+		if (state != GameBattle && !last_replay.events.empty())
+		{
+			if (hud->button(L"Replay Last Battle"))
+				start_replay(last_replay);
+		}
+		{
+			if (hud->button(L"Verify Replays"))
+			{
+				auto passed = 0, failed = 0;
+				if (std::filesystem::exists(L"replays"))
+				{
+					std::vector<std::filesystem::path> paths;
+					for (auto& entry : std::filesystem::directory_iterator(L"replays"))
+						paths.push_back(entry.path());
+					auto results = job_system.map<uint8_t>(paths.size(), [&](uint idx, uint) {
+						BattleReplay replay;
+						return replay.load(paths[idx]) && verify_replay(replay);
+					});
+					for (auto ok : results)
+					{
+						if (ok)
+							passed++;
+						else
+							failed++;
+					}
+				}
+				verify_result = std::format(L"Replays: {} passed, {} failed", passed, failed);
+			}
+			if (!verify_result.empty())
+				hud->text(verify_result, 18);
+		}
 	}
 	hud->end();
 
@@ -4457,7 +2157,7 @@ void Game::on_render()
 	if (state == GameDay)
 	{
 		if (hud->button(L"Start Battle"))
-			start_battle();
+			start_night();
 	}
 	hud->end();
 
@@ -4468,7 +2168,7 @@ void Game::on_render()
 				return player.troop->lord_id;
 			if (player.city)
 				return player.city->lord_id;
-			return 5U;
+			return player.replay_lord_id;
 		};
 
 		hud->begin("battle"_h, vec2(100.f, 150.f), vec2(0.f), cvec4(0, 0, 0, 255), vec2(0.f), {}, vec4(0.f), true);
@@ -4476,14 +2176,15 @@ void Game::on_render()
 		hud->begin_layout(HudVertical, vec2(0.f), vec2(0.f));
 		hud->rect(vec2(750.f, 100.f), hsv(get_lord_id(battle_players[1]) * 60.f, 0.5f, 0.5f, 1.f));
 		hud->rect(vec2(750.f, 100.f), hsv(get_lord_id(battle_players[0]) * 60.f, 0.5f, 0.5f, 1.f));
-		if ((battle_players[0].troop || battle_players[0].camp) && battle_players[1].troop)
+		if (is_unit_battle())
 		{
-			for (auto& log : battle_log)
-				hud->text(log, 20);
+			for (auto i = 0; i < battle_log.size(); i++)
+				hud->text(battle_log[i].format_log(), 20);
 		}
 		hud->end_layout();
 
-		auto hovered_unit = -1;
+		auto hovered_side = -1;
+		auto hovered_idx = -1;
 
 		for (auto i = 0; i < 2; i++)
 		{
@@ -4492,16 +2193,20 @@ void Game::on_render()
 			{
 				auto& unit = player.get_units()[j];
 				auto& display = player.unit_displays[j];
-				auto& unit_data = unit_datas[display.unit_id];
+				if (unit.stats[StatHP] == 0 && display.alpha <= 0.f)
+					continue;
 				auto sz = vec2(64.f) * display.scl.x;
-				if (unit_data.icon)
-					draw_image(unit_data.icon, display.pos, sz, vec2(0.5f, 1.f), cvec4(255, 255, 255, 255 * display.alpha));
+				if (unit_icons[display.unit_id])
+					draw_image(unit_icons[display.unit_id], display.pos, sz, vec2(0.5f, 1.f), cvec4(255, 255, 255, 255 * display.alpha));
 				Rect rect;
 				rect.a = display.init_pos - sz * vec2(0.5f, 1.f);
 				rect.b = rect.a + sz;
 				if (rect.contains(mpos))
-					hovered_unit = i * 100 + j;
-				if ((battle_players[0].troop || battle_players[0].camp) && battle_players[1].troop)
+				{
+					hovered_side = i;
+					hovered_idx = j;
+				}
+				if (is_unit_battle())
 				{
 					draw_rect(display.init_pos + vec2(-20.f, 5.f), vec2(40.f, 5.f), vec2(0.f), cvec4(150, 150, 150, 255));
 					draw_rect(display.init_pos + vec2(-20.f, 5.f), vec2(40.f * ((float)display.HP / (float)unit.HP_MAX), 5.f), vec2(0.f), cvec4(0, 255, 0, 255));
@@ -4515,10 +2220,10 @@ void Game::on_render()
 		if (city_damge > 0)
 			draw_text(wstr(city_damge), 20, vec2(450.f, 300.f), vec2(0.5f, 0.f), cvec4(255, 255, 255, 255), vec2(1.f), cvec4(0, 0, 0, 255));
 
-		if (hovered_unit != -1)
+		if (hovered_side != -1)
 		{
-			auto i = hovered_unit / 100;
-			auto j = hovered_unit % 100;
+			auto i = hovered_side;
+			auto j = hovered_idx;
 
 			auto& player = battle_players[i];
 			auto& unit = player.get_units()[j];
@@ -4628,55 +2333,7 @@ void Game::on_render()
 				if (unit_displays.empty())
 				{
 					step = StepEnd;
-
-					for (auto& lord : lords)
-					{
-						for (auto& city : lord.cities)
-						{
-							for (auto& unit : city.units)
-							{
-								auto old_lv = unit.lv;
-								unit.exp += unit.gain_exp;
-								unit.gain_exp = 0;
-								auto next_lv_exp = calc_exp(unit.lv + 1);
-
-								while (true)
-								{
-									if (unit.exp < next_lv_exp)
-										break;
-									unit.lv++;
-									next_lv_exp = calc_exp(unit.lv + 1);
-								}
-
-								if (unit.lv != old_lv)
-								{
-									while (true)
-									{
-										auto& unit_data = unit_datas[unit.id];
-										if (unit_data.evolution_lv != 0 && unit.lv >= unit_data.evolution_lv)
-											unit.id = unit.id + 1;
-										else
-											break;
-									}
-
-									unit.learn_skills();
-									if (lord.id != main_player_id)
-									{
-										for (auto i = 0; i < 4; i++)
-											unit.skills[i] = -1;
-										auto n = 0;
-										for (auto it = unit.learnt_skills.rbegin(); it != unit.learnt_skills.rend(); it++)
-										{
-											if (n >= 4)
-												break;
-											unit.skills[n] = *it;
-											n++;
-										}
-									}
-								}
-							}
-						}
-					}
+					apply_gained_exp();
 				}
 				break;
 			}
@@ -4757,8 +2414,8 @@ void Game::on_render()
 				auto& old_unit_data = unit_datas[display.old_id];
 				auto& unit_data = unit_datas[display.id];
 				hud->begin_layout(HudVertical);
-				if (unit_data.icon)
-					hud->image(vec2(64.f), unit_data.icon);
+				if (unit_icons[display.id])
+					hud->image(vec2(64.f), unit_icons[display.id]);
 				hud->rect(vec2(40.f, 5.f), cvec4(150, 150, 150, 255));
 				hud->set_cursor(hud->item_rect().a);
 				hud->rect(vec2(40.f * ((float)display.lv_exp / (float)display.lv_exp_max), 5.f), cvec4(0, 0, 255, 255));
@@ -4848,6 +2505,13 @@ int entry(int argc, char** args)
 		//}
 	}
 
+	game_seed = time(0);
+	for (auto i = 1; i < argc; i++)
+	{
+		if (std::string_view(args[i]) == "-seed" && i + 1 < argc)
+			game_seed = std::stoull(args[++i]);
+	}
+
 	game.init();
 	game.run();
 
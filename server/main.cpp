@@ -0,0 +1,158 @@
+// headless game, plays whole days without a window:
+//  wvv_server [-seed n] [-days n] [-map WxH] [-lords n] [-camps n] [-assets dir] [-threads n] [-load file] [-save file]
+//  [-autosave dir] [-load-autosave dir] [-ai-all] [-build-pack]
+// the main player does nothing unless -ai-all is given, every day prints one line per lord.
+//  -load continues a binary save instead of generating a world, -save writes one after the last day.
+//  -autosave journals every day into dir, -load-autosave continues from what is in dir.
+//  -build-pack compiles the sheets of the assets into data.pack next to them and quits
+
+#include "../cpp/core/world.h"
+#include "../cpp/core/jobs.h"
+#include "../cpp/core/save.h"
+#include "../cpp/core/autosave.h"
+#include "../cpp/core/datapack.h"
+
+#include <cstdio>
+
+void print_day()
+{
+	for (auto& lord : lords)
+	{
+		uint units = 0;
+		uint max_lv = 0;
+		uint loyalty = 0;
+		for (auto& city : lord.cities)
+		{
+			units += city.units.size();
+			for (auto& unit : city.units)
+				max_lv = std::max(max_lv, unit.lv);
+			loyalty += city.loyalty;
+		}
+		printf("day %u lord %u: cities %u loyalty %u gold %u units %u max_lv %u\n", current_day, lord.id, (uint)lord.cities.size(), loyalty,
+			lord.resources[ResourceGold], units, max_lv);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path assets_path = "assets";
+	std::filesystem::path load_path;
+	std::filesystem::path save_path;
+	std::filesystem::path recover_path;
+	auto days = 30U;
+	auto lord_count = 2U;
+	auto camp_count = 10U;
+	auto num_threads = 0U;
+	auto build_pack = false;
+	game_seed = time(0);
+	for (auto i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+		if (arg == "-seed" && i + 1 < argc)
+			game_seed = std::stoull(argv[++i]);
+		else if (arg == "-days" && i + 1 < argc)
+			days = std::max(1, atoi(argv[++i]));
+		else if (arg == "-map" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%ux%u", &tile_cx, &tile_cy) != 2 || tile_cx < MIN_MAP_SIZE || tile_cy < MIN_MAP_SIZE ||
+				tile_cx > MAX_MAP_SIZE || tile_cy > MAX_MAP_SIZE)
+			{
+				fprintf(stderr, "bad map size %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (arg == "-lords" && i + 1 < argc)
+			lord_count = std::max(1, atoi(argv[++i]));
+		else if (arg == "-camps" && i + 1 < argc)
+			camp_count = std::max(0, atoi(argv[++i]));
+		else if (arg == "-assets" && i + 1 < argc)
+			assets_path = argv[++i];
+		else if (arg == "-threads" && i + 1 < argc)
+			num_threads = std::max(1, atoi(argv[++i]));
+		else if (arg == "-load" && i + 1 < argc)
+			load_path = argv[++i];
+		else if (arg == "-save" && i + 1 < argc)
+			save_path = argv[++i];
+		else if (arg == "-autosave" && i + 1 < argc)
+			autosave_dir = argv[++i];
+		else if (arg == "-load-autosave" && i + 1 < argc)
+			recover_path = argv[++i];
+		else if (arg == "-ai-all")
+			main_player_ai = true;
+		else if (arg == "-build-pack")
+			build_pack = true;
+	}
+
+	if (build_pack)
+	{
+		if (!load_world_sheets(assets_path) || !build_data_pack(assets_path))
+		{
+			fprintf(stderr, "cannot build the data pack of %s\n", assets_path.string().c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	job_system.init(num_threads);
+
+	if (!load_world_datas(assets_path))
+	{
+		fprintf(stderr, "cannot load sheets from %s\n", assets_path.string().c_str());
+		return 1;
+	}
+	record_replays = false;
+
+	if (!recover_path.empty())
+	{
+		// autosave_dir may point elsewhere, the recovered world journals into that one
+		auto dir = autosave_dir;
+		autosave_dir = recover_path;
+		auto ok = load_autosave();
+		autosave_dir = dir;
+		if (!ok)
+		{
+			fprintf(stderr, "cannot recover from %s\n", recover_path.string().c_str());
+			return 1;
+		}
+		printf("seed %llu\n", (unsigned long long)game_seed);
+	}
+	else if (!load_path.empty())
+	{
+		if (!load_world(load_path))
+		{
+			fprintf(stderr, "cannot load %s\n", load_path.string().c_str());
+			return 1;
+		}
+		printf("seed %llu\n", (unsigned long long)game_seed);
+	}
+	else
+	{
+		printf("seed %llu\n", (unsigned long long)game_seed);
+		generate_world(lord_count, camp_count);
+		if (lords.empty())
+		{
+			fprintf(stderr, "no room for the lords on the map\n");
+			return 1;
+		}
+		new_day();
+	}
+	for (auto i = 0; i < days; i++)
+	{
+		run_night();
+		print_day();
+		if (game_over)
+		{
+			printf(victory ? "victory\n" : "defeat\n");
+			break;
+		}
+		new_day();
+	}
+
+	finish_autosave();
+	if (!save_path.empty() && !save_world(save_path))
+	{
+		fprintf(stderr, "cannot save %s\n", save_path.string().c_str());
+		return 1;
+	}
+	return 0;
+}